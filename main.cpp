@@ -32,6 +32,25 @@
 #include <charconv>
 #include <span>
 #include <utility>
+#include <chrono>
+#include <filesystem>
+#include <bit>
+#include <deque>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(SPREADSHEET_BENCHMARK)
+#include <malloc.h>
+#endif
 #include "expression.h"
 using namespace std::literals;
 using CValue = std::variant<std::monostate, double, std::string>;
@@ -98,6 +117,13 @@ public:
      */
     static int convertColumn(std::string_view columnStr);
 
+    /**
+     * Move the relative parts of the position
+     * @param rowOffset row offset
+     * @param columnOffset column offset
+     */
+    void relocate(int rowOffset, int columnOffset);
+
 };
 
 // *—————————————————————————————————————————————————CPos.cpp——————————————————————————————————————————————————————* //
@@ -164,6 +190,13 @@ int CPos::convertColumn(std::string_view columnStr) {
     return column - 1;
 }
 
+void CPos::relocate(int rowOffset, int columnOffset) {
+    if (!m_AbsRow)
+        m_Row += rowOffset;
+    if (!m_AbsColumn)
+        m_Column += columnOffset;
+}
+
 std::strong_ordering CPos::operator<=>(const CPos &rhs) const {
     return std::tie(m_Row, m_Column) <=> std::tie(rhs.m_Row, rhs.m_Column);
 }
@@ -188,915 +221,1614 @@ bool CPos::loadBinary(std::istream &is) {
     return is.good();
 }
 
-// *—————————————————————————————————————————————————COperation.h————————————————————————————————————————————* //
-class CCell; // forward declaration
+// *—————————————————————————————————————————————————CRange.h——————————————————————————————————————————————————————* //
 
 /**
- * abstract class representing an operation in a spreadsheet
+ * Class representing a rectangular range of cells given by two corners
  */
-class COperation {
+class CRange {
 public:
-    virtual ~COperation() = default;
+    CPos m_From;
+    CPos m_To;
+
+    CRange() = default;
 
     /**
-     * evaluate the operation
-     * @param stack stack of operations
-     * @param sheet map of cells
-     * @param depth depth of the operation in the stack
-     * @return result of the operation
+     * Constructor from string
+     * @param str string representation of the range, two positions separated by a colon
      */
-    virtual CValue
-    evaluate(std::deque<std::shared_ptr<COperation>> &stack, std::map<CPos, CCell> &sheet, int &depth) const = 0;
+    explicit CRange(std::string_view str);
 
     /**
-     * clone the operation
-     * @return cloned operation
+     * Constructor from corners
+     * @param from first corner
+     * @param to opposite corner
      */
-    virtual std::shared_ptr<COperation> clone() const = 0;
+    CRange(const CPos &from, const CPos &to) : m_From(from), m_To(to) {}
 
     /**
-     * save the operation to a binary stream
-     * @param os output stream
-     * @return true if successful
+     * Get the first row of the range
+     * @return row
      */
-    virtual bool saveBinary(std::ostream &os) const = 0;
+    int top() const;
 
     /**
-     * load the operation from a binary stream
-     * @param is input stream
-     * @return true if successful
+     * Get the last row of the range
+     * @return row
      */
-    virtual bool loadBinary(std::istream &is) = 0;
+    int bottom() const;
 
     /**
-     * get the type id of the operation
-     * @return type id
+     * Get the first column of the range
+     * @return column
      */
-    virtual int getTypeId() const = 0;
+    int left() const;
 
     /**
-     * create an operation from a type id
-     * @param typeId type id
-     * @return shared pointer to the operation
+     * Get the last column of the range
+     * @return column
      */
-    static std::shared_ptr<COperation> createOperationFromType(int typeId);
+    int right() const;
 
-};
-
-// *—————————————————————————————————————————————————CAddition.h————————————————————————————————————————————* //
-
-/**
- * class representing addition operation
- */
-class CAddition : public COperation {
-public:
-    CValue
-    evaluate(std::deque<std::shared_ptr<COperation>> &stack, std::map<CPos, CCell> &sheet, int &depth) const override;
-
-    std::shared_ptr<COperation> clone() const override;
+    /**
+     * Check whether the range contains a position
+     * @param pos position
+     * @return true if the position is inside
+     */
+    bool contains(const CPos &pos) const;
 
-    bool saveBinary(std::ostream &os) const override;
+    /**
+     * Move the relative parts of both corners
+     * @param rowOffset row offset
+     * @param columnOffset column offset
+     */
+    void relocate(int rowOffset, int columnOffset);
 
-    bool loadBinary(std::istream &is) override;
+    /**
+     * Save the range to a binary stream
+     * @param os output stream
+     * @return true if successful
+     */
+    bool saveBinary(std::ostream &os) const;
 
-    int getTypeId() const override;
+    /**
+     * Load the range from a binary stream
+     * @param is input stream
+     * @return true if successful
+     */
+    bool loadBinary(std::istream &is);
 };
 
-// *—————————————————————————————————————————————————CAddition.cpp————————————————————————————————————————————* //
+// *—————————————————————————————————————————————————CRange.cpp——————————————————————————————————————————————————————* //
 
-CValue
-CAddition::evaluate(std::deque<std::shared_ptr<COperation>> &stack, std::map<CPos, CCell> &sheet, int &depth) const {
-    depth++;
-    CValue right_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
-    CValue left_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
+CRange::CRange(std::string_view str) {
+    size_t colon = str.find(':');
+    if (colon == std::string_view::npos)
+        throw std::invalid_argument("Invalid range string: missing colon");
+    m_From = CPos(str.substr(0, colon));
+    m_To = CPos(str.substr(colon + 1));
+}
 
-    if (std::holds_alternative<double>(right_side) && std::holds_alternative<double>(left_side))
-        return std::get<double>(left_side) + std::get<double>(right_side);
+int CRange::top() const {
+    return std::min(m_From.m_Row, m_To.m_Row);
+}
 
-    if (std::holds_alternative<std::string>(right_side) && std::holds_alternative<std::string>(left_side))
-        return std::get<std::string>(left_side) + std::get<std::string>(right_side);
+int CRange::bottom() const {
+    return std::max(m_From.m_Row, m_To.m_Row);
+}
 
-    return {};
+int CRange::left() const {
+    return std::min(m_From.m_Column, m_To.m_Column);
 }
 
-std::shared_ptr<COperation> CAddition::clone() const {
-    return std::make_shared<CAddition>(*this);
+int CRange::right() const {
+    return std::max(m_From.m_Column, m_To.m_Column);
 }
 
-bool CAddition::saveBinary(std::ostream &os) const {
-    return os.good();
+bool CRange::contains(const CPos &pos) const {
+    return pos.m_Row >= top() && pos.m_Row <= bottom() && pos.m_Column >= left() && pos.m_Column <= right();
 }
 
-bool CAddition::loadBinary(std::istream &is) {
-    return is.good();
+void CRange::relocate(int rowOffset, int columnOffset) {
+    m_From.relocate(rowOffset, columnOffset);
+    m_To.relocate(rowOffset, columnOffset);
 }
 
-int CAddition::getTypeId() const {
-    return 1;
+bool CRange::saveBinary(std::ostream &os) const {
+    return m_From.saveBinary(os) && m_To.saveBinary(os);
 }
 
-// *—————————————————————————————————————————————————CSubtraction.h————————————————————————————————————————————* //
+bool CRange::loadBinary(std::istream &is) {
+    return m_From.loadBinary(is) && m_To.loadBinary(is);
+}
+
+// *—————————————————————————————————————————————————CArena.h————————————————————————————————————————————* //
 
 /**
- * class representing subtraction operation
+ * bump allocator for short lived objects, everything is released at once by reset
+ * blocks are kept for reuse, so a warm arena allocates nothing
  */
-class CSubtraction : public COperation {
+class CArena {
 public:
-    CValue
-    evaluate(std::deque<std::shared_ptr<COperation>> &stack, std::map<CPos, CCell> &sheet, int &depth) const override;
-
-    std::shared_ptr<COperation> clone() const override;
-
-    bool saveBinary(std::ostream &os) const override;
+    CArena() = default;
 
-    bool loadBinary(std::istream &is) override;
-
-    int getTypeId() const override;
-};
-
-// *—————————————————————————————————————————————————CSubtraction.cpp————————————————————————————————————————————* //
-
-CValue
-CSubtraction::evaluate(std::deque<std::shared_ptr<COperation>> &stack, std::map<CPos, CCell> &sheet, int &depth) const {
-    depth++;
+    /**
+     * the objects are owned by the arena they were made in, a copy starts empty
+     */
+    CArena(const CArena &other);
 
-    CValue right_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
-    CValue left_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
+    CArena &operator=(const CArena &other);
 
-    if (std::holds_alternative<double>(left_side) && std::holds_alternative<double>(right_side))
-        return std::get<double>(left_side) - std::get<double>(right_side);
+    ~CArena();
 
-    return {};
-}
+    /**
+     * construct an object in the arena
+     * @param args arguments of the constructor
+     * @return handle valid until the next reset
+     */
+    template<typename T, typename... Args>
+    T *make(Args &&... args);
 
-std::shared_ptr<COperation> CSubtraction::clone() const {
-    return std::make_shared<CSubtraction>(*this);
-}
+    /**
+     * destroy all objects made since the last reset
+     */
+    void reset();
 
-bool CSubtraction::saveBinary(std::ostream &os) const {
-    return os.good();
-}
+private:
+    static constexpr size_t BLOCK_SIZE = 4096;
 
-bool CSubtraction::loadBinary(std::istream &is) {
-    return is.good();
-}
+    /**
+     * allocate raw memory from the current block, or from the next one when it does not fit
+     * @param size size in bytes
+     * @param align alignment
+     * @return pointer to the memory
+     */
+    void *allocate(size_t size, size_t align);
 
-int CSubtraction::getTypeId() const {
-    return 2;
-}
+    struct CDestructor {
+        void (*m_Destroy)(void *);
 
-// *—————————————————————————————————————————————————CMultiplication.h————————————————————————————————————————————* //
+        void *m_Object;
+    };
 
-/**
- * class representing multiplication operation
- */
-class CMultiplication : public COperation {
-public:
-    CValue
-    evaluate(std::deque<std::shared_ptr<COperation>> &stack, std::map<CPos, CCell> &sheet, int &depth) const override;
+    std::vector<std::unique_ptr<std::byte[]>> m_Blocks;
 
-    std::shared_ptr<COperation> clone() const override;
+    /**
+     * size of every block, blocks for objects larger than BLOCK_SIZE are sized to fit
+     */
+    std::vector<size_t> m_Sizes;
 
-    bool saveBinary(std::ostream &os) const override;
+    size_t m_Block = 0;
 
-    bool loadBinary(std::istream &is) override;
+    /**
+     * bytes used in the current block
+     */
+    size_t m_Used = 0;
 
-    int getTypeId() const override;
+    std::vector<CDestructor> m_Destructors;
 };
 
-// *—————————————————————————————————————————————————CMultiplication.cpp————————————————————————————————————————————* //
+// *—————————————————————————————————————————————————CArena.cpp————————————————————————————————————————————* //
 
-CValue CMultiplication::evaluate(std::deque<std::shared_ptr<COperation>> &stack, std::map<CPos, CCell> &sheet,
-                                 int &depth) const {
-    depth++;
-    CValue right_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
-    CValue left_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
-    if (std::holds_alternative<double>(left_side) && std::holds_alternative<double>(right_side))
-        return std::get<double>(left_side) * std::get<double>(right_side);
+CArena::CArena(const CArena &) {}
 
-    return {};
+CArena &CArena::operator=(const CArena &) {
+    return *this;
 }
 
-std::shared_ptr<COperation> CMultiplication::clone() const {
-    return std::make_shared<CMultiplication>(*this);
+CArena::~CArena() {
+    reset();
 }
 
-bool CMultiplication::saveBinary(std::ostream &os) const {
-    return os.good();
+template<typename T, typename... Args>
+T *CArena::make(Args &&... args) {
+    T *object = new(allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    if constexpr (!std::is_trivially_destructible_v<T>)
+        m_Destructors.push_back({[](void *p) { static_cast<T *>(p)->~T(); }, object});
+    return object;
 }
 
-bool CMultiplication::loadBinary(std::istream &is) {
-    return is.good();
+void CArena::reset() {
+    for (auto it = m_Destructors.rbegin(); it != m_Destructors.rend(); ++it)
+        it->m_Destroy(it->m_Object);
+    m_Destructors.clear();
+    m_Block = 0;
+    m_Used = 0;
 }
 
-int CMultiplication::getTypeId() const {
-    return 3;
+void *CArena::allocate(size_t size, size_t align) {
+    for (; m_Block < m_Blocks.size(); m_Block++, m_Used = 0) {
+        size_t offset = (m_Used + align - 1) & ~(align - 1);
+        if (offset + size <= m_Sizes[m_Block]) {
+            m_Used = offset + size;
+            return m_Blocks[m_Block].get() + offset;
+        }
+    }
+    // new blocks come from operator new[], aligned for every fundamental type
+    size_t blockSize = std::max(size, BLOCK_SIZE);
+    m_Blocks.push_back(std::make_unique<std::byte[]>(blockSize));
+    m_Sizes.push_back(blockSize);
+    m_Used = size;
+    return m_Blocks.back().get();
 }
 
-// *—————————————————————————————————————————————————CDivision.h————————————————————————————————————————————* //
+// *—————————————————————————————————————————————————CStringPool.h————————————————————————————————————————————* //
 
 /**
- * class representing division operation
+ * strings of a sheet interned so that equal strings share one copy and are referred to by a pointer handle
+ * a string stays while templates or cell values retain it, or while an evaluation runs, interning is thread-safe
  */
-class CDivision : public COperation {
+class CStringPool : public std::enable_shared_from_this<CStringPool> {
 public:
-    CValue
-    evaluate(std::deque<std::shared_ptr<COperation>> &stack, std::map<CPos, CCell> &sheet, int &depth) const override;
+    CStringPool() = default;
 
-    std::shared_ptr<COperation> clone() const override;
+    CStringPool(const CStringPool &other) = delete;
 
-    bool saveBinary(std::ostream &os) const override;
+    CStringPool &operator=(const CStringPool &other) = delete;
 
-    bool loadBinary(std::istream &is) override;
+    /**
+     * find the interned copy of a string, or add one, the handle is valid while the calling evaluation runs
+     * @param value string
+     * @return handle, the same for equal strings
+     */
+    const std::string *intern(std::string_view value);
 
-    int getTypeId() const override;
-};
+    /**
+     * intern a string and retain it at once, so no sweep in between releases it
+     * @param value string
+     * @return handle, the same for equal strings
+     */
+    const std::string *keep(std::string_view value);
 
-// *—————————————————————————————————————————————————CDivision.cpp————————————————————————————————————————————* //
+    /**
+     * keep the string of a handle until it is released as many times as it was retained
+     * @param handle handle of a string retained elsewhere or held by a running evaluation
+     */
+    static void retain(const std::string *handle);
 
-CValue
-CDivision::evaluate(std::deque<std::shared_ptr<COperation>> &stack, std::map<CPos, CCell> &sheet, int &depth) const {
-    depth++;
+    /**
+     * drop one retain of a string, the string is released by the next sweep once nothing retains it
+     * @param handle handle of a retained string
+     */
+    static void release(const std::string *handle);
 
-    CValue right_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
-    CValue left_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
+    /**
+     * mark an evaluation as running, sweeps wait for it to end since it holds handles it has not retained
+     */
+    void enter();
 
-    if (std::holds_alternative<double>(left_side) && std::holds_alternative<double>(right_side)) {
-        if (std::get<double>(right_side) == 0)
-            return {};
-        return std::get<double>(left_side) / std::get<double>(right_side);
-    }
+    /**
+     * mark an evaluation started by enter as ended
+     */
+    void leave();
 
-    return {};
-}
+    /**
+     * check whether the strings added since the last sweep outnumber the strings it kept
+     * @return true if a sweep is due
+     */
+    bool sweepDue() const;
 
-std::shared_ptr<COperation> CDivision::clone() const {
-    return std::make_shared<CDivision>(*this);
-}
+    /**
+     * release the strings nothing retains, unless an evaluation of any grid sharing the pool runs
+     * @return true if the strings were swept
+     */
+    bool sweep();
 
-bool CDivision::saveBinary(std::ostream &os) const {
-    return os.good();
-}
+    /**
+     * get the number of interned strings
+     * @return number of strings
+     */
+    size_t size() const;
 
-bool CDivision::loadBinary(std::istream &is) {
-    return is.good();
-}
+private:
+    /**
+     * interned string with the count of its retains, handles point to the string
+     */
+    struct CEntry : std::string {
+        explicit CEntry(std::string_view value);
 
-int CDivision::getTypeId() const {
-    return 4;
-}
+        mutable std::atomic<uint32_t> m_Uses = 0;
+    };
 
-// *—————————————————————————————————————————————————CPower.h————————————————————————————————————————————* //
+    /**
+     * hash of strings that finds them by views too
+     */
+    struct CHash {
+        using is_transparent = void;
 
-/**
- * class representing power operation
- */
-class CPower : public COperation {
-public:
-    CValue
-    evaluate(std::deque<std::shared_ptr<COperation>> &stack, std::map<CPos, CCell> &sheet, int &depth) const override;
+        size_t operator()(std::string_view value) const;
+    };
 
-    std::shared_ptr<COperation> clone() const override;
+    mutable std::mutex m_Mutex;
 
-    bool saveBinary(std::ostream &os) const override;
+    /**
+     * the nodes of the set keep the strings in place when it grows or other strings are released
+     */
+    std::unordered_set<CEntry, CHash, std::equal_to<>> m_Strings;
 
-    bool loadBinary(std::istream &is) override;
+    /**
+     * number of strings after the last sweep
+     */
+    size_t m_Swept = 0;
 
-    int getTypeId() const override;
+    /**
+     * number of running evaluations
+     */
+    std::atomic<size_t> m_Evaluations = 0;
 };
 
-// *—————————————————————————————————————————————————CPower.cpp————————————————————————————————————————————* //
+// *—————————————————————————————————————————————————CStringPool.cpp————————————————————————————————————————————* //
 
-CValue
-CPower::evaluate(std::deque<std::shared_ptr<COperation>> &stack, std::map<CPos, CCell> &sheet, int &depth) const {
-    depth++;
+CStringPool::CEntry::CEntry(std::string_view value) : std::string(value) {}
 
-    CValue right_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
-    CValue left_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
+size_t CStringPool::CHash::operator()(std::string_view value) const {
+    return std::hash<std::string_view>()(value);
+}
 
-    if (std::holds_alternative<double>(left_side) && std::holds_alternative<double>(right_side)) {
-        if (std::get<double>(right_side) == 0)
-            return 1.0;
-        return std::pow(std::get<double>(left_side), std::get<double>(right_side));
+const std::string *CStringPool::intern(std::string_view value) {
+    std::lock_guard lock(m_Mutex);
+    auto it = m_Strings.find(value);
+    if (it == m_Strings.end())
+        it = m_Strings.emplace(value).first;
+    return &*it;
+}
 
-    }
+const std::string *CStringPool::keep(std::string_view value) {
+    std::lock_guard lock(m_Mutex);
+    auto it = m_Strings.find(value);
+    if (it == m_Strings.end())
+        it = m_Strings.emplace(value).first;
+    it->m_Uses.fetch_add(1, std::memory_order_relaxed);
+    return &*it;
+}
 
-    return {};
+void CStringPool::retain(const std::string *handle) {
+    static_cast<const CEntry *>(handle)->m_Uses.fetch_add(1, std::memory_order_relaxed);
 }
 
-std::shared_ptr<COperation> CPower::clone() const {
-    return std::make_shared<CPower>(*this);
+void CStringPool::release(const std::string *handle) {
+    static_cast<const CEntry *>(handle)->m_Uses.fetch_sub(1, std::memory_order_release);
 }
 
-bool CPower::saveBinary(std::ostream &os) const {
-    return os.good();
+void CStringPool::enter() {
+    m_Evaluations.fetch_add(1);
 }
 
-bool CPower::loadBinary(std::istream &is) {
-    return is.good();
+void CStringPool::leave() {
+    m_Evaluations.fetch_sub(1);
 }
 
-int CPower::getTypeId() const {
-    return 5;
+bool CStringPool::sweepDue() const {
+    std::lock_guard lock(m_Mutex);
+    return m_Strings.size() - m_Swept >= m_Swept + 64;
 }
 
-// *—————————————————————————————————————————————————CNegation.h————————————————————————————————————————————* //
+bool CStringPool::sweep() {
+    std::lock_guard lock(m_Mutex);
+    // an evaluation starting after the check interns under the lock, so it gets no string released here, and the
+    // values it reads from cells are retained by them
+    if (m_Evaluations.load() != 0) return false;
+    std::erase_if(m_Strings, [](const CEntry &entry) { return entry.m_Uses.load(std::memory_order_acquire) == 0; });
+    m_Swept = m_Strings.size();
+    return true;
+}
+
+size_t CStringPool::size() const {
+    std::lock_guard lock(m_Mutex);
+    return m_Strings.size();
+}
+
+// *—————————————————————————————————————————————————CCompactValue.h————————————————————————————————————————————* //
 
 /**
- * class representing negation operation
+ * value used inside the sheet, a number or a handle to a string interned in the string pool of the sheet
+ * all strings of a sheet come from its pool, so equal strings have equal handles
  */
-class CNegation : public COperation {
+class CCompactValue {
 public:
-    CValue
-    evaluate(std::deque<std::shared_ptr<COperation>> &stack, std::map<CPos, CCell> &sheet, int &depth) const override;
+    enum class EType : uint8_t {
+        Undefined, Number, String
+    };
 
-    std::shared_ptr<COperation> clone() const override;
+    CCompactValue() = default;
 
-    bool saveBinary(std::ostream &os) const override;
+    CCompactValue(double number);
 
-    bool loadBinary(std::istream &is) override;
+    /**
+     * constructor from an interned string
+     * @param string handle from the string pool
+     */
+    CCompactValue(const std::string *string);
 
-    int getTypeId() const override;
-};
+    EType type() const;
 
-// *—————————————————————————————————————————————————CNegation.cpp————————————————————————————————————————————* //
+    bool isUndefined() const;
 
-CValue
-CNegation::evaluate(std::deque<std::shared_ptr<COperation>> &stack, std::map<CPos, CCell> &sheet, int &depth) const {
-    depth++;
+    bool isNumber() const;
 
-    CValue right_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
+    bool isString() const;
 
-    if (std::holds_alternative<double>(right_side))
-        return -std::get<double>(right_side);
+    /**
+     * get the number, only valid for numbers
+     * @return number
+     */
+    double number() const;
 
-    return {};
-}
+    /**
+     * get the string, only valid for strings
+     * @return interned string
+     */
+    const std::string &string() const;
 
-std::shared_ptr<COperation> CNegation::clone() const {
-    return std::make_shared<CNegation>(*this);
-}
+    /**
+     * get the handle of the string, only valid for strings
+     * @return handle from the string pool
+     */
+    const std::string *handle() const;
 
-bool CNegation::saveBinary(std::ostream &os) const {
-    return os.good();
-}
+    /**
+     * convert a value of the public interface
+     * @param value value
+     * @param strings pool to intern the string in
+     * @return compact value
+     */
+    static CCompactValue fromValue(const CValue &value, CStringPool &strings);
 
-bool CNegation::loadBinary(std::istream &is) {
-    return is.good();
-}
+    /**
+     * convert to the value returned by the public interface
+     * @return value with a copy of the string
+     */
+    CValue toValue() const;
 
-int CNegation::getTypeId() const {
-    return 6;
-}
+    /**
+     * compare values of the same sheet, strings are compared by their handles
+     * @param other value to compare with
+     * @return true if the values are equal
+     */
+    bool operator==(const CCompactValue &other) const;
 
-// *—————————————————————————————————————————————————CEqual.h————————————————————————————————————————————* //
+private:
+    union {
+        double m_Number = 0;
+        const std::string *m_String;
+    };
 
-/**
- * class representing equal operation
- */
-class CEqual : public COperation {
-public:
-    CValue
-    evaluate(std::deque<std::shared_ptr<COperation>> &stack, std::map<CPos, CCell> &sheet, int &depth) const override;
+    EType m_Type = EType::Undefined;
+};
 
-    std::shared_ptr<COperation> clone() const override;
+static_assert(sizeof(CCompactValue) == 16);
 
-    bool saveBinary(std::ostream &os) const override;
+// *—————————————————————————————————————————————————CCompactValue.cpp————————————————————————————————————————————* //
 
-    bool loadBinary(std::istream &is) override;
+CCompactValue::CCompactValue(double number) : m_Number(number), m_Type(EType::Number) {}
 
-    int getTypeId() const override;
-};
+CCompactValue::CCompactValue(const std::string *string) : m_String(string), m_Type(EType::String) {}
 
-// *—————————————————————————————————————————————————CEqual.cpp————————————————————————————————————————————* //
+CCompactValue::EType CCompactValue::type() const {
+    return m_Type;
+}
 
-CValue
-CEqual::evaluate(std::deque<std::shared_ptr<COperation>> &stack, std::map<CPos, CCell> &sheet, int &depth) const {
-    depth++;
-    CValue right_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
-    CValue left_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
+bool CCompactValue::isUndefined() const {
+    return m_Type == EType::Undefined;
+}
 
-    if (std::holds_alternative<double>(right_side) && std::holds_alternative<double>(left_side)) {
-        if (std::get<double>(left_side) == std::get<double>(right_side))
-            return 1.0;
-        return 0.0;
-    }
+bool CCompactValue::isNumber() const {
+    return m_Type == EType::Number;
+}
 
-    if (std::holds_alternative<std::string>(right_side) && std::holds_alternative<std::string>(left_side)) {
-        if (std::get<std::string>(left_side) == std::get<std::string>(right_side))
-            return 1.0;
-        return 0.0;
-    }
+bool CCompactValue::isString() const {
+    return m_Type == EType::String;
+}
 
-    return {};
+double CCompactValue::number() const {
+    return m_Number;
 }
 
-std::shared_ptr<COperation> CEqual::clone() const {
-    return std::make_shared<CEqual>(*this);
+const std::string &CCompactValue::string() const {
+    return *m_String;
 }
 
-bool CEqual::saveBinary(std::ostream &os) const {
-    return os.good();
+const std::string *CCompactValue::handle() const {
+    return m_String;
 }
 
-bool CEqual::loadBinary(std::istream &is) {
-    return is.good();
+CCompactValue CCompactValue::fromValue(const CValue &value, CStringPool &strings) {
+    if (auto number = std::get_if<double>(&value))
+        return *number;
+    if (auto string = std::get_if<std::string>(&value))
+        return strings.intern(*string);
+    return {};
 }
 
-int CEqual::getTypeId() const {
-    return 7;
+CValue CCompactValue::toValue() const {
+    switch (m_Type) {
+        case EType::Number:
+            return m_Number;
+        case EType::String:
+            return *m_String;
+        default:
+            return {};
+    }
 }
 
-// *—————————————————————————————————————————————————CNotEqual.h————————————————————————————————————————————* //
+bool CCompactValue::operator==(const CCompactValue &other) const {
+    if (m_Type != other.m_Type) return false;
+    switch (m_Type) {
+        case EType::Number:
+            return m_Number == other.m_Number;
+        case EType::String:
+            return m_String == other.m_String;
+        default:
+            return true;
+    }
+}
+
+// *—————————————————————————————————————————————————CRetainedValue.h————————————————————————————————————————————* //
 
 /**
- * class representing not equal operation
+ * compact value kept by a cell, its string stays in the pool as long as the value holds it
  */
-class CNotEqual : public COperation {
+class CRetainedValue : public CCompactValue {
 public:
-    CValue
-    evaluate(std::deque<std::shared_ptr<COperation>> &stack, std::map<CPos, CCell> &sheet, int &depth) const override;
-
-    std::shared_ptr<COperation> clone() const override;
+    CRetainedValue() = default;
 
-    bool saveBinary(std::ostream &os) const override;
+    CRetainedValue(const CRetainedValue &other);
 
-    bool loadBinary(std::istream &is) override;
+    CRetainedValue(CRetainedValue &&other) noexcept;
 
-    int getTypeId() const override;
-};
+    ~CRetainedValue();
 
-// *—————————————————————————————————————————————————CNotEqual.cpp————————————————————————————————————————————* //
+    CRetainedValue &operator=(const CRetainedValue &other);
 
-CValue
-CNotEqual::evaluate(std::deque<std::shared_ptr<COperation>> &stack, std::map<CPos, CCell> &sheet, int &depth) const {
-    depth++;
-    CValue right_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
-    CValue left_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
+    CRetainedValue &operator=(CRetainedValue &&other) noexcept;
 
-    if (std::holds_alternative<double>(right_side) && std::holds_alternative<double>(left_side)) {
-        if (std::get<double>(left_side) != std::get<double>(right_side))
-            return 1.0;
-        return 0.0;
-    }
+    /**
+     * keep a value, it has to be held by a running evaluation or retained elsewhere
+     * @param value value
+     * @return this
+     */
+    CRetainedValue &operator=(const CCompactValue &value);
+};
 
-    if (std::holds_alternative<std::string>(right_side) && std::holds_alternative<std::string>(left_side)) {
-        if (std::get<std::string>(left_side) != std::get<std::string>(right_side))
-            return 1.0;
-        return 0.0;
-    }
+/**
+ * string constants interned by a template, kept in the pool as long as the template lives, the pool lives as long
+ * as they do
+ */
+class CRetainedStrings {
+public:
+    CRetainedStrings() = default;
 
-    return {};
-}
+    CRetainedStrings(const CRetainedStrings &other);
 
-std::shared_ptr<COperation> CNotEqual::clone() const {
-    return std::make_shared<CNotEqual>(*this);
-}
+    CRetainedStrings(CRetainedStrings &&other) noexcept;
 
-bool CNotEqual::saveBinary(std::ostream &os) const {
-    return os.good();
-}
+    ~CRetainedStrings();
 
-bool CNotEqual::loadBinary(std::istream &is) {
-    return is.good();
-}
+    CRetainedStrings &operator=(CRetainedStrings other) noexcept;
 
-int CNotEqual::getTypeId() const {
-    return 8;
-}
+    /**
+     * intern and keep strings, releasing the ones kept before
+     * @param strings pool to intern the strings in
+     * @param values strings
+     */
+    void assign(CStringPool &strings, const std::vector<std::string> &values);
 
-// *—————————————————————————————————————————————————CLessThan.h————————————————————————————————————————————* //
+    /**
+     * get a handle
+     * @param index index of the string
+     * @return handle from the pool
+     */
+    const std::string *operator[](size_t index) const;
 
-/**
- * class representing less than operation
- */
-class CLessThan : public COperation {
+private:
+    void release();
 
-public:
-    CValue
-    evaluate(std::deque<std::shared_ptr<COperation>> &stack, std::map<CPos, CCell> &sheet, int &depth) const override;
+    /**
+     * the pool when it is owned by a shared pointer, the pool of a grid is
+     */
+    std::shared_ptr<CStringPool> m_Pool;
 
-    std::shared_ptr<COperation> clone() const override;
+    std::vector<const std::string *> m_Handles;
+};
 
-    bool saveBinary(std::ostream &os) const override;
+// *—————————————————————————————————————————————————CRetainedValue.cpp————————————————————————————————————————————* //
 
-    bool loadBinary(std::istream &is) override;
+CRetainedValue::CRetainedValue(const CRetainedValue &other) : CCompactValue(other) {
+    if (isString()) CStringPool::retain(handle());
+}
 
-    int getTypeId() const override;
-};
+CRetainedValue::CRetainedValue(CRetainedValue &&other) noexcept : CCompactValue(other) {
+    other.CCompactValue::operator=(CCompactValue());
+}
 
-// *—————————————————————————————————————————————————CLessThan.cpp————————————————————————————————————————————* //
+CRetainedValue::~CRetainedValue() {
+    if (isString()) CStringPool::release(handle());
+}
 
-CValue
-CLessThan::evaluate(std::deque<std::shared_ptr<COperation>> &stack, std::map<CPos, CCell> &sheet, int &depth) const {
-    depth++;
-    CValue right_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
-    CValue left_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
+CRetainedValue &CRetainedValue::operator=(const CRetainedValue &other) {
+    return *this = static_cast<const CCompactValue &>(other);
+}
 
-    if (std::holds_alternative<double>(right_side) && std::holds_alternative<double>(left_side)) {
-        if (std::get<double>(left_side) < std::get<double>(right_side))
-            return 1.0;
-        return 0.0;
+CRetainedValue &CRetainedValue::operator=(CRetainedValue &&other) noexcept {
+    if (this != &other) {
+        if (isString()) CStringPool::release(handle());
+        CCompactValue::operator=(other);
+        other.CCompactValue::operator=(CCompactValue());
     }
+    return *this;
+}
 
-    if (std::holds_alternative<std::string>(right_side) && std::holds_alternative<std::string>(left_side)) {
-        if (std::get<std::string>(left_side) < std::get<std::string>(right_side))
-            return 1.0;
-        return 0.0;
-    }
+CRetainedValue &CRetainedValue::operator=(const CCompactValue &value) {
+    if (value.isString()) CStringPool::retain(value.handle());
+    if (isString()) CStringPool::release(handle());
+    CCompactValue::operator=(value);
+    return *this;
+}
 
-    return {};
+CRetainedStrings::CRetainedStrings(const CRetainedStrings &other) : m_Pool(other.m_Pool), m_Handles(other.m_Handles) {
+    for (const std::string *handle: m_Handles)
+        CStringPool::retain(handle);
 }
 
-std::shared_ptr<COperation> CLessThan::clone() const {
-    return std::make_shared<CLessThan>(*this);
+CRetainedStrings::CRetainedStrings(CRetainedStrings &&other) noexcept
+        : m_Pool(std::move(other.m_Pool)), m_Handles(std::move(other.m_Handles)) {
+    other.m_Handles.clear();
 }
 
-bool CLessThan::saveBinary(std::ostream &os) const {
-    return os.good();
+CRetainedStrings::~CRetainedStrings() {
+    release();
 }
 
-bool CLessThan::loadBinary(std::istream &is) {
-    return is.good();
+CRetainedStrings &CRetainedStrings::operator=(CRetainedStrings other) noexcept {
+    std::swap(m_Pool, other.m_Pool);
+    std::swap(m_Handles, other.m_Handles);
+    return *this;
 }
 
-int CLessThan::getTypeId() const {
-    return 9;
+void CRetainedStrings::assign(CStringPool &strings, const std::vector<std::string> &values) {
+    std::vector<const std::string *> handles;
+    for (const auto &value: values)
+        handles.push_back(strings.keep(value));
+    release();
+    m_Pool = strings.weak_from_this().lock();
+    m_Handles = std::move(handles);
 }
 
-// *—————————————————————————————————————————————————CLessEqual.h————————————————————————————————————————————* //
+const std::string *CRetainedStrings::operator[](size_t index) const {
+    return m_Handles[index];
+}
+
+void CRetainedStrings::release() {
+    for (const std::string *handle: m_Handles)
+        CStringPool::release(handle);
+    m_Handles.clear();
+}
+
+// *—————————————————————————————————————————————————CByteWriter.h————————————————————————————————————————————* //
 
 /**
- * class representing less equal operation
+ * buffer for the binary file format, multi-byte values are written little-endian whatever the host is
+ * integers are written as varints, seven bits per byte with the high bit set on all bytes but the last
  */
-class CLessEqual : public COperation {
+class CByteWriter {
 public:
-    CValue
-    evaluate(std::deque<std::shared_ptr<COperation>> &stack, std::map<CPos, CCell> &sheet, int &depth) const override;
-
-    std::shared_ptr<COperation> clone() const override;
-
-    bool saveBinary(std::ostream &os) const override;
+    void putByte(uint8_t value);
 
-    bool loadBinary(std::istream &is) override;
-
-    int getTypeId() const override;
-};
+    void putVarint(uint64_t value);
 
-// *—————————————————————————————————————————————————CLessEqual.cpp————————————————————————————————————————————* //
-
-CValue
-CLessEqual::evaluate(std::deque<std::shared_ptr<COperation>> &stack, std::map<CPos, CCell> &sheet, int &depth) const {
-    depth++;
-    CValue right_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
-    CValue left_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
+    /**
+     * write a signed integer as a varint, small magnitudes of both signs take one byte
+     * @param value integer
+     */
+    void putZigzag(int64_t value);
 
-    if (std::holds_alternative<double>(right_side) && std::holds_alternative<double>(left_side)) {
-        if (std::get<double>(left_side) <= std::get<double>(right_side))
-            return 1.0;
-        return 0.0;
-    }
+    void putDouble(double value);
 
-    if (std::holds_alternative<std::string>(right_side) && std::holds_alternative<std::string>(left_side)) {
-        if (std::get<std::string>(left_side) <= std::get<std::string>(right_side))
-            return 1.0;
-        return 0.0;
-    }
+    /**
+     * write four bytes, for checksums
+     * @param value integer
+     */
+    void putFixed32(uint32_t value);
 
-    return {};
-}
+    /**
+     * write a length prefixed string
+     * @param value string
+     */
+    void putString(std::string_view value);
 
-std::shared_ptr<COperation> CLessEqual::clone() const {
-    return std::make_shared<CLessEqual>(*this);
-}
+    /**
+     * write a position with its absolute flags
+     * @param pos position
+     */
+    void putPos(const CPos &pos);
 
-bool CLessEqual::saveBinary(std::ostream &os) const {
-    return os.good();
-}
+    void putBytes(std::string_view bytes);
 
-bool CLessEqual::loadBinary(std::istream &is) {
-    return is.good();
-}
+    /**
+     * get the written bytes
+     * @return bytes
+     */
+    const std::string &data() const;
 
-int CLessEqual::getTypeId() const {
-    return 10;
-}
+private:
+    std::string m_Data;
+};
 
-// *—————————————————————————————————————————————————CGreaterThan.h————————————————————————————————————————————* //
+// *—————————————————————————————————————————————————CByteReader.h————————————————————————————————————————————* //
 
 /**
- * class representing greater than operation
+ * bounds checked reader of the bytes written by CByteWriter, every method returns false when the data runs out
+ * or is malformed
  */
-class CGreaterThan : public COperation {
-
+class CByteReader {
 public:
-    CValue
-    evaluate(std::deque<std::shared_ptr<COperation>> &stack, std::map<CPos, CCell> &sheet, int &depth) const override;
+    explicit CByteReader(std::string_view data);
 
-    std::shared_ptr<COperation> clone() const override;
+    bool getByte(uint8_t &value);
 
-    bool saveBinary(std::ostream &os) const override;
+    bool getVarint(uint64_t &value);
 
-    bool loadBinary(std::istream &is) override;
+    bool getZigzag(int64_t &value);
 
-    int getTypeId() const override;
-};
+    /**
+     * read a varint that has to fit an int
+     * @param value integer
+     * @return true if successful
+     */
+    bool getInt(int &value);
 
-// *—————————————————————————————————————————————————CGreaterThan.cpp————————————————————————————————————————————* //
+    bool getDouble(double &value);
 
-CValue
-CGreaterThan::evaluate(std::deque<std::shared_ptr<COperation>> &stack, std::map<CPos, CCell> &sheet, int &depth) const {
-//    std::cout << "GreaterThan\n";
-    depth++;
-    CValue right_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
-    CValue left_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
+    bool getFixed32(uint32_t &value);
 
-    if (std::holds_alternative<double>(right_side) && std::holds_alternative<double>(left_side)) {
-        if (std::get<double>(left_side) > std::get<double>(right_side))
-            return 1.0;
-        return 0.0;
-    }
+    /**
+     * read a length prefixed string
+     * @param value view of the string in the data
+     * @return true if successful
+     */
+    bool getString(std::string_view &value);
 
-    if (std::holds_alternative<std::string>(right_side) && std::holds_alternative<std::string>(left_side)) {
-        if (std::get<std::string>(left_side) > std::get<std::string>(right_side))
-            return 1.0;
-        return 0.0;
-    }
+    bool getPos(CPos &pos);
 
-    return {};
-}
+    /**
+     * read a number of raw bytes
+     * @param size number of bytes
+     * @param bytes view of the bytes in the data
+     * @return true if successful
+     */
+    bool getBytes(size_t size, std::string_view &bytes);
 
-std::shared_ptr<COperation> CGreaterThan::clone() const {
-    return std::make_shared<CGreaterThan>(*this);
-}
+    /**
+     * get the number of unread bytes
+     * @return number of bytes
+     */
+    size_t remaining() const;
 
-bool CGreaterThan::saveBinary(std::ostream &os) const {
-    return os.good();
-}
+    /**
+     * get the number of read bytes
+     * @return offset of the next byte in the data
+     */
+    size_t offset() const;
 
-bool CGreaterThan::loadBinary(std::istream &is) {
-    return is.good();
-}
+private:
+    std::string_view m_Data;
 
-int CGreaterThan::getTypeId() const {
-    return 11;
-}
+    size_t m_Offset = 0;
+};
 
-// *—————————————————————————————————————————————————CGreaterEqual.h————————————————————————————————————————————* //
+// *—————————————————————————————————————————————————CCrc32.h————————————————————————————————————————————* //
 
 /**
- * class representing greater equal operation
+ * CRC-32 of the IEEE 802.3 polynomial, the checksum of zip and png
  */
-class CGreaterEqual : public COperation {
+class CCrc32 {
 public:
-    CValue
-    evaluate(std::deque<std::shared_ptr<COperation>> &stack, std::map<CPos, CCell> &sheet, int &depth) const override;
+    /**
+     * compute or continue a checksum
+     * @param data bytes
+     * @param crc checksum of the preceding bytes
+     * @return checksum
+     */
+    static uint32_t compute(std::string_view data, uint32_t crc = 0);
 
-    std::shared_ptr<COperation> clone() const override;
+private:
+    static constexpr std::array<uint32_t, 256> TABLE = [] {
+        std::array<uint32_t, 256> table{};
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; bit++)
+                crc = (crc >> 1) ^ (crc & 1 ? 0xEDB88320u : 0);
+            table[i] = crc;
+        }
+        return table;
+    }();
+};
 
-    bool saveBinary(std::ostream &os) const override;
+// *—————————————————————————————————————————————————CByteWriter.cpp————————————————————————————————————————————* //
 
-    bool loadBinary(std::istream &is) override;
+void CByteWriter::putByte(uint8_t value) {
+    m_Data.push_back(static_cast<char>(value));
+}
 
-    int getTypeId() const override;
-};
+void CByteWriter::putVarint(uint64_t value) {
+    for (; value >= 0x80; value >>= 7)
+        putByte(static_cast<uint8_t>(value | 0x80));
+    putByte(static_cast<uint8_t>(value));
+}
 
-// *—————————————————————————————————————————————————CGreaterEqual.cpp————————————————————————————————————————————* //
+void CByteWriter::putZigzag(int64_t value) {
+    putVarint((static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+}
 
-CValue CGreaterEqual::evaluate(std::deque<std::shared_ptr<COperation>> &stack, std::map<CPos, CCell> &sheet,
-                               int &depth) const {
-//    std::cout << "GreaterEqual\n";
-    depth++;
-    CValue right_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
-    CValue left_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
+void CByteWriter::putDouble(double value) {
+    auto bits = std::bit_cast<uint64_t>(value);
+    for (int i = 0; i < 8; i++)
+        putByte(static_cast<uint8_t>(bits >> (8 * i)));
+}
 
-    if (std::holds_alternative<double>(right_side) && std::holds_alternative<double>(left_side)) {
-        if (std::get<double>(left_side) >= std::get<double>(right_side))
-            return 1.0;
-        return 0.0;
-    }
+void CByteWriter::putFixed32(uint32_t value) {
+    for (int i = 0; i < 4; i++)
+        putByte(static_cast<uint8_t>(value >> (8 * i)));
+}
 
-    if (std::holds_alternative<std::string>(right_side) && std::holds_alternative<std::string>(left_side)) {
-        if (std::get<std::string>(left_side) >= std::get<std::string>(right_side))
-            return 1.0;
-        return 0.0;
-    }
+void CByteWriter::putString(std::string_view value) {
+    putVarint(value.size());
+    putBytes(value);
+}
 
-    return {};
+void CByteWriter::putPos(const CPos &pos) {
+    putByte((pos.m_AbsRow ? 1 : 0) | (pos.m_AbsColumn ? 2 : 0));
+    putZigzag(pos.m_Row);
+    putZigzag(pos.m_Column);
 }
 
-std::shared_ptr<COperation> CGreaterEqual::clone() const {
-    return std::make_shared<CGreaterEqual>(*this);
+void CByteWriter::putBytes(std::string_view bytes) {
+    m_Data.append(bytes);
 }
 
-bool CGreaterEqual::saveBinary(std::ostream &os) const {
-    return os.good();
+const std::string &CByteWriter::data() const {
+    return m_Data;
 }
 
-bool CGreaterEqual::loadBinary(std::istream &is) {
-    return is.good();
+// *—————————————————————————————————————————————————CByteReader.cpp————————————————————————————————————————————* //
+
+CByteReader::CByteReader(std::string_view data) : m_Data(data) {}
+
+bool CByteReader::getByte(uint8_t &value) {
+    if (m_Offset >= m_Data.size()) return false;
+    value = static_cast<uint8_t>(m_Data[m_Offset++]);
+    return true;
 }
 
-int CGreaterEqual::getTypeId() const {
-    return 12;
+bool CByteReader::getVarint(uint64_t &value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        uint8_t byte;
+        if (!getByte(byte)) return false;
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
 }
 
-// *—————————————————————————————————————————————————CReference.h——————————————————————————————————————————————————* //
+bool CByteReader::getZigzag(int64_t &value) {
+    uint64_t encoded;
+    if (!getVarint(encoded)) return false;
+    value = static_cast<int64_t>(encoded >> 1) ^ -static_cast<int64_t>(encoded & 1);
+    return true;
+}
 
-/**
- * class representing a reference to a cell
- */
-class CReference : public COperation {
-public:
-    CReference() = default;
+bool CByteReader::getInt(int &value) {
+    int64_t wide;
+    if (!getZigzag(wide) || wide < INT_MIN || wide > INT_MAX) return false;
+    value = static_cast<int>(wide);
+    return true;
+}
 
-    CReference(std::string &str);
+bool CByteReader::getDouble(double &value) {
+    std::string_view bytes;
+    if (!getBytes(8, bytes)) return false;
+    uint64_t bits = 0;
+    for (int i = 0; i < 8; i++)
+        bits |= static_cast<uint64_t>(static_cast<uint8_t>(bytes[i])) << (8 * i);
+    value = std::bit_cast<double>(bits);
+    return true;
+}
 
-    CValue
-    evaluate(std::deque<std::shared_ptr<COperation>> &stack, std::map<CPos, CCell> &sheet, int &depth) const override;
+bool CByteReader::getFixed32(uint32_t &value) {
+    std::string_view bytes;
+    if (!getBytes(4, bytes)) return false;
+    value = 0;
+    for (int i = 0; i < 4; i++)
+        value |= static_cast<uint32_t>(static_cast<uint8_t>(bytes[i])) << (8 * i);
+    return true;
+}
 
-    std::shared_ptr<COperation> clone() const override;
+bool CByteReader::getString(std::string_view &value) {
+    uint64_t size;
+    return getVarint(size) && size <= remaining() && getBytes(size, value);
+}
 
-    CPos getCPos();
+bool CByteReader::getPos(CPos &pos) {
+    uint8_t flags;
+    if (!getByte(flags) || flags > 3 || !getInt(pos.m_Row) || !getInt(pos.m_Column)) return false;
+    pos.m_AbsRow = flags & 1;
+    pos.m_AbsColumn = flags & 2;
+    return true;
+}
 
-    void setCPos(int rowOffset, int columnOffset);
+bool CByteReader::getBytes(size_t size, std::string_view &bytes) {
+    if (size > remaining()) return false;
+    bytes = m_Data.substr(m_Offset, size);
+    m_Offset += size;
+    return true;
+}
 
-    bool saveBinary(std::ostream &os) const override;
+size_t CByteReader::remaining() const {
+    return m_Data.size() - m_Offset;
+}
 
-    bool loadBinary(std::istream &is) override;
+size_t CByteReader::offset() const {
+    return m_Offset;
+}
 
-    int getTypeId() const override;
+// *—————————————————————————————————————————————————CCrc32.cpp————————————————————————————————————————————* //
 
-private:
-    CPos m_Pos;
-};
+uint32_t CCrc32::compute(std::string_view data, uint32_t crc) {
+    crc = ~crc;
+    for (char byte: data)
+        crc = TABLE[(crc ^ static_cast<uint8_t>(byte)) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
 
-// *—————————————————————————————————————————————————CNumber.h——————————————————————————————————————————————————* //
+class CCell; // forward declaration
+class CGrid; // forward declaration
+class CEvaluation; // forward declaration
+class COperation; // forward declaration
+
+// *—————————————————————————————————————————————————CFunction.h————————————————————————————————————————————* //
 
 /**
- * class representing a number
+ * built-in function callable from formulas
  */
-class CNumber : public COperation {
-public:
-    CNumber() = default;
+struct CFunction {
+    static constexpr int MAX_PARAMS = 3;
 
-    CNumber(double value);
+    const char *m_Name;
 
-    CValue
-    evaluate(std::deque<std::shared_ptr<COperation>> &stack, std::map<CPos, CCell> &sheet, int &depth) const override;
+    int m_ParamCount;
 
-    std::shared_ptr<COperation> clone() const override;
+    /**
+     * bit i is set if parameter i must be a range
+     */
+    unsigned m_RangeParams;
 
-    bool saveBinary(std::ostream &os) const override;
+    /**
+     * evaluate the function
+     * @param values values of the parameters, undefined for range parameters
+     * @param ranges ranges of the range parameters, nullptr for the others
+     * @param evaluation evaluation the function is called in, the cells of the ranges are read through it
+     * @return result of the function
+     */
+    CCompactValue (*m_Evaluate)(const CCompactValue *values, const CRange *const *ranges, CEvaluation &evaluation);
+};
 
-    bool loadBinary(std::istream &is) override;
+/**
+ * table of built-in functions, names are resolved to ids when a formula is built
+ */
+class CFunctionRegistry {
+public:
+    /**
+     * find a function by name
+     * @param name name of the function
+     * @return id of the function or -1 if there is no such function
+     */
+    static int find(std::string_view name);
 
-    int getTypeId() const override;
+    /**
+     * get a function by id
+     * @param id id of the function, ids are stored in saved files and must not change
+     * @return function
+     */
+    static const CFunction &get(int id);
 
-private:
-    double m_Value;
+    /**
+     * get the number of functions
+     * @return number of functions
+     */
+    static int size();
 };
 
-// *—————————————————————————————————————————————————CNumber.cpp——————————————————————————————————————————————————* //
+// *—————————————————————————————————————————————————CFormula.h————————————————————————————————————————————* //
 
-CNumber::CNumber(double value) : m_Value(value) {}
+/**
+ * Opcodes of a compiled formula, numbered the same as the operation type ids
+ */
+enum class EOpCode : uint8_t {
+    Add = 1, Sub, Mul, Div, Pow, Neg, Eq, Ne, Lt, Le, Gt, Ge, Reference, Number, String, Range, FuncCall
+};
 
-CValue
-CNumber::evaluate(std::deque<std::shared_ptr<COperation>> &stack, std::map<CPos, CCell> &sheet, int &depth) const {
-    depth++;
-    return m_Value;
-}
+/**
+ * single instruction of a compiled formula, operands are stored inline
+ */
+struct CInstruction {
+    static constexpr uint8_t ABS_ROW = 0x01;
+    static constexpr uint8_t ABS_COLUMN = 0x02;
 
-std::shared_ptr<COperation> CNumber::clone() const {
-    return std::make_shared<CNumber>(*this);
-}
+    EOpCode m_Op;
 
-bool CNumber::saveBinary(std::ostream &os) const {
-    os.write(reinterpret_cast<const char *>(&m_Value), sizeof(m_Value));
-    return os.good();
-}
+    /**
+     * absolute flags of a reference
+     */
+    uint8_t m_Flags = 0;
 
-bool CNumber::loadBinary(std::istream &is) {
-    is.read(reinterpret_cast<char *>(&m_Value), sizeof(m_Value));
-    return is.good();
-}
+    /**
+     * index to the string table or count of parameters
+     */
+    uint32_t m_Arg = 0;
 
-int CNumber::getTypeId() const {
-    return 14;
-}
+    union {
+        double m_Number;
+        /**
+         * row in the upper and column in the lower half
+         */
+        uint64_t m_Pos;
+    };
 
-// *—————————————————————————————————————————————————CString.h——————————————————————————————————————————————————* //
+    /**
+     * unpack the referenced position
+     * @return position with absolute flags
+     */
+    CPos getPos() const;
+
+    /**
+     * pack the referenced position
+     * @param pos position with absolute flags
+     */
+    void setPos(const CPos &pos);
+};
+
+static_assert(sizeof(CInstruction) == 16);
 
 /**
- * class representing a string
+ * formula compiled to a flat array of postfix instructions
+ * relative references are stored as offsets from the cell the formula belongs to (R1C1), so the formulas of cells
+ * filled by copying are equal and can be shared, the position of the cell is passed to the methods that resolve them
  */
-class CString : public COperation {
+class CFormula {
 public:
-    CString() = default;
+    /**
+     * append an instruction without operands
+     * @param op opcode
+     * @param arg count of parameters for function calls
+     */
+    void emit(EOpCode op, uint32_t arg = 0);
 
-    CString(std::string &value);
+    /**
+     * append a number constant
+     * @param value number
+     */
+    void emitNumber(double value);
 
-    CValue
-    evaluate(std::deque<std::shared_ptr<COperation>> &stack, std::map<CPos, CCell> &sheet, int &depth) const override;
+    /**
+     * append a string constant
+     * @param value string
+     */
+    void emitString(const std::string &value);
 
-    std::shared_ptr<COperation> clone() const override;
+    /**
+     * append a reference to a cell
+     * @param pos referenced position
+     */
+    void emitReference(const CPos &pos);
 
-    bool saveBinary(std::ostream &os) const override;
+    /**
+     * append a range of cells
+     * @param range referenced range
+     */
+    void emitRange(const CRange &range);
 
-    bool loadBinary(std::istream &is) override;
+    /**
+     * append a function call
+     * @param function id of the function in the function registry
+     * @param paramCount count of parameters
+     */
+    void emitCall(int function, int paramCount);
 
-    int getTypeId() const override;
+    /**
+     * check that the instructions form a single expression, fold its constant subexpressions, compute the needed
+     * stack size and intern the string constants
+     * @param strings string pool of the sheet the formula is evaluated in
+     * @return true if the formula is well-formed
+     */
+    bool finalize(CStringPool &strings);
 
-private:
-    std::string m_Value;
-};
+    /**
+     * position of a suspended evaluation
+     */
+    struct CState {
+        uint32_t m_Pc = 0;
 
-// *—————————————————————————————————————————————————CString.cpp——————————————————————————————————————————————————* //
+        /**
+         * count of values on the value stack
+         */
+        uint32_t m_Top = 0;
 
-CString::CString(std::string &value) : m_Value(value) {}
+        /**
+         * the formula cells of the ranges of the current function call have been evaluated
+         */
+        bool m_RangesReady = false;
+    };
 
-CValue
-CString::evaluate(std::deque<std::shared_ptr<COperation>> &stack, std::map<CPos, CCell> &sheet, int &depth) const {
-    depth++;
-    return m_Value;
-}
+    /**
+     * reason why resume returned
+     */
+    enum class EStep : uint8_t {
+        Done,
+        /**
+         * the referenced cell has to be evaluated, its value is then pushed and the reference skipped
+         */
+        Reference,
+        /**
+         * the formula cells of the ranges have to be evaluated before the function call
+         */
+        Ranges
+    };
 
-std::shared_ptr<COperation> CString::clone() const {
-    return std::make_shared<CString>(*this);
-}
+    /**
+     * evaluate the formula, cells it waits for are evaluated recursively
+     * @param sheet map of cells
+     * @param origin position relative references are resolved against
+     * @return result of the formula
+     */
+    CCompactValue evaluate(CGrid &sheet, const CPos &origin) const;
 
-bool CString::saveBinary(std::ostream &os) const {
-    size_t size = m_Value.size();
-    os.write(reinterpret_cast<const char *>(&size), sizeof(size));
-    os.write(m_Value.data(), size);
-    return os.good();
-}
+    /**
+     * run the instructions until the formula is done or needs the value of a cell that has not been evaluated
+     * @param evaluation evaluation the formula is part of, cells are read through it
+     * @param origin position relative references are resolved against
+     * @param values value stack with stackSize() slots
+     * @param state position of the evaluation, updated
+     * @param wait receives the cells to evaluate before resuming
+     * @return Done with the result in values[0], or the reason of the suspension
+     */
+    EStep resume(CEvaluation &evaluation, const CPos &origin, CCompactValue *values, CState &state,
+                 std::vector<const CCell *> &wait) const;
 
-bool CString::loadBinary(std::istream &is) {
-    size_t size;
-    is.read(reinterpret_cast<char *>(&size), sizeof(size));
-    m_Value.resize(size);
-    is.read(m_Value.data(), size);
-    return is.good();
-}
+    /**
+     * get the size of the value stack evaluation needs
+     * @return count of slots, at least one for the result
+     */
+    uint32_t stackSize() const;
 
-int CString::getTypeId() const {
-    return 15;
-}
+    /**
+     * move relative references by the given offset, moving by minus the position of the cell makes them relative
+     * @param rowOffset row offset
+     * @param columnOffset column offset
+     */
+    void relocate(int rowOffset, int columnOffset);
 
-// *—————————————————————————————————————————————————CValRange.h——————————————————————————————————————————————————* //
+    /**
+     * collect positions of referenced cells
+     * @param origin position relative references are resolved against
+     * @param refs vector to append the positions to
+     */
+    void getReferences(const CPos &origin, std::vector<CPos> &refs) const;
 
-/**
- * class representing a range of values
- */
-class CValRange : public COperation {
-public:
-    CValue
-    evaluate(std::deque<std::shared_ptr<COperation>> &stack, std::map<CPos, CCell> &sheet, int &depth) const override;
+    /**
+     * collect the ranges used by the formula
+     * @param origin position relative references are resolved against
+     * @param ranges vector to append the ranges to
+     */
+    void getRanges(const CPos &origin, std::vector<CRange> &ranges) const;
 
-    std::shared_ptr<COperation> clone() const override;
+    /**
+     * check whether the formula has any instructions
+     * @return true if there is nothing to evaluate
+     */
+    bool empty() const;
 
-    bool saveBinary(std::ostream &os) const override;
+    /**
+     * check whether the formula is a single number constant
+     * @param value set to the number if it is
+     * @return true if the formula is a single number constant
+     */
+    bool getNumber(double &value) const;
 
-    bool loadBinary(std::istream &is) override;
+    /**
+     * rebuild the operations the formula was compiled from
+     * @param arena arena to allocate the operations from
+     * @param origin position relative references are resolved against
+     * @param stack vector to append the operations to, in postfix order
+     */
+    void decompile(CArena &arena, const CPos &origin, std::vector<COperation *> &stack) const;
 
-    int getTypeId() const override;
-};
+    /**
+     * write the instructions in the compact file format, references stay relative
+     * @param out output buffer
+     * @param strings ids of the strings in the string table of the file, new strings are added
+     * @return true if successful
+     */
+    bool saveBinary(CByteWriter &out, std::unordered_map<std::string, uint32_t> &strings) const;
 
-// *—————————————————————————————————————————————————CValRange.cpp——————————————————————————————————————————————————* //
+    /**
+     * read instructions written by saveBinary, the formula has to be finalized afterwards
+     * @param in input buffer
+     * @param strings string table of the file
+     * @return true if the instructions are well-formed
+     */
+    bool loadBinary(CByteReader &in, std::span<const std::string_view> strings);
 
-CValue
-CValRange::evaluate(std::deque<std::shared_ptr<COperation>> &stack, std::map<CPos, CCell> &sheet, int &depth) const {
-    return {}; // todo
-}
+    /**
+     * skip instructions written by saveBinary, checking them the same as loadBinary
+     * @param in input buffer
+     * @param strings size of the string table of the file
+     * @return true if the instructions are well-formed
+     */
+    static bool skipBinary(CByteReader &in, size_t strings);
 
-std::shared_ptr<COperation> CValRange::clone() const {
-    return std::make_shared<CValRange>(*this);
-}
+    /**
+     * hash of the instructions and their operands, equal formulas have equal hashes
+     * @return hash
+     */
+    size_t hash() const;
 
-bool CValRange::saveBinary(std::ostream &os) const {
-    return os.good();
-}
+    /**
+     * compare the instructions and their operands, including absolute flags of references
+     * @param other formula to compare with
+     * @return true if the formulas are the same
+     */
+    bool operator==(const CFormula &other) const;
 
-bool CValRange::loadBinary(std::istream &is) {
+private:
+    /**
+     * check that the instructions form a single expression, compute the needed stack size and the range table
+     * indices of function parameters
+     * @return true if the formula is well-formed
+     */
+    bool analyze();
+
+    /**
+     * evaluate the subexpressions of constants ahead, with the same results evaluation would give, and drop
+     * operations that leave a number unchanged, a well-formed formula stays well-formed
+     * operands that reference cells are never dropped, they are dependencies of the cell and may close cycles even
+     * when the result is undefined whatever their values are
+     */
+    void fold();
+
+    std::vector<CInstruction> m_Code;
+
+    /**
+     * string constants referenced by index
+     */
+    std::vector<std::string> m_Strings;
+
+    /**
+     * string constants interned by finalize, indexed the same as m_Strings
+     */
+    CRetainedStrings m_Handles;
+
+    /**
+     * ranges referenced by index
+     */
+    std::vector<CRange> m_Ranges;
+
+    /**
+     * function call referenced by index from the FuncCall instruction
+     */
+    struct CCallSite {
+        uint32_t m_Function;
+        uint32_t m_ParamCount;
+
+        /**
+         * index to the range table for range parameters, -1 for the others, filled by finalize
+         */
+        std::array<int32_t, CFunction::MAX_PARAMS> m_Ranges;
+    };
+
+    std::vector<CCallSite> m_Calls;
+
+    /**
+     * maximal depth of the value stack
+     */
+    uint32_t m_MaxDepth = 0;
+};
+
+// *—————————————————————————————————————————————————CFormulaPool.h————————————————————————————————————————————* //
+
+/**
+ * set of formula templates shared by the cells of a sheet and by its copies
+ * cells hold the templates, the pool only finds them again, templates no cell uses are released, interning is
+ * thread-safe
+ */
+class CFormulaPool {
+public:
+    /**
+     * find the template equal to the formula, or add the formula as a new one
+     * @param formula formula with relative references
+     * @return shared template
+     */
+    std::shared_ptr<const CFormula> intern(CFormula &&formula);
+
+    /**
+     * get the number of templates in use
+     * @return number of templates some cell holds
+     */
+    size_t size() const;
+
+private:
+    /**
+     * drop the templates no cell holds anymore
+     */
+    void sweep();
+
+    mutable std::mutex m_Mutex;
+
+    std::unordered_multimap<size_t, std::weak_ptr<const CFormula>> m_Templates;
+
+    /**
+     * number of entries after the last sweep, the next one runs when it doubles
+     */
+    size_t m_Swept = 0;
+};
+
+// *—————————————————————————————————————————————————CInstruction.cpp————————————————————————————————————————————* //
+
+CPos CInstruction::getPos() const {
+    CPos pos(static_cast<int32_t>(m_Pos >> 32), static_cast<int32_t>(m_Pos & 0xFFFFFFFFu));
+    pos.m_AbsRow = m_Flags & ABS_ROW;
+    pos.m_AbsColumn = m_Flags & ABS_COLUMN;
+    return pos;
+}
+
+void CInstruction::setPos(const CPos &pos) {
+    m_Pos = (static_cast<uint64_t>(static_cast<uint32_t>(pos.m_Row)) << 32) | static_cast<uint32_t>(pos.m_Column);
+    m_Flags = (pos.m_AbsRow ? ABS_ROW : 0) | (pos.m_AbsColumn ? ABS_COLUMN : 0);
+}
+
+// *—————————————————————————————————————————————————COperation.h————————————————————————————————————————————* //
+
+/**
+ * abstract class representing an operation in a spreadsheet
+ */
+class COperation {
+public:
+    virtual ~COperation() = default;
+
+    /**
+     * evaluate the operation
+     * @param stack stack of operations
+     * @param sheet map of cells
+     * @param depth depth of the operation in the stack
+     * @return result of the operation
+     */
+    virtual CValue
+    evaluate(const std::vector<COperation *> &stack, CGrid &sheet, int &depth) const = 0;
+
+    /**
+     * clone the operation
+     * @param arena arena to allocate the clone from
+     * @return cloned operation, owned by the arena
+     */
+    virtual COperation *clone(CArena &arena) const = 0;
+
+    /**
+     * append the operation to a compiled formula
+     * @param formula formula to append to
+     */
+    virtual void compile(CFormula &formula) const = 0;
+
+    /**
+     * save the operation to a binary stream
+     * @param os output stream
+     * @return true if successful
+     */
+    virtual bool saveBinary(std::ostream &os) const = 0;
+
+    /**
+     * load the operation from a binary stream
+     * @param is input stream
+     * @return true if successful
+     */
+    virtual bool loadBinary(std::istream &is) = 0;
+
+    /**
+     * get the type id of the operation
+     * @return type id
+     */
+    virtual int getTypeId() const = 0;
+
+    /**
+     * create an operation from a type id
+     * @param typeId type id
+     * @param arena arena to allocate the operation from
+     * @return operation owned by the arena, nullptr for an unknown type id
+     */
+    static COperation *createOperationFromType(int typeId, CArena &arena);
+
+};
+
+// *—————————————————————————————————————————————————CAddition.h————————————————————————————————————————————* //
+
+/**
+ * class representing addition operation
+ */
+class CAddition : public COperation {
+public:
+    CValue
+    evaluate(const std::vector<COperation *> &stack, CGrid &sheet, int &depth) const override;
+
+    COperation *clone(CArena &arena) const override;
+
+    void compile(CFormula &formula) const override;
+
+    bool saveBinary(std::ostream &os) const override;
+
+    bool loadBinary(std::istream &is) override;
+
+    int getTypeId() const override;
+};
+
+// *—————————————————————————————————————————————————CAddition.cpp————————————————————————————————————————————* //
+
+CValue
+CAddition::evaluate(const std::vector<COperation *> &stack, CGrid &sheet, int &depth) const {
+    depth++;
+    CValue right_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
+    CValue left_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
+
+    if (std::holds_alternative<double>(right_side) && std::holds_alternative<double>(left_side))
+        return std::get<double>(left_side) + std::get<double>(right_side);
+
+    if (std::holds_alternative<std::string>(right_side) && std::holds_alternative<std::string>(left_side))
+        return std::get<std::string>(left_side) + std::get<std::string>(right_side);
+
+    return {};
+}
+
+COperation *CAddition::clone(CArena &arena) const {
+    return arena.make<CAddition>(*this);
+}
+
+void CAddition::compile(CFormula &formula) const {
+    formula.emit(EOpCode::Add);
+}
+
+bool CAddition::saveBinary(std::ostream &os) const {
+    return os.good();
+}
+
+bool CAddition::loadBinary(std::istream &is) {
     return is.good();
 }
 
-int CValRange::getTypeId() const {
-    return 16;
+int CAddition::getTypeId() const {
+    return 1;
 }
 
-// *—————————————————————————————————————————————————CFuncCall.h——————————————————————————————————————————————————* //
+// *—————————————————————————————————————————————————CSubtraction.h————————————————————————————————————————————* //
 
 /**
- * class representing a function call
+ * class representing subtraction operation
  */
-class CFuncCall : public COperation {
+class CSubtraction : public COperation {
+public:
+    CValue
+    evaluate(const std::vector<COperation *> &stack, CGrid &sheet, int &depth) const override;
+
+    COperation *clone(CArena &arena) const override;
+
+    void compile(CFormula &formula) const override;
+
+    bool saveBinary(std::ostream &os) const override;
+
+    bool loadBinary(std::istream &is) override;
+
+    int getTypeId() const override;
+};
+
+// *—————————————————————————————————————————————————CSubtraction.cpp————————————————————————————————————————————* //
+
+CValue
+CSubtraction::evaluate(const std::vector<COperation *> &stack, CGrid &sheet, int &depth) const {
+    depth++;
+
+    CValue right_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
+    CValue left_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
+
+    if (std::holds_alternative<double>(left_side) && std::holds_alternative<double>(right_side))
+        return std::get<double>(left_side) - std::get<double>(right_side);
+
+    return {};
+}
+
+COperation *CSubtraction::clone(CArena &arena) const {
+    return arena.make<CSubtraction>(*this);
+}
+
+void CSubtraction::compile(CFormula &formula) const {
+    formula.emit(EOpCode::Sub);
+}
+
+bool CSubtraction::saveBinary(std::ostream &os) const {
+    return os.good();
+}
+
+bool CSubtraction::loadBinary(std::istream &is) {
+    return is.good();
+}
+
+int CSubtraction::getTypeId() const {
+    return 2;
+}
+
+// *—————————————————————————————————————————————————CMultiplication.h————————————————————————————————————————————* //
+
+/**
+ * class representing multiplication operation
+ */
+class CMultiplication : public COperation {
+public:
+    CValue
+    evaluate(const std::vector<COperation *> &stack, CGrid &sheet, int &depth) const override;
+
+    COperation *clone(CArena &arena) const override;
+
+    void compile(CFormula &formula) const override;
+
+    bool saveBinary(std::ostream &os) const override;
+
+    bool loadBinary(std::istream &is) override;
+
+    int getTypeId() const override;
+};
+
+// *—————————————————————————————————————————————————CMultiplication.cpp————————————————————————————————————————————* //
+
+CValue CMultiplication::evaluate(const std::vector<COperation *> &stack, CGrid &sheet,
+                                 int &depth) const {
+    depth++;
+    CValue right_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
+    CValue left_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
+    if (std::holds_alternative<double>(left_side) && std::holds_alternative<double>(right_side))
+        return std::get<double>(left_side) * std::get<double>(right_side);
+
+    return {};
+}
+
+COperation *CMultiplication::clone(CArena &arena) const {
+    return arena.make<CMultiplication>(*this);
+}
+
+void CMultiplication::compile(CFormula &formula) const {
+    formula.emit(EOpCode::Mul);
+}
+
+bool CMultiplication::saveBinary(std::ostream &os) const {
+    return os.good();
+}
+
+bool CMultiplication::loadBinary(std::istream &is) {
+    return is.good();
+}
+
+int CMultiplication::getTypeId() const {
+    return 3;
+}
+
+// *—————————————————————————————————————————————————CDivision.h————————————————————————————————————————————* //
+
+/**
+ * class representing division operation
+ */
+class CDivision : public COperation {
 public:
     CValue
-    evaluate(std::deque<std::shared_ptr<COperation>> &stack, std::map<CPos, CCell> &sheet, int &depth) const override;
+    evaluate(const std::vector<COperation *> &stack, CGrid &sheet, int &depth) const override;
+
+    COperation *clone(CArena &arena) const override;
 
-    std::shared_ptr<COperation> clone() const override;
+    void compile(CFormula &formula) const override;
 
     bool saveBinary(std::ostream &os) const override;
 
@@ -1105,377 +1837,5674 @@ public:
     int getTypeId() const override;
 };
 
-// *—————————————————————————————————————————————————CFuncCall.cpp——————————————————————————————————————————————————* //
+// *—————————————————————————————————————————————————CDivision.cpp————————————————————————————————————————————* //
+
+CValue
+CDivision::evaluate(const std::vector<COperation *> &stack, CGrid &sheet, int &depth) const {
+    depth++;
+
+    CValue right_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
+    CValue left_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
+
+    if (std::holds_alternative<double>(left_side) && std::holds_alternative<double>(right_side)) {
+        if (std::get<double>(right_side) == 0)
+            return {};
+        return std::get<double>(left_side) / std::get<double>(right_side);
+    }
+
+    return {};
+}
+
+COperation *CDivision::clone(CArena &arena) const {
+    return arena.make<CDivision>(*this);
+}
+
+void CDivision::compile(CFormula &formula) const {
+    formula.emit(EOpCode::Div);
+}
+
+bool CDivision::saveBinary(std::ostream &os) const {
+    return os.good();
+}
+
+bool CDivision::loadBinary(std::istream &is) {
+    return is.good();
+}
+
+int CDivision::getTypeId() const {
+    return 4;
+}
+
+// *—————————————————————————————————————————————————CPower.h————————————————————————————————————————————* //
+
+/**
+ * class representing power operation
+ */
+class CPower : public COperation {
+public:
+    CValue
+    evaluate(const std::vector<COperation *> &stack, CGrid &sheet, int &depth) const override;
+
+    COperation *clone(CArena &arena) const override;
+
+    void compile(CFormula &formula) const override;
+
+    bool saveBinary(std::ostream &os) const override;
+
+    bool loadBinary(std::istream &is) override;
+
+    int getTypeId() const override;
+};
+
+// *—————————————————————————————————————————————————CPower.cpp————————————————————————————————————————————* //
+
+CValue
+CPower::evaluate(const std::vector<COperation *> &stack, CGrid &sheet, int &depth) const {
+    depth++;
+
+    CValue right_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
+    CValue left_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
+
+    if (std::holds_alternative<double>(left_side) && std::holds_alternative<double>(right_side)) {
+        if (std::get<double>(right_side) == 0)
+            return 1.0;
+        return std::pow(std::get<double>(left_side), std::get<double>(right_side));
+
+    }
+
+    return {};
+}
+
+COperation *CPower::clone(CArena &arena) const {
+    return arena.make<CPower>(*this);
+}
+
+void CPower::compile(CFormula &formula) const {
+    formula.emit(EOpCode::Pow);
+}
+
+bool CPower::saveBinary(std::ostream &os) const {
+    return os.good();
+}
+
+bool CPower::loadBinary(std::istream &is) {
+    return is.good();
+}
+
+int CPower::getTypeId() const {
+    return 5;
+}
+
+// *—————————————————————————————————————————————————CNegation.h————————————————————————————————————————————* //
+
+/**
+ * class representing negation operation
+ */
+class CNegation : public COperation {
+public:
+    CValue
+    evaluate(const std::vector<COperation *> &stack, CGrid &sheet, int &depth) const override;
+
+    COperation *clone(CArena &arena) const override;
+
+    void compile(CFormula &formula) const override;
+
+    bool saveBinary(std::ostream &os) const override;
+
+    bool loadBinary(std::istream &is) override;
+
+    int getTypeId() const override;
+};
+
+// *—————————————————————————————————————————————————CNegation.cpp————————————————————————————————————————————* //
+
+CValue
+CNegation::evaluate(const std::vector<COperation *> &stack, CGrid &sheet, int &depth) const {
+    depth++;
+
+    CValue right_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
+
+    if (std::holds_alternative<double>(right_side))
+        return -std::get<double>(right_side);
+
+    return {};
+}
+
+COperation *CNegation::clone(CArena &arena) const {
+    return arena.make<CNegation>(*this);
+}
+
+void CNegation::compile(CFormula &formula) const {
+    formula.emit(EOpCode::Neg);
+}
+
+bool CNegation::saveBinary(std::ostream &os) const {
+    return os.good();
+}
+
+bool CNegation::loadBinary(std::istream &is) {
+    return is.good();
+}
+
+int CNegation::getTypeId() const {
+    return 6;
+}
+
+// *—————————————————————————————————————————————————CEqual.h————————————————————————————————————————————* //
+
+/**
+ * class representing equal operation
+ */
+class CEqual : public COperation {
+public:
+    CValue
+    evaluate(const std::vector<COperation *> &stack, CGrid &sheet, int &depth) const override;
+
+    COperation *clone(CArena &arena) const override;
+
+    void compile(CFormula &formula) const override;
+
+    bool saveBinary(std::ostream &os) const override;
+
+    bool loadBinary(std::istream &is) override;
+
+    int getTypeId() const override;
+};
+
+// *—————————————————————————————————————————————————CEqual.cpp————————————————————————————————————————————* //
+
+CValue
+CEqual::evaluate(const std::vector<COperation *> &stack, CGrid &sheet, int &depth) const {
+    depth++;
+    CValue right_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
+    CValue left_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
+
+    if (std::holds_alternative<double>(right_side) && std::holds_alternative<double>(left_side)) {
+        if (std::get<double>(left_side) == std::get<double>(right_side))
+            return 1.0;
+        return 0.0;
+    }
+
+    if (std::holds_alternative<std::string>(right_side) && std::holds_alternative<std::string>(left_side)) {
+        if (std::get<std::string>(left_side) == std::get<std::string>(right_side))
+            return 1.0;
+        return 0.0;
+    }
+
+    return {};
+}
+
+COperation *CEqual::clone(CArena &arena) const {
+    return arena.make<CEqual>(*this);
+}
+
+void CEqual::compile(CFormula &formula) const {
+    formula.emit(EOpCode::Eq);
+}
+
+bool CEqual::saveBinary(std::ostream &os) const {
+    return os.good();
+}
+
+bool CEqual::loadBinary(std::istream &is) {
+    return is.good();
+}
+
+int CEqual::getTypeId() const {
+    return 7;
+}
+
+// *—————————————————————————————————————————————————CNotEqual.h————————————————————————————————————————————* //
+
+/**
+ * class representing not equal operation
+ */
+class CNotEqual : public COperation {
+public:
+    CValue
+    evaluate(const std::vector<COperation *> &stack, CGrid &sheet, int &depth) const override;
+
+    COperation *clone(CArena &arena) const override;
+
+    void compile(CFormula &formula) const override;
+
+    bool saveBinary(std::ostream &os) const override;
+
+    bool loadBinary(std::istream &is) override;
+
+    int getTypeId() const override;
+};
+
+// *—————————————————————————————————————————————————CNotEqual.cpp————————————————————————————————————————————* //
+
+CValue
+CNotEqual::evaluate(const std::vector<COperation *> &stack, CGrid &sheet, int &depth) const {
+    depth++;
+    CValue right_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
+    CValue left_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
+
+    if (std::holds_alternative<double>(right_side) && std::holds_alternative<double>(left_side)) {
+        if (std::get<double>(left_side) != std::get<double>(right_side))
+            return 1.0;
+        return 0.0;
+    }
+
+    if (std::holds_alternative<std::string>(right_side) && std::holds_alternative<std::string>(left_side)) {
+        if (std::get<std::string>(left_side) != std::get<std::string>(right_side))
+            return 1.0;
+        return 0.0;
+    }
+
+    return {};
+}
+
+COperation *CNotEqual::clone(CArena &arena) const {
+    return arena.make<CNotEqual>(*this);
+}
+
+void CNotEqual::compile(CFormula &formula) const {
+    formula.emit(EOpCode::Ne);
+}
+
+bool CNotEqual::saveBinary(std::ostream &os) const {
+    return os.good();
+}
+
+bool CNotEqual::loadBinary(std::istream &is) {
+    return is.good();
+}
+
+int CNotEqual::getTypeId() const {
+    return 8;
+}
+
+// *—————————————————————————————————————————————————CLessThan.h————————————————————————————————————————————* //
+
+/**
+ * class representing less than operation
+ */
+class CLessThan : public COperation {
+
+public:
+    CValue
+    evaluate(const std::vector<COperation *> &stack, CGrid &sheet, int &depth) const override;
+
+    COperation *clone(CArena &arena) const override;
+
+    void compile(CFormula &formula) const override;
+
+    bool saveBinary(std::ostream &os) const override;
+
+    bool loadBinary(std::istream &is) override;
+
+    int getTypeId() const override;
+};
+
+// *—————————————————————————————————————————————————CLessThan.cpp————————————————————————————————————————————* //
+
+CValue
+CLessThan::evaluate(const std::vector<COperation *> &stack, CGrid &sheet, int &depth) const {
+    depth++;
+    CValue right_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
+    CValue left_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
+
+    if (std::holds_alternative<double>(right_side) && std::holds_alternative<double>(left_side)) {
+        if (std::get<double>(left_side) < std::get<double>(right_side))
+            return 1.0;
+        return 0.0;
+    }
+
+    if (std::holds_alternative<std::string>(right_side) && std::holds_alternative<std::string>(left_side)) {
+        if (std::get<std::string>(left_side) < std::get<std::string>(right_side))
+            return 1.0;
+        return 0.0;
+    }
+
+    return {};
+}
+
+COperation *CLessThan::clone(CArena &arena) const {
+    return arena.make<CLessThan>(*this);
+}
+
+void CLessThan::compile(CFormula &formula) const {
+    formula.emit(EOpCode::Lt);
+}
+
+bool CLessThan::saveBinary(std::ostream &os) const {
+    return os.good();
+}
+
+bool CLessThan::loadBinary(std::istream &is) {
+    return is.good();
+}
+
+int CLessThan::getTypeId() const {
+    return 9;
+}
+
+// *—————————————————————————————————————————————————CLessEqual.h————————————————————————————————————————————* //
+
+/**
+ * class representing less equal operation
+ */
+class CLessEqual : public COperation {
+public:
+    CValue
+    evaluate(const std::vector<COperation *> &stack, CGrid &sheet, int &depth) const override;
+
+    COperation *clone(CArena &arena) const override;
+
+    void compile(CFormula &formula) const override;
+
+    bool saveBinary(std::ostream &os) const override;
+
+    bool loadBinary(std::istream &is) override;
+
+    int getTypeId() const override;
+};
+
+// *—————————————————————————————————————————————————CLessEqual.cpp————————————————————————————————————————————* //
+
+CValue
+CLessEqual::evaluate(const std::vector<COperation *> &stack, CGrid &sheet, int &depth) const {
+    depth++;
+    CValue right_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
+    CValue left_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
+
+    if (std::holds_alternative<double>(right_side) && std::holds_alternative<double>(left_side)) {
+        if (std::get<double>(left_side) <= std::get<double>(right_side))
+            return 1.0;
+        return 0.0;
+    }
+
+    if (std::holds_alternative<std::string>(right_side) && std::holds_alternative<std::string>(left_side)) {
+        if (std::get<std::string>(left_side) <= std::get<std::string>(right_side))
+            return 1.0;
+        return 0.0;
+    }
+
+    return {};
+}
+
+COperation *CLessEqual::clone(CArena &arena) const {
+    return arena.make<CLessEqual>(*this);
+}
+
+void CLessEqual::compile(CFormula &formula) const {
+    formula.emit(EOpCode::Le);
+}
+
+bool CLessEqual::saveBinary(std::ostream &os) const {
+    return os.good();
+}
+
+bool CLessEqual::loadBinary(std::istream &is) {
+    return is.good();
+}
+
+int CLessEqual::getTypeId() const {
+    return 10;
+}
+
+// *—————————————————————————————————————————————————CGreaterThan.h————————————————————————————————————————————* //
+
+/**
+ * class representing greater than operation
+ */
+class CGreaterThan : public COperation {
+
+public:
+    CValue
+    evaluate(const std::vector<COperation *> &stack, CGrid &sheet, int &depth) const override;
+
+    COperation *clone(CArena &arena) const override;
+
+    void compile(CFormula &formula) const override;
+
+    bool saveBinary(std::ostream &os) const override;
+
+    bool loadBinary(std::istream &is) override;
+
+    int getTypeId() const override;
+};
+
+// *—————————————————————————————————————————————————CGreaterThan.cpp————————————————————————————————————————————* //
+
+CValue
+CGreaterThan::evaluate(const std::vector<COperation *> &stack, CGrid &sheet, int &depth) const {
+//    std::cout << "GreaterThan\n";
+    depth++;
+    CValue right_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
+    CValue left_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
+
+    if (std::holds_alternative<double>(right_side) && std::holds_alternative<double>(left_side)) {
+        if (std::get<double>(left_side) > std::get<double>(right_side))
+            return 1.0;
+        return 0.0;
+    }
+
+    if (std::holds_alternative<std::string>(right_side) && std::holds_alternative<std::string>(left_side)) {
+        if (std::get<std::string>(left_side) > std::get<std::string>(right_side))
+            return 1.0;
+        return 0.0;
+    }
+
+    return {};
+}
+
+COperation *CGreaterThan::clone(CArena &arena) const {
+    return arena.make<CGreaterThan>(*this);
+}
+
+void CGreaterThan::compile(CFormula &formula) const {
+    formula.emit(EOpCode::Gt);
+}
+
+bool CGreaterThan::saveBinary(std::ostream &os) const {
+    return os.good();
+}
+
+bool CGreaterThan::loadBinary(std::istream &is) {
+    return is.good();
+}
+
+int CGreaterThan::getTypeId() const {
+    return 11;
+}
+
+// *—————————————————————————————————————————————————CGreaterEqual.h————————————————————————————————————————————* //
+
+/**
+ * class representing greater equal operation
+ */
+class CGreaterEqual : public COperation {
+public:
+    CValue
+    evaluate(const std::vector<COperation *> &stack, CGrid &sheet, int &depth) const override;
+
+    COperation *clone(CArena &arena) const override;
+
+    void compile(CFormula &formula) const override;
+
+    bool saveBinary(std::ostream &os) const override;
+
+    bool loadBinary(std::istream &is) override;
+
+    int getTypeId() const override;
+};
+
+// *—————————————————————————————————————————————————CGreaterEqual.cpp————————————————————————————————————————————* //
+
+CValue CGreaterEqual::evaluate(const std::vector<COperation *> &stack, CGrid &sheet,
+                               int &depth) const {
+//    std::cout << "GreaterEqual\n";
+    depth++;
+    CValue right_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
+    CValue left_side = stack[stack.size() - 1 - depth]->evaluate(stack, sheet, depth);
+
+    if (std::holds_alternative<double>(right_side) && std::holds_alternative<double>(left_side)) {
+        if (std::get<double>(left_side) >= std::get<double>(right_side))
+            return 1.0;
+        return 0.0;
+    }
+
+    if (std::holds_alternative<std::string>(right_side) && std::holds_alternative<std::string>(left_side)) {
+        if (std::get<std::string>(left_side) >= std::get<std::string>(right_side))
+            return 1.0;
+        return 0.0;
+    }
+
+    return {};
+}
+
+COperation *CGreaterEqual::clone(CArena &arena) const {
+    return arena.make<CGreaterEqual>(*this);
+}
+
+void CGreaterEqual::compile(CFormula &formula) const {
+    formula.emit(EOpCode::Ge);
+}
+
+bool CGreaterEqual::saveBinary(std::ostream &os) const {
+    return os.good();
+}
+
+bool CGreaterEqual::loadBinary(std::istream &is) {
+    return is.good();
+}
+
+int CGreaterEqual::getTypeId() const {
+    return 12;
+}
+
+// *—————————————————————————————————————————————————CReference.h——————————————————————————————————————————————————* //
+
+/**
+ * class representing a reference to a cell
+ */
+class CReference : public COperation {
+public:
+    CReference() = default;
+
+    CReference(std::string &str);
+
+    CReference(const CPos &pos);
+
+    CValue
+    evaluate(const std::vector<COperation *> &stack, CGrid &sheet, int &depth) const override;
+
+    COperation *clone(CArena &arena) const override;
+
+    void compile(CFormula &formula) const override;
+
+    CPos getCPos();
+
+    void setCPos(int rowOffset, int columnOffset);
+
+    bool saveBinary(std::ostream &os) const override;
+
+    bool loadBinary(std::istream &is) override;
+
+    int getTypeId() const override;
+
+private:
+    CPos m_Pos;
+};
+
+// *—————————————————————————————————————————————————CNumber.h——————————————————————————————————————————————————* //
+
+/**
+ * class representing a number
+ */
+class CNumber : public COperation {
+public:
+    CNumber() = default;
+
+    CNumber(double value);
+
+    CValue
+    evaluate(const std::vector<COperation *> &stack, CGrid &sheet, int &depth) const override;
+
+    COperation *clone(CArena &arena) const override;
+
+    void compile(CFormula &formula) const override;
+
+    bool saveBinary(std::ostream &os) const override;
+
+    bool loadBinary(std::istream &is) override;
+
+    int getTypeId() const override;
+
+private:
+    double m_Value;
+};
+
+// *—————————————————————————————————————————————————CNumber.cpp——————————————————————————————————————————————————* //
+
+CNumber::CNumber(double value) : m_Value(value) {}
+
+CValue
+CNumber::evaluate(const std::vector<COperation *> &stack, CGrid &sheet, int &depth) const {
+    depth++;
+    return m_Value;
+}
+
+COperation *CNumber::clone(CArena &arena) const {
+    return arena.make<CNumber>(*this);
+}
+
+void CNumber::compile(CFormula &formula) const {
+    formula.emitNumber(m_Value);
+}
+
+bool CNumber::saveBinary(std::ostream &os) const {
+    os.write(reinterpret_cast<const char *>(&m_Value), sizeof(m_Value));
+    return os.good();
+}
+
+bool CNumber::loadBinary(std::istream &is) {
+    is.read(reinterpret_cast<char *>(&m_Value), sizeof(m_Value));
+    return is.good();
+}
+
+int CNumber::getTypeId() const {
+    return 14;
+}
+
+// *—————————————————————————————————————————————————CString.h——————————————————————————————————————————————————* //
+
+/**
+ * class representing a string
+ */
+class CString : public COperation {
+public:
+    CString() = default;
+
+    CString(const std::string &value);
+
+    CValue
+    evaluate(const std::vector<COperation *> &stack, CGrid &sheet, int &depth) const override;
+
+    COperation *clone(CArena &arena) const override;
+
+    void compile(CFormula &formula) const override;
+
+    bool saveBinary(std::ostream &os) const override;
+
+    bool loadBinary(std::istream &is) override;
+
+    int getTypeId() const override;
+
+private:
+    std::string m_Value;
+};
+
+// *—————————————————————————————————————————————————CString.cpp——————————————————————————————————————————————————* //
+
+CString::CString(const std::string &value) : m_Value(value) {}
+
+CValue
+CString::evaluate(const std::vector<COperation *> &stack, CGrid &sheet, int &depth) const {
+    depth++;
+    return m_Value;
+}
+
+COperation *CString::clone(CArena &arena) const {
+    return arena.make<CString>(*this);
+}
+
+void CString::compile(CFormula &formula) const {
+    formula.emitString(m_Value);
+}
+
+bool CString::saveBinary(std::ostream &os) const {
+    size_t size = m_Value.size();
+    os.write(reinterpret_cast<const char *>(&size), sizeof(size));
+    os.write(m_Value.data(), size);
+    return os.good();
+}
+
+bool CString::loadBinary(std::istream &is) {
+    size_t size;
+    is.read(reinterpret_cast<char *>(&size), sizeof(size));
+    m_Value.resize(size);
+    is.read(m_Value.data(), size);
+    return is.good();
+}
+
+int CString::getTypeId() const {
+    return 15;
+}
+
+// *—————————————————————————————————————————————————CValRange.h——————————————————————————————————————————————————* //
+
+/**
+ * class representing a range of values
+ */
+class CValRange : public COperation {
+public:
+    CValRange() = default;
+
+    CValRange(std::string &str);
+
+    CValRange(const CRange &range);
+
+    CValue
+    evaluate(const std::vector<COperation *> &stack, CGrid &sheet, int &depth) const override;
+
+    COperation *clone(CArena &arena) const override;
+
+    void compile(CFormula &formula) const override;
+
+    const CRange &getRange() const;
+
+    void setCPos(int rowOffset, int columnOffset);
+
+    bool saveBinary(std::ostream &os) const override;
+
+    bool loadBinary(std::istream &is) override;
+
+    int getTypeId() const override;
+
+private:
+    CRange m_Range;
+};
+
+// *—————————————————————————————————————————————————CValRange.cpp——————————————————————————————————————————————————* //
+
+CValRange::CValRange(std::string &str) : m_Range(str) {}
+
+CValRange::CValRange(const CRange &range) : m_Range(range) {}
+
+CValue
+CValRange::evaluate(const std::vector<COperation *> &stack, CGrid &sheet, int &depth) const {
+    depth++;
+    // a range has no value of its own, functions read its cells through getRange()
+    return {};
+}
+
+COperation *CValRange::clone(CArena &arena) const {
+    return arena.make<CValRange>(*this);
+}
+
+void CValRange::compile(CFormula &formula) const {
+    formula.emitRange(m_Range);
+}
+
+const CRange &CValRange::getRange() const {
+    return m_Range;
+}
+
+void CValRange::setCPos(int rowOffset, int columnOffset) {
+    m_Range.relocate(rowOffset, columnOffset);
+}
+
+bool CValRange::saveBinary(std::ostream &os) const {
+    return m_Range.saveBinary(os);
+}
+
+bool CValRange::loadBinary(std::istream &is) {
+    return m_Range.loadBinary(is);
+}
+
+int CValRange::getTypeId() const {
+    return 16;
+}
+
+// *—————————————————————————————————————————————————CFuncCall.h——————————————————————————————————————————————————* //
+
+/**
+ * class representing a function call
+ */
+class CFuncCall : public COperation {
+public:
+    CFuncCall() = default;
+
+    CFuncCall(int function, int paramCount);
+
+    CValue
+    evaluate(const std::vector<COperation *> &stack, CGrid &sheet, int &depth) const override;
+
+    COperation *clone(CArena &arena) const override;
+
+    void compile(CFormula &formula) const override;
+
+    bool saveBinary(std::ostream &os) const override;
+
+    bool loadBinary(std::istream &is) override;
+
+    int getTypeId() const override;
+
+private:
+    /**
+     * id of the function in the function registry
+     */
+    int m_Function = 0;
+
+    int m_ParamCount = 0;
+};
+
+// *—————————————————————————————————————————————————CCell.h——————————————————————————————————————————————————————————————* //
+
+/**
+ * Class that represents cell.
+ */
+class CCell {
+public:
+    /**
+     * Formula of the cell compiled for evaluation, a template shared by all cells whose formulas are the same
+     * relative to their positions. The operations it was compiled from live only in an arena while the formula
+     * is parsed, loaded or saved.
+     */
+    std::shared_ptr<const CFormula> m_Formula;
+
+    /**
+     * Position of the cell, relative references of the formula are resolved against it.
+     */
+    CPos m_Pos;
+
+    /**
+     * Cached result of the last calculation.
+     */
+    CRetainedValue m_Value;
+
+    /**
+     * Flag that indicates whether m_Value is up to date.
+     */
+    bool m_IsCached = false;
+
+    /**
+     * Flag that indicates whether the cell lies on a cycle of references, maintained when formulas change.
+     */
+    bool m_InCycle = false;
+
+    CCell() {};
+
+    /**
+     * Save cell to binary file.
+     * @param os - output stream
+     * @param arena - arena for the operations rebuilt from the formula
+     * @return - true if success, false otherwise
+     */
+    bool saveBinary(std::ostream &os, CArena &arena) const;
+
+    /**
+     * Save numeric literal to binary file in the same format as a cell.
+     * @param os - output stream
+     * @param number - numeric literal
+     * @return - true if success, false otherwise
+     */
+    static bool saveBinary(std::ostream &os, double number);
+
+    /**
+     * Calculate cell. Referenced cells are calculated first on a heap allocated stack of suspended formulas,
+     * so the depth of reference chains is limited by memory only. The results are stored by the evaluation.
+     * @param evaluation - evaluation the cell is calculated in
+     * @return - result of calculation
+     */
+    CCompactValue calculateCell(CEvaluation &evaluation) const;
+
+    /**
+     * Compile the stack of operations and share the formula through the pool.
+     * @param stack - operations in postfix order
+     * @param pos - position of the cell
+     * @param pool - pool of formula templates
+     * @param strings - string pool of the sheet
+     * @return - true if the stack forms a valid expression, false otherwise
+     */
+    bool compile(const std::vector<COperation *> &stack, const CPos &pos, CFormulaPool &pool, CStringPool &strings);
+
+    /**
+     * Check whether the cell has a formula to evaluate.
+     * @return - true if there is a formula with instructions
+     */
+    bool hasFormula() const;
+
+    /**
+     * Collect positions of cells referenced by the formula.
+     * @param refs - vector to append the referenced positions to
+     */
+    void getReferences(std::vector<CPos> &refs) const;
+
+    /**
+     * Collect ranges used by the formula.
+     * @param ranges - vector to append the ranges to
+     */
+    void getRanges(std::vector<CRange> &ranges) const;
+
+    /**
+     * Load cell from binary file of version 1, where ranges and function calls are stored without operands.
+     * @param is - input stream
+     * @param arena - arena for the loaded operations until they are compiled
+     * @param pos - position of the cell
+     * @param pool - pool of formula templates
+     * @param strings - string pool of the sheet
+     * @return - true if success, false otherwise
+     */
+    bool loadBinary(std::istream &is, CArena &arena, const CPos &pos, CFormulaPool &pool, CStringPool &strings);
+};
+
+// *—————————————————————————————————————————————————CEvaluation.h——————————————————————————————————————————————————————————————* //
+
+/**
+ * State of one evaluation of cells: the cells being calculated, through which cycles not known yet are found, and the
+ * count of cycles met. A writer stores the values it calculates in the cells of a grid nothing else uses meanwhile,
+ * the values of cells in tiles shared with copies of the grid are stored once the evaluation is flushed. A reader
+ * keeps them to itself and never changes the grid, so any number of readers can evaluate the same grid at once, as
+ * long as nothing changes it.
+ */
+class CEvaluation {
+public:
+    /**
+     * Start an evaluation that stores the calculated values in the cells.
+     * @param sheet - grid of the cells, values of cells in tiles shared with copies of the grid are kept by the
+     * evaluation until it is flushed
+     */
+    explicit CEvaluation(CGrid &sheet);
+
+    /**
+     * Start an evaluation that only reads the grid.
+     * @param sheet - grid of the cells, it must not change until the evaluation ends
+     */
+    explicit CEvaluation(const CGrid &sheet);
+
+    CEvaluation(const CEvaluation &other) = delete;
+
+    CEvaluation &operator=(const CEvaluation &other) = delete;
+
+    ~CEvaluation();
+
+    /**
+     * Find a cell or a numeric literal.
+     * @param pos - position of the cell
+     * @param number - set to the numeric literal if the position holds one, nullptr otherwise
+     * @return - pointer to the cell or nullptr if there is no cell
+     */
+    const CCell *lookup(const CPos &pos, const double *&number);
+
+    /**
+     * Get the value of a cell if it is known, cached in the cell or calculated by this evaluation.
+     * @param cell - cell
+     * @param value - set to the value if it is known
+     * @return - true if the value is known
+     */
+    bool cached(const CCell &cell, CCompactValue &value) const;
+
+    /**
+     * Check whether a cell has to be calculated before its value can be used.
+     * @param cell - cell or nullptr
+     * @return - true if the cell has a formula whose value is neither known nor being calculated
+     */
+    bool needsEvaluation(const CCell *cell) const;
+
+    /**
+     * Check whether a cell is being calculated, a reference to it closes a cycle.
+     * @param cell - cell
+     * @return - true if the cell was entered and not left yet
+     */
+    bool isCalculating(const CCell &cell) const;
+
+    /**
+     * Mark a cell as being calculated. Cells are left in the reverse order they are entered in.
+     * @param cell - cell
+     */
+    void enter(const CCell &cell);
+
+    /**
+     * Unmark the cell entered last.
+     */
+    void leave();
+
+    /**
+     * Store the calculated value of a cell.
+     * @param cell - cell found through this evaluation
+     * @param value - value
+     */
+    void store(const CCell &cell, const CCompactValue &value);
+
+    /**
+     * Store the values a writer kept for cells of tiles shared with copies of the grid in the cells, copying each of
+     * these tiles once. The tiles are not copied while the evaluation runs, the cells it found stay in place until
+     * it is flushed.
+     */
+    void flush();
+
+    /**
+     * Record a reference closing a cycle.
+     */
+    void cycle();
+
+    /**
+     * Get the number of cycles met so far. A value calculated while the number changed depends on where its cycle
+     * was entered, it is never stored.
+     * @return - number of cycles
+     */
+    unsigned cycles() const;
+
+    /**
+     * Visit the non-empty positions of a range as CGrid::forEachInRange does.
+     * @param range - range of cells
+     * @param onNumbers - function called with the array of numbers and the row mask
+     * @param onCell - function called with the position and the cell
+     */
+    template<typename FN, typename FC>
+    void forEachInRange(const CRange &range, FN &&onNumbers, FC &&onCell);
+
+    /**
+     * Sum and count the numeric literals of a range as CGrid::sumInRange does.
+     * @param range - range of cells
+     * @param sum - increased by the sum of the numbers
+     * @param count - increased by the count of the numbers
+     * @param onNumbers - function called with the array of numbers and the row mask
+     * @param onCell - function called with the position and the cell
+     */
+    template<typename FN, typename FC>
+    void sumInRange(const CRange &range, double &sum, size_t &count, FN &&onNumbers, FC &&onCell);
+
+    /**
+     * Get the pool the strings of the grid are interned in.
+     * @return - string pool
+     */
+    CStringPool &strings() const;
+
+private:
+    /**
+     * Count of the cells being calculated that are kept inline and searched linearly.
+     */
+    static constexpr size_t SHORT_PATH = 16;
+
+    const CGrid &m_Sheet;
+
+    /**
+     * Grid the values are stored in where it owns the tile, nullptr for a reader.
+     */
+    CGrid *m_Writable = nullptr;
+
+    /**
+     * The first SHORT_PATH cells being calculated in the order they were entered, most evaluations need no more.
+     */
+    std::array<const CCell *, SHORT_PATH> m_Calculating;
+
+    /**
+     * Count of the cells being calculated.
+     */
+    size_t m_Depth = 0;
+
+    /**
+     * The other cells being calculated, the cell entered last at the back, and the same cells to be found by hashing.
+     */
+    std::vector<const CCell *> m_Deep;
+    std::unordered_set<const CCell *> m_DeepSet;
+
+    /**
+     * Values calculated by a reader, or by a writer for cells of shared tiles.
+     */
+    std::unordered_map<const CCell *, CCompactValue> m_Values;
+
+    /**
+     * Positions of the cells of shared tiles a writer calculated, their values are stored by flush.
+     */
+    std::vector<CPos> m_Unstored;
+
+    unsigned m_Cycles = 0;
+};
+
+// *—————————————————————————————————————————————————CCell.cpp——————————————————————————————————————————————————————————————* //
+
+CCompactValue CCell::calculateCell(CEvaluation &evaluation) const {
+    CCompactValue known;
+    if (evaluation.cached(*this, known)) return known;
+    if (!hasFormula()) return {};
+    if (m_InCycle) {
+        evaluation.store(*this, CCompactValue());
+        return {};
+    }
+    // cycles written in a batch that has not been committed yet are only found here
+    if (evaluation.isCalculating(*this)) {
+        evaluation.cycle();
+        return {};
+    }
+
+    // a frame for every cell being calculated, their value stacks lie one after another in values
+    struct CFrame {
+        const CCell *m_Cell;
+        CFormula::CState m_State;
+        size_t m_Base = 0;
+        unsigned m_CycleCount = 0;
+        bool m_Started = false;
+
+        /**
+         * calculated only to be cached for a function over a range, the result is not passed on
+         */
+        bool m_Discard = false;
+    };
+    std::vector<CFrame> frames;
+    std::vector<CCompactValue> values;
+    std::vector<const CCell *> wait;
+    CFormula::EStep step;
+    bool suspended = false;
+
+    // most formulas read only cached values, they run on the native stack without setting up the frames
+    constexpr uint32_t SMALL_STACK = 8;
+    if (m_Formula->stackSize() <= SMALL_STACK) {
+        std::array<CCompactValue, SMALL_STACK> small;
+        CFrame root{this, {}, 0, evaluation.cycles(), true};
+        evaluation.enter(*this);
+        step = m_Formula->resume(evaluation, m_Pos, small.data(), root.m_State, wait);
+        if (step == CFormula::EStep::Done) {
+            evaluation.leave();
+            if (root.m_CycleCount == evaluation.cycles())
+                evaluation.store(*this, small[0]);
+            return small[0];
+        }
+        values.assign(small.begin(), small.begin() + m_Formula->stackSize());
+        frames.push_back(root);
+        suspended = true;
+    } else
+        frames.push_back({this, {}});
+
+    for (;;) {
+        if (!suspended) {
+            // cells of ranges may have been reached through other cells in the meantime
+            while (!frames.back().m_Started && (evaluation.cached(*frames.back().m_Cell, known)
+                                                || evaluation.isCalculating(*frames.back().m_Cell)))
+                frames.pop_back();
+            CFrame &frame = frames.back();
+            const CCell &cell = *frame.m_Cell;
+            if (!frame.m_Started) {
+                frame.m_Started = true;
+                frame.m_CycleCount = evaluation.cycles();
+                frame.m_Base = values.size();
+                evaluation.enter(cell);
+                values.resize(frame.m_Base + cell.m_Formula->stackSize());
+            }
+            wait.clear();
+            step = cell.m_Formula->resume(evaluation, cell.m_Pos, values.data() + frame.m_Base, frame.m_State, wait);
+        }
+        suspended = false;
+
+        if (step == CFormula::EStep::Reference) {
+            frames.push_back({wait[0], {}});
+            continue;
+        }
+        if (step == CFormula::EStep::Ranges) {
+            for (auto it = wait.rbegin(); it != wait.rend(); ++it)
+                frames.push_back({*it, {}, 0, 0, false, true});
+            continue;
+        }
+
+        CFrame &frame = frames.back();
+        const CCell &cell = *frame.m_Cell;
+        CCompactValue result = values[frame.m_Base];
+        evaluation.leave();
+        // values computed inside a cycle depend on where the cycle was entered, never cache them
+        if (frame.m_CycleCount == evaluation.cycles())
+            evaluation.store(cell, result);
+        bool discard = frame.m_Discard;
+        values.resize(frame.m_Base);
+        frames.pop_back();
+        if (frames.empty())
+            return result;
+        if (!discard) {
+            CFrame &caller = frames.back();
+            values[caller.m_Base + caller.m_State.m_Top++] = result;
+            caller.m_State.m_Pc++;
+        }
+    }
+}
+
+bool CCell::compile(const std::vector<COperation *> &stack, const CPos &pos, CFormulaPool &pool,
+                    CStringPool &strings) {
+    CFormula formula;
+    for (const auto &op: stack)
+        op->compile(formula);
+    if (!formula.finalize(strings)) return false;
+    formula.relocate(-pos.m_Row, -pos.m_Column);
+    m_Formula = pool.intern(std::move(formula));
+    m_Pos = pos;
+    return true;
+}
+
+bool CCell::hasFormula() const {
+    return m_Formula && !m_Formula->empty();
+}
+
+void CCell::getReferences(std::vector<CPos> &refs) const {
+    if (m_Formula)
+        m_Formula->getReferences(m_Pos, refs);
+}
+
+void CCell::getRanges(std::vector<CRange> &ranges) const {
+    if (m_Formula)
+        m_Formula->getRanges(m_Pos, ranges);
+}
+
+bool CCell::saveBinary(std::ostream &os, CArena &arena) const {
+    std::vector<COperation *> stack;
+    if (m_Formula)
+        m_Formula->decompile(arena, m_Pos, stack);
+    size_t stackSize = stack.size();
+    os.write(reinterpret_cast<const char *>(&stackSize), sizeof(stackSize));
+
+    for (const auto &op: stack) {
+        int typeId = op->getTypeId();
+        os.write(reinterpret_cast<const char *>(&typeId), sizeof(typeId));
+        if (!op->saveBinary(os)) return false;
+    }
+
+    // the flag of a calculation in progress, kept in the format of version 1
+    bool isCalculated = false;
+    os.write(reinterpret_cast<const char *>(&isCalculated), sizeof(isCalculated));
+
+    return true;
+}
+
+bool CCell::saveBinary(std::ostream &os, double number) {
+    size_t stackSize = 1;
+    os.write(reinterpret_cast<const char *>(&stackSize), sizeof(stackSize));
+
+    CNumber op(number);
+    int typeId = op.getTypeId();
+    os.write(reinterpret_cast<const char *>(&typeId), sizeof(typeId));
+    if (!op.saveBinary(os)) return false;
+
+    bool isCalculated = false;
+    os.write(reinterpret_cast<const char *>(&isCalculated), sizeof(isCalculated));
+
+    return os.good();
+}
+
+// *—————————————————————————————————————————————————CShared.h——————————————————————————————————————————————————————————————* //
+
+/**
+ * Value shared by copies until one of them changes it.
+ * Copying is constant time, the first change after a copy copies the value. An empty handle stands for a default
+ * constructed value. The owners are counted by the handles themselves, a change may follow the release of the other
+ * owners in another thread and has to synchronize with it, which the relaxed use_count of std::shared_ptr does not.
+ */
+template<typename T>
+class CShared {
+public:
+    CShared() = default;
+
+    CShared(const CShared &other);
+
+    CShared(CShared &&other) noexcept;
+
+    CShared &operator=(CShared other) noexcept;
+
+    ~CShared();
+
+    /**
+     * Check whether the handle holds a value.
+     * @return - true if a value was set or changed
+     */
+    explicit operator bool() const;
+
+    /**
+     * Read the value.
+     * @return - the value, or a default constructed one for an empty handle
+     */
+    const T &operator*() const;
+
+    const T *operator->() const;
+
+    /**
+     * Get the value to change it, copying it first if a copy of the handle still shares it.
+     * @return - value owned by this handle alone
+     */
+    T &edit();
+
+    /**
+     * Check whether the value belongs to this handle alone, so that edit() changes it without copying.
+     * @return - true if the handle holds a value no copy shares
+     */
+    bool owned() const;
+
+    /**
+     * Replace the value.
+     * @param value - new value
+     * @return - the value owned by this handle
+     */
+    T &emplace(T &&value);
+
+    /**
+     * Release the value, the handle becomes empty.
+     */
+    void reset();
+
+private:
+    struct CBox {
+        std::atomic<size_t> m_Owners = 1;
+        T m_Value;
+    };
+
+    CBox *m_Box = nullptr;
+};
+
+/**
+ * Map of keys to blocks, shared by copies of the map at the granularity of single blocks.
+ * Copying is constant time, the first change after a copy copies the table of blocks and the block it changes.
+ */
+template<typename T>
+class CSharedBlocks {
+public:
+    /**
+     * Find a block to read it.
+     * @param key - key of the block
+     * @return - pointer to the block or nullptr if it does not exist
+     */
+    const T *find(uint64_t key) const;
+
+    /**
+     * Find a block to change it.
+     * @param key - key of the block
+     * @return - pointer to the block owned by this map alone or nullptr if it does not exist
+     */
+    T *edit(uint64_t key);
+
+    /**
+     * Find a block to change it only if neither the block nor the table of blocks is shared with a copy.
+     * @param key - key of the block
+     * @return - pointer to the block or nullptr if it does not exist or is shared
+     */
+    T *owned(uint64_t key);
+
+    /**
+     * Get a block to change it, create an empty one if it does not exist.
+     * @param key - key of the block
+     * @return - reference to the block owned by this map alone
+     */
+    T &operator[](uint64_t key);
+
+    /**
+     * Remove a block.
+     * @param key - key of the block
+     */
+    void erase(uint64_t key);
+
+    /**
+     * Remove all blocks.
+     */
+    void clear();
+
+    /**
+     * Get the number of blocks.
+     * @return - number of blocks
+     */
+    size_t size() const;
+
+    /**
+     * Call a function for every block to read it.
+     * @param fn - function called with the key and the block
+     */
+    template<typename F>
+    void forEach(F &&fn) const;
+
+    /**
+     * Call a function for every block to change it, all blocks become owned by this map alone.
+     * @param fn - function called with the key and the block
+     */
+    template<typename F>
+    void forEachEdit(F &&fn);
+
+    /**
+     * Move the blocks of another map to this one. Blocks missing here are taken over without copying.
+     * @param other - map left empty
+     * @param onTaken - function called with every block taken over
+     * @param onPresent - function called with every block of the other map whose key is here already
+     */
+    template<typename FT, typename FP>
+    void merge(CSharedBlocks &&other, FT &&onTaken, FP &&onPresent);
+
+private:
+    CShared<std::unordered_map<uint64_t, CShared<T>>> m_Table;
+};
+
+// *—————————————————————————————————————————————————CShared.cpp——————————————————————————————————————————————————————————————* //
+
+template<typename T>
+CShared<T>::CShared(const CShared &other) : m_Box(other.m_Box) {
+    if (m_Box)
+        m_Box->m_Owners.fetch_add(1, std::memory_order_relaxed);
+}
+
+template<typename T>
+CShared<T>::CShared(CShared &&other) noexcept : m_Box(std::exchange(other.m_Box, nullptr)) {}
+
+template<typename T>
+CShared<T> &CShared<T>::operator=(CShared other) noexcept {
+    std::swap(m_Box, other.m_Box);
+    return *this;
+}
+
+template<typename T>
+CShared<T>::~CShared() {
+    reset();
+}
+
+template<typename T>
+CShared<T>::operator bool() const {
+    return m_Box;
+}
+
+template<typename T>
+const T &CShared<T>::operator*() const {
+    static const T empty{};
+    return m_Box ? m_Box->m_Value : empty;
+}
+
+template<typename T>
+const T *CShared<T>::operator->() const {
+    return &**this;
+}
+
+template<typename T>
+T &CShared<T>::edit() {
+    if (!m_Box)
+        m_Box = new CBox();
+    else if (m_Box->m_Owners.load(std::memory_order_acquire) != 1) {
+        // the copy is made before the handle lets go of the shared value
+        auto *copy = new CBox{1, m_Box->m_Value};
+        reset();
+        m_Box = copy;
+    }
+    return m_Box->m_Value;
+}
+
+template<typename T>
+bool CShared<T>::owned() const {
+    return m_Box && m_Box->m_Owners.load(std::memory_order_acquire) == 1;
+}
+
+template<typename T>
+T &CShared<T>::emplace(T &&value) {
+    auto *box = new CBox{1, std::move(value)};
+    reset();
+    m_Box = box;
+    return m_Box->m_Value;
+}
+
+template<typename T>
+void CShared<T>::reset() {
+    // the last owner sees the changes of all others before deleting
+    if (m_Box && m_Box->m_Owners.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        delete m_Box;
+    m_Box = nullptr;
+}
+
+template<typename T>
+const T *CSharedBlocks<T>::find(uint64_t key) const {
+    auto it = m_Table->find(key);
+    return it == m_Table->end() ? nullptr : &*it->second;
+}
+
+template<typename T>
+T *CSharedBlocks<T>::edit(uint64_t key) {
+    // missing blocks are found without copying the table
+    if (!find(key)) return nullptr;
+    return &m_Table.edit().find(key)->second.edit();
+}
+
+template<typename T>
+T *CSharedBlocks<T>::owned(uint64_t key) {
+    if (!m_Table.owned()) return nullptr;
+    auto it = m_Table.edit().find(key);
+    return it != m_Table->end() && it->second.owned() ? &it->second.edit() : nullptr;
+}
+
+template<typename T>
+T &CSharedBlocks<T>::operator[](uint64_t key) {
+    return m_Table.edit()[key].edit();
+}
+
+template<typename T>
+void CSharedBlocks<T>::erase(uint64_t key) {
+    if (find(key))
+        m_Table.edit().erase(key);
+}
+
+template<typename T>
+void CSharedBlocks<T>::clear() {
+    m_Table.reset();
+}
+
+template<typename T>
+size_t CSharedBlocks<T>::size() const {
+    return m_Table->size();
+}
+
+template<typename T>
+template<typename F>
+void CSharedBlocks<T>::forEach(F &&fn) const {
+    for (const auto &[key, block]: *m_Table)
+        fn(key, *block);
+}
+
+template<typename T>
+template<typename F>
+void CSharedBlocks<T>::forEachEdit(F &&fn) {
+    if (!m_Table) return;
+    for (auto &[key, block]: m_Table.edit())
+        fn(key, block.edit());
+}
+
+template<typename T>
+template<typename FT, typename FP>
+void CSharedBlocks<T>::merge(CSharedBlocks &&other, FT &&onTaken, FP &&onPresent) {
+    if (!other.m_Table) return;
+    for (auto &[key, block]: other.m_Table.edit()) {
+        if (find(key)) {
+            onPresent(block.edit());
+            continue;
+        }
+        onTaken(*block);
+        m_Table.edit().emplace(key, std::move(block));
+    }
+    other.clear();
+}
+
+// *—————————————————————————————————————————————————CGrid.h——————————————————————————————————————————————————————————————* //
+
+/**
+ * Sparse grid of cells split into square tiles.
+ * Tiles are found by hashing, cells of a tile are kept together in one array. Copies of the grid share the tiles
+ * until they change them, so copying is constant time and a change copies only the tile it touches. Every non-const
+ * access to a cell counts as a change, evaluation stores its results in the cells.
+ */
+class CGrid {
+public:
+    /**
+     * Log2 of the tile side.
+     */
+    static constexpr int TILE_BITS = 6;
+
+    static constexpr int TILE_SIZE = 1 << TILE_BITS;
+
+    CGrid() = default;
+
+    CGrid(const CGrid &other) = default;
+
+    CGrid(CGrid &&other) noexcept = default;
+
+    CGrid &operator=(const CGrid &other) = default;
+
+    CGrid &operator=(CGrid &&other) noexcept = default;
+
+    ~CGrid();
+
+    /**
+     * Find a cell.
+     * @param pos - position of the cell
+     * @return - pointer to the cell or nullptr if the cell does not exist
+     */
+    CCell *find(const CPos &pos);
+
+    const CCell *find(const CPos &pos) const;
+
+    /**
+     * Find a cell to change it in place, only if its tile belongs to this grid alone.
+     * @param pos - position of the cell
+     * @return - pointer to the cell or nullptr if the cell does not exist or its tile is shared with a copy
+     */
+    CCell *owned(const CPos &pos);
+
+    /**
+     * Get a cell, create an empty one if it does not exist.
+     * Creating a cell may move other cells of the same tile.
+     * @param pos - position of the cell
+     * @return - reference to the cell
+     */
+    CCell &operator[](const CPos &pos);
+
+    /**
+     * Find a cell or a numeric literal.
+     * @param pos - position of the cell
+     * @param number - set to the numeric literal if the position holds one, nullptr otherwise
+     * @return - pointer to the cell or nullptr if there is no cell
+     */
+    CCell *lookup(const CPos &pos, const double *&number);
+
+    const CCell *lookup(const CPos &pos, const double *&number) const;
+
+    /**
+     * Find a numeric literal.
+     * @param pos - position of the cell
+     * @return - pointer to the number or nullptr if the position does not hold a numeric literal
+     */
+    const double *findNumber(const CPos &pos) const;
+
+    /**
+     * Store a numeric literal, replacing a cell at the same position.
+     * @param pos - position of the cell
+     * @param value - number
+     */
+    void setNumber(const CPos &pos, double value);
+
+    /**
+     * Remove a cell or a numeric literal.
+     * Removing a cell may move other cells of the same tile.
+     * @param pos - position of the cell
+     */
+    void erase(const CPos &pos);
+
+    /**
+     * Get the number of cells.
+     * @return - number of cells
+     */
+    size_t size() const;
+
+    /**
+     * Get the pool the strings of the cells are interned in, copies of the grid share it.
+     * @return - string pool
+     */
+    CStringPool &strings() const;
+
+    /**
+     * Compute the key of the tile containing the position.
+     * @param row - row
+     * @param column - column
+     * @return - tile key
+     */
+    static uint64_t tileKey(int row, int column);
+
+    /**
+     * Compute a key of the position, the same for positions differing only by their absolute flags.
+     * @param pos - position
+     * @return - cell key
+     */
+    static uint64_t cellKey(const CPos &pos);
+
+    /**
+     * Remove all cells.
+     */
+    void clear();
+
+    /**
+     * Move the cells of another grid into this one. Tiles missing here are moved whole, others cell by cell.
+     * @param other - grid whose positions are all empty here, left empty
+     */
+    void merge(CGrid &&other);
+
+    /**
+     * Call a function for every cell, tile by tile. Numeric literals are not included.
+     * @param fn - function called with the position and the cell
+     */
+    template<typename F>
+    void forEach(F &&fn);
+
+    template<typename F>
+    void forEach(F &&fn) const;
+
+    /**
+     * Call a function for every numeric literal, tile by tile.
+     * @param fn - function called with the position and the number
+     */
+    template<typename F>
+    void forEachNumber(F &&fn) const;
+
+    /**
+     * Visit the non-empty positions of a range in place, tile by tile.
+     * Numeric literals are passed one tile column at a time as an array of TILE_SIZE numbers with a mask of the rows
+     * that are present and inside the range, other cells are passed one by one.
+     * @param range - range of cells
+     * @param onNumbers - function called with the array of numbers and the row mask
+     * @param onCell - function called with the position and the cell
+     */
+    template<typename FN, typename FC>
+    void forEachInRange(const CRange &range, FN &&onNumbers, FC &&onCell);
+
+    template<typename FN, typename FC>
+    void forEachInRange(const CRange &range, FN &&onNumbers, FC &&onCell) const;
+
+    /**
+     * Visit the non-empty positions of a range one by one, tile by tile.
+     * @param range - range of cells
+     * @param onNumber - function called with the position and the number of every numeric literal
+     * @param onCell - function called with the position and the cell of every other position
+     */
+    template<typename FN, typename FC>
+    void forEachEntryInRange(const CRange &range, FN &&onNumber, FC &&onCell) const;
+
+    /**
+     * Sum and count the numeric literals of a range in constant time per tile, other cells are passed one by one.
+     * Numbers are read from summed-area tables built on the first query of a tile and rebuilt after its numbers change.
+     * Ranges narrower than TABLE_MIN_COLUMNS within a tile and tiles holding infinite or NaN numbers, or numbers whose
+     * magnitudes differ by more than TABLE_MAX_SPAN binary orders, are not indexed, their numbers are passed one tile
+     * column at a time as in forEachInRange. Tables are built only in tiles not shared with copies of the grid, the
+     * const overload never builds them, it uses only those built already.
+     * @param range - range of cells
+     * @param sum - increased by the sum of the numbers
+     * @param count - increased by the count of the numbers
+     * @param onNumbers - function called with the array of numbers and the row mask
+     * @param onCell - function called with the position and the cell
+     */
+    template<typename FN, typename FC>
+    void sumInRange(const CRange &range, double &sum, size_t &count, FN &&onNumbers, FC &&onCell);
+
+    template<typename FN, typename FC>
+    void sumInRange(const CRange &range, double &sum, size_t &count, FN &&onNumbers, FC &&onCell) const;
+
+    /**
+     * Build the summed-area tables sumInRange over a range would build, so that later queries only read the grid.
+     * @param range - range of cells
+     */
+    void prepareRange(const CRange &range);
+
+private:
+    /**
+     * Side of the summed-area tables, the first row and column are zero.
+     */
+    static constexpr int TABLE_SIZE = TILE_SIZE + 1;
+
+    /**
+     * Narrower parts of ranges are cheaper to sum column by column than to index.
+     */
+    static constexpr int TABLE_MIN_COLUMNS = 8;
+
+    /**
+     * Tiles whose nonzero numbers differ in magnitude by more than two to this power are not indexed, the sums of the
+     * tables would lose the smallest numbers.
+     */
+    static constexpr int TABLE_MAX_SPAN = 40;
+
+    /**
+     * State of the summed-area tables of a tile.
+     */
+    enum class ETable : uint8_t {
+        Stale,
+        Built,
+        Unusable
+    };
+
+    /**
+     * Tiles with at most this many cells find them by searching their slots, denser tiles allocate an index.
+     */
+    static constexpr size_t SPARSE_CELLS = TILE_SIZE;
+
+    /**
+     * Columns of tiles with at most this many numbers keep them packed, fuller columns keep one for every row.
+     */
+    static constexpr int SPARSE_NUMBERS = 16;
+
+    /**
+     * Numeric literals of one column of a tile.
+     */
+    struct CNumberColumn {
+        /**
+         * Rows holding a numeric literal.
+         */
+        uint64_t m_Mask = 0;
+
+        /**
+         * Numbers of the rows in m_Mask in the order of the rows, or TILE_SIZE numbers indexed by the row.
+         */
+        std::vector<double> m_Values;
+    };
+
+    /**
+     * Summed-area tables of a tile.
+     */
+    struct CTables {
+        /**
+         * Sums and counts of the numbers above and to the left of every position, TABLE_SIZE entries per row.
+         * A sum is the rounded sum together with its rounding error in m_SumErrors, so the differences of large sums
+         * keep the small numbers.
+         */
+        std::vector<double> m_SumTable;
+        std::vector<double> m_SumErrors;
+        std::vector<uint16_t> m_CountTable;
+    };
+
+    /**
+     * Square block of cells.
+     */
+    struct CTile {
+        /**
+         * Index of each cell in m_Cells plus one, zero for missing cells. Allocated once the tile holds more than
+         * SPARSE_CELLS cells, the cells of sparser tiles are found in m_Slots.
+         */
+        std::vector<uint16_t> m_Index;
+
+        /**
+         * Cells of the tile.
+         */
+        std::vector<CCell> m_Cells;
+
+        /**
+         * Slot within the tile of each cell in m_Cells.
+         */
+        std::vector<uint16_t> m_Slots;
+
+        /**
+         * Position of the numbers of each column in m_Numbers plus one, zero for columns without numbers.
+         */
+        std::array<uint8_t, TILE_SIZE> m_NumberColumns{};
+
+        /**
+         * Numbers of the columns holding any, a column is allocated with its first number and released with its last.
+         * Copies of the tile share the columns until they change them.
+         */
+        std::vector<CShared<CNumberColumn>> m_Numbers;
+
+        /**
+         * Summed-area tables, allocated when they are built and shared by copies of the tile.
+         */
+        CShared<CTables> m_Tables;
+
+        ETable m_Table = ETable::Stale;
+
+        /**
+         * Position of the top left corner.
+         */
+        int m_Row;
+        int m_Column;
+    };
+
+    /**
+     * Compute the slot of the position within its tile.
+     * @param row - row
+     * @param column - column
+     * @return - slot, rows are stored one after another
+     */
+    static uint16_t tileSlot(int row, int column);
+
+    /**
+     * Find the index of a cell within its tile.
+     * @param tile - tile
+     * @param slot - slot of the cell
+     * @return - index of the cell in m_Cells plus one, zero if the tile does not hold the cell
+     */
+    static uint16_t cellIndex(const CTile &tile, uint16_t slot);
+
+    /**
+     * Find the numbers of a column of a tile.
+     * @param tile - tile
+     * @param column - column within the tile
+     * @return - pointer to the numbers or nullptr if the column holds none
+     */
+    static const CNumberColumn *numberColumn(const CTile &tile, int column);
+
+    /**
+     * Find the number of a row in a column of a tile.
+     * @param numbers - numbers of the column
+     * @param row - row within the tile
+     * @return - pointer to the number or nullptr if the row holds none
+     */
+    static const double *numberAt(const CNumberColumn &numbers, int row);
+
+    /**
+     * Get the numbers of a column indexed by the row, as the kernels read them.
+     * @param numbers - numbers of the column
+     * @param buffer - array the numbers of a packed column are spread to
+     * @return - array of TILE_SIZE numbers, only the rows in the mask of the column are valid
+     */
+    static const double *columnValues(const CNumberColumn &numbers, std::array<double, TILE_SIZE> &buffer);
+
+    /**
+     * Get the numbers of a column of a tile to change them, allocate them if the column holds none.
+     * @param tile - tile
+     * @param column - column within the tile
+     * @return - reference to the numbers owned by the tile alone
+     */
+    static CNumberColumn &editNumberColumn(CTile &tile, int column);
+
+    /**
+     * Remove a number from a tile, the numbers of the column are released with the last of them.
+     * @param tile - tile
+     * @param row - row within the tile
+     * @param column - column within the tile
+     * @return - true if the tile held a number at the position
+     */
+    static bool eraseNumber(CTile &tile, int row, int column);
+
+    /**
+     * Get the tile containing the position, create it if it does not exist.
+     * @param pos - position
+     * @return - reference to the tile
+     */
+    CTile &tileAt(const CPos &pos);
+
+    /**
+     * Remove a cell from a tile, the last cell of the tile takes its place.
+     * @param tile - tile
+     * @param slot - slot of the removed cell
+     */
+    static void eraseCell(CTile &tile, uint16_t slot);
+
+    /**
+     * Build the summed-area tables of a tile if they are stale.
+     * @param tile - tile
+     * @return - false if the tile holds a number that cannot be summed by differences
+     */
+    static bool buildTables(CTile &tile);
+
+    /**
+     * Add a number to a sum kept as a rounded sum and the rounding error, the error of the addition is exact.
+     * @param sum - rounded sum
+     * @param error - rounding error of the sum
+     * @param value - added number
+     */
+    static void addCompensated(double &sum, double &error, double value);
+
+    /**
+     * Compute the mask of a run of rows within a tile.
+     * @param firstRow - first row
+     * @param lastRow - last row
+     * @return - mask with the bits of the rows set
+     */
+    static uint64_t rowMask(int firstRow, int lastRow);
+
+    /**
+     * Call a function for every existing tile overlapping a range.
+     * @param grid - grid, the tiles of a non-const grid are passed to be changed
+     * @param range - range of cells
+     * @param fn - function called with the tile and the first and last row and column of the range within the tile
+     */
+    template<typename G, typename F>
+    static void forEachTileInRange(G &grid, const CRange &range, F &&fn);
+
+    /**
+     * Call a function for every cell of a tile within bounds.
+     */
+    template<typename T, typename FC>
+    static void forEachCellInTile(T &tile, int firstRow, int lastRow, int firstColumn, int lastColumn, FC &&onCell);
+
+    /**
+     * Implementation of forEachInRange for both constness of the grid.
+     */
+    template<typename G, typename FN, typename FC>
+    static void forEachInRange(G &grid, const CRange &range, FN &&onNumbers, FC &&onCell);
+
+    /**
+     * Implementation of sumInRange for both constness of the grid, only a non-const grid builds the tables.
+     */
+    template<typename G, typename FN, typename FC>
+    static void sumInRange(G &grid, const CRange &range, double &sum, size_t &count, FN &&onNumbers, FC &&onCell);
+
+    CSharedBlocks<CTile> m_Tiles;
+
+    size_t m_Size = 0;
+
+    std::shared_ptr<CStringPool> m_Strings = std::make_shared<CStringPool>();
+};
+
+template<typename F>
+void CGrid::forEach(F &&fn) {
+    m_Tiles.forEachEdit([&](uint64_t, CTile &tile) {
+        for (size_t i = 0; i < tile.m_Cells.size(); i++)
+            fn(CPos(tile.m_Row + (tile.m_Slots[i] >> TILE_BITS), tile.m_Column + (tile.m_Slots[i] & (TILE_SIZE - 1))),
+               tile.m_Cells[i]);
+    });
+}
+
+template<typename F>
+void CGrid::forEach(F &&fn) const {
+    m_Tiles.forEach([&](uint64_t, const CTile &tile) {
+        for (size_t i = 0; i < tile.m_Cells.size(); i++)
+            fn(CPos(tile.m_Row + (tile.m_Slots[i] >> TILE_BITS), tile.m_Column + (tile.m_Slots[i] & (TILE_SIZE - 1))),
+               tile.m_Cells[i]);
+    });
+}
+
+template<typename G, typename F>
+void CGrid::forEachTileInRange(G &grid, const CRange &range, F &&fn) {
+    int top = range.top(), bottom = range.bottom(), left = range.left(), right = range.right();
+    auto visit = [&](auto &tile) {
+        int firstRow = std::max(top, tile.m_Row) - tile.m_Row;
+        int lastRow = std::min(bottom, tile.m_Row + TILE_SIZE - 1) - tile.m_Row;
+        int firstColumn = std::max(left, tile.m_Column) - tile.m_Column;
+        int lastColumn = std::min(right, tile.m_Column + TILE_SIZE - 1) - tile.m_Column;
+        if (firstRow <= lastRow && firstColumn <= lastColumn)
+            fn(tile, firstRow, lastRow, firstColumn, lastColumn);
+    };
+    auto tileOf = [&](uint64_t key) {
+        if constexpr (std::is_const_v<G>)
+            return grid.m_Tiles.find(key);
+        else
+            return grid.m_Tiles.edit(key);
+    };
+
+    // walk the tiles covered by the range, or all tiles if there are fewer of them
+    int64_t rangeTiles = (int64_t(bottom >> TILE_BITS) - (top >> TILE_BITS) + 1)
+                         * (int64_t(right >> TILE_BITS) - (left >> TILE_BITS) + 1);
+    if (rangeTiles > static_cast<int64_t>(grid.m_Tiles.size())) {
+        // only the overlapping tiles are changed, the others stay shared
+        std::vector<uint64_t> keys;
+        grid.m_Tiles.forEach([&](uint64_t key, const CTile &tile) {
+            if (tile.m_Row <= bottom && tile.m_Row + TILE_SIZE > top && tile.m_Column <= right
+                && tile.m_Column + TILE_SIZE > left)
+                keys.push_back(key);
+        });
+        for (uint64_t key: keys)
+            visit(*tileOf(key));
+        return;
+    }
+    for (int tileRow = top >> TILE_BITS; tileRow <= bottom >> TILE_BITS; tileRow++)
+        for (int tileColumn = left >> TILE_BITS; tileColumn <= right >> TILE_BITS; tileColumn++)
+            if (auto *tile = tileOf(tileKey(tileRow << TILE_BITS, tileColumn << TILE_BITS)))
+                visit(*tile);
+}
+
+template<typename T, typename FC>
+void CGrid::forEachCellInTile(T &tile, int firstRow, int lastRow, int firstColumn, int lastColumn, FC &&onCell) {
+    for (size_t i = 0; i < tile.m_Cells.size(); i++) {
+        int row = tile.m_Slots[i] >> TILE_BITS, column = tile.m_Slots[i] & (TILE_SIZE - 1);
+        if (row >= firstRow && row <= lastRow && column >= firstColumn && column <= lastColumn)
+            onCell(CPos(tile.m_Row + row, tile.m_Column + column), tile.m_Cells[i]);
+    }
+}
+
+template<typename G, typename FN, typename FC>
+void CGrid::forEachInRange(G &grid, const CRange &range, FN &&onNumbers, FC &&onCell) {
+    std::array<double, TILE_SIZE> buffer{};
+    forEachTileInRange(grid, range, [&](auto &tile, int firstRow, int lastRow, int firstColumn, int lastColumn) {
+        uint64_t rows = rowMask(firstRow, lastRow);
+        if (!tile.m_Numbers.empty())
+            for (int column = firstColumn; column <= lastColumn; column++)
+                if (const CNumberColumn *numbers = numberColumn(tile, column))
+                    if (uint64_t mask = numbers->m_Mask & rows)
+                        onNumbers(columnValues(*numbers, buffer), mask);
+        forEachCellInTile(tile, firstRow, lastRow, firstColumn, lastColumn, onCell);
+    });
+}
+
+template<typename FN, typename FC>
+void CGrid::forEachInRange(const CRange &range, FN &&onNumbers, FC &&onCell) {
+    forEachInRange(*this, range, onNumbers, onCell);
+}
+
+template<typename FN, typename FC>
+void CGrid::forEachInRange(const CRange &range, FN &&onNumbers, FC &&onCell) const {
+    forEachInRange(*this, range, onNumbers, onCell);
+}
+
+template<typename FN, typename FC>
+void CGrid::forEachEntryInRange(const CRange &range, FN &&onNumber, FC &&onCell) const {
+    forEachTileInRange(*this, range, [&](const CTile &tile, int firstRow, int lastRow, int firstColumn, int lastColumn) {
+        uint64_t rows = rowMask(firstRow, lastRow);
+        if (!tile.m_Numbers.empty())
+            for (int column = firstColumn; column <= lastColumn; column++)
+                if (const CNumberColumn *numbers = numberColumn(tile, column))
+                    for (uint64_t mask = numbers->m_Mask & rows; mask; mask &= mask - 1) {
+                        int row = std::countr_zero(mask);
+                        onNumber(CPos(tile.m_Row + row, tile.m_Column + column), *numberAt(*numbers, row));
+                    }
+        forEachCellInTile(tile, firstRow, lastRow, firstColumn, lastColumn, onCell);
+    });
+}
+
+template<typename G, typename FN, typename FC>
+void CGrid::sumInRange(G &grid, const CRange &range, double &sum, size_t &count, FN &&onNumbers, FC &&onCell) {
+    std::array<double, TILE_SIZE> buffer{};
+    forEachTileInRange(std::as_const(grid), range, [&](const CTile &tile, int firstRow, int lastRow, int firstColumn,
+                                                       int lastColumn) {
+        if (!tile.m_Numbers.empty()) {
+            bool wide = lastColumn - firstColumn + 1 >= TABLE_MIN_COLUMNS;
+            bool indexed = wide && tile.m_Table == ETable::Built;
+            // tables are built only in tiles of this grid alone, the tiles shared with copies stay shared
+            if constexpr (!std::is_const_v<G>)
+                if (wide && tile.m_Table == ETable::Stale)
+                    if (CTile *owned = grid.m_Tiles.owned(tileKey(tile.m_Row, tile.m_Column)))
+                        indexed = buildTables(*owned);
+            if (indexed) {
+                // inclusion-exclusion of the four corners of the rectangle
+                int a = firstRow * TABLE_SIZE + firstColumn, b = firstRow * TABLE_SIZE + lastColumn + 1;
+                int c = (lastRow + 1) * TABLE_SIZE + firstColumn, d = (lastRow + 1) * TABLE_SIZE + lastColumn + 1;
+                const CTables &tables = *tile.m_Tables;
+                double corners = tables.m_SumTable[d], error = tables.m_SumErrors[d] - tables.m_SumErrors[b]
+                                                               - tables.m_SumErrors[c] + tables.m_SumErrors[a];
+                addCompensated(corners, error, -tables.m_SumTable[b]);
+                addCompensated(corners, error, -tables.m_SumTable[c]);
+                addCompensated(corners, error, tables.m_SumTable[a]);
+                sum += corners + error;
+                count += tables.m_CountTable[d] - tables.m_CountTable[b] - tables.m_CountTable[c]
+                         + tables.m_CountTable[a];
+            } else {
+                uint64_t rows = rowMask(firstRow, lastRow);
+                for (int column = firstColumn; column <= lastColumn; column++)
+                    if (const CNumberColumn *numbers = numberColumn(tile, column))
+                        if (uint64_t mask = numbers->m_Mask & rows)
+                            onNumbers(columnValues(*numbers, buffer), mask);
+            }
+        }
+        forEachCellInTile(tile, firstRow, lastRow, firstColumn, lastColumn, onCell);
+    });
+}
+
+template<typename FN, typename FC>
+void CGrid::sumInRange(const CRange &range, double &sum, size_t &count, FN &&onNumbers, FC &&onCell) {
+    sumInRange(*this, range, sum, count, onNumbers, onCell);
+}
+
+template<typename FN, typename FC>
+void CGrid::sumInRange(const CRange &range, double &sum, size_t &count, FN &&onNumbers, FC &&onCell) const {
+    sumInRange(*this, range, sum, count, onNumbers, onCell);
+}
+
+template<typename F>
+void CGrid::forEachNumber(F &&fn) const {
+    m_Tiles.forEach([&](uint64_t, const CTile &tile) {
+        for (int column = 0; column < TILE_SIZE; column++)
+            if (const CNumberColumn *numbers = numberColumn(tile, column))
+                for (uint64_t mask = numbers->m_Mask; mask; mask &= mask - 1) {
+                    int row = std::countr_zero(mask);
+                    fn(CPos(tile.m_Row + row, tile.m_Column + column), *numberAt(*numbers, row));
+                }
+    });
+}
+
+// *—————————————————————————————————————————————————CGrid.cpp——————————————————————————————————————————————————————————————* //
+
+uint64_t CGrid::tileKey(int row, int column) {
+    return (static_cast<uint64_t>(static_cast<uint32_t>(row >> TILE_BITS)) << 32)
+           | static_cast<uint32_t>(column >> TILE_BITS);
+}
+
+uint64_t CGrid::cellKey(const CPos &pos) {
+    return (static_cast<uint64_t>(static_cast<uint32_t>(pos.m_Row)) << 32) | static_cast<uint32_t>(pos.m_Column);
+}
+
+uint16_t CGrid::tileSlot(int row, int column) {
+    return static_cast<uint16_t>(((row & (TILE_SIZE - 1)) << TILE_BITS) | (column & (TILE_SIZE - 1)));
+}
+
+CCell *CGrid::find(const CPos &pos) {
+    // the tile is changed only if it holds the cell
+    if (!std::as_const(*this).find(pos)) return nullptr;
+    CTile &tile = *m_Tiles.edit(tileKey(pos.m_Row, pos.m_Column));
+    return &tile.m_Cells[cellIndex(tile, tileSlot(pos.m_Row, pos.m_Column)) - 1];
+}
+
+const CCell *CGrid::find(const CPos &pos) const {
+    const CTile *tile = m_Tiles.find(tileKey(pos.m_Row, pos.m_Column));
+    if (!tile) return nullptr;
+    uint16_t index = cellIndex(*tile, tileSlot(pos.m_Row, pos.m_Column));
+    return index ? &tile->m_Cells[index - 1] : nullptr;
+}
+
+CCell *CGrid::owned(const CPos &pos) {
+    CTile *tile = m_Tiles.owned(tileKey(pos.m_Row, pos.m_Column));
+    if (!tile) return nullptr;
+    uint16_t index = cellIndex(*tile, tileSlot(pos.m_Row, pos.m_Column));
+    return index ? &tile->m_Cells[index - 1] : nullptr;
+}
+
+uint16_t CGrid::cellIndex(const CTile &tile, uint16_t slot) {
+    if (!tile.m_Index.empty())
+        return tile.m_Index[slot];
+    auto it = std::find(tile.m_Slots.begin(), tile.m_Slots.end(), slot);
+    return it == tile.m_Slots.end() ? 0 : static_cast<uint16_t>(it - tile.m_Slots.begin() + 1);
+}
+
+const CGrid::CNumberColumn *CGrid::numberColumn(const CTile &tile, int column) {
+    uint8_t index = tile.m_NumberColumns[column];
+    return index ? &*tile.m_Numbers[index - 1] : nullptr;
+}
+
+const double *CGrid::numberAt(const CNumberColumn &numbers, int row) {
+    if (!((numbers.m_Mask >> row) & 1)) return nullptr;
+    if (numbers.m_Values.size() == TILE_SIZE)
+        return &numbers.m_Values[row];
+    return &numbers.m_Values[std::popcount(numbers.m_Mask & ((uint64_t(1) << row) - 1))];
+}
+
+const double *CGrid::columnValues(const CNumberColumn &numbers, std::array<double, TILE_SIZE> &buffer) {
+    if (numbers.m_Values.size() == TILE_SIZE)
+        return numbers.m_Values.data();
+    size_t i = 0;
+    for (uint64_t mask = numbers.m_Mask; mask; mask &= mask - 1)
+        buffer[std::countr_zero(mask)] = numbers.m_Values[i++];
+    return buffer.data();
+}
+
+CGrid::CNumberColumn &CGrid::editNumberColumn(CTile &tile, int column) {
+    uint8_t &index = tile.m_NumberColumns[column];
+    if (!index) {
+        tile.m_Numbers.emplace_back();
+        index = static_cast<uint8_t>(tile.m_Numbers.size());
+    }
+    return tile.m_Numbers[index - 1].edit();
+}
+
+bool CGrid::eraseNumber(CTile &tile, int row, int column) {
+    const CNumberColumn *numbers = numberColumn(tile, column);
+    uint64_t bit = uint64_t(1) << row;
+    if (!numbers || !(numbers->m_Mask & bit)) return false;
+    tile.m_Table = ETable::Stale;
+    if (numbers->m_Mask != bit) {
+        CNumberColumn &edited = editNumberColumn(tile, column);
+        if (edited.m_Values.size() != TILE_SIZE)
+            edited.m_Values.erase(edited.m_Values.begin() + std::popcount(edited.m_Mask & (bit - 1)));
+        edited.m_Mask &= ~bit;
+        return true;
+    }
+    // the last column takes the place of the released one
+    uint8_t index = std::exchange(tile.m_NumberColumns[column], 0);
+    if (index != tile.m_Numbers.size()) {
+        tile.m_Numbers[index - 1] = std::move(tile.m_Numbers.back());
+        *std::find(tile.m_NumberColumns.begin(), tile.m_NumberColumns.end(), tile.m_Numbers.size()) = index;
+    }
+    tile.m_Numbers.pop_back();
+    return true;
+}
+
+CGrid::CTile &CGrid::tileAt(const CPos &pos) {
+    CTile &tile = m_Tiles[tileKey(pos.m_Row, pos.m_Column)];
+    if (tile.m_Cells.empty() && tile.m_Numbers.empty()) {
+        tile.m_Row = pos.m_Row & ~(TILE_SIZE - 1);
+        tile.m_Column = pos.m_Column & ~(TILE_SIZE - 1);
+    }
+    return tile;
+}
+
+CCell &CGrid::operator[](const CPos &pos) {
+    CTile &tile = tileAt(pos);
+    uint16_t slot = tileSlot(pos.m_Row, pos.m_Column);
+    uint16_t index = cellIndex(tile, slot);
+    if (!index) {
+        if (!eraseNumber(tile, pos.m_Row & (TILE_SIZE - 1), pos.m_Column & (TILE_SIZE - 1)))
+            m_Size++;
+        tile.m_Cells.emplace_back();
+        tile.m_Slots.push_back(slot);
+        index = static_cast<uint16_t>(tile.m_Cells.size());
+        if (!tile.m_Index.empty())
+            tile.m_Index[slot] = index;
+        else if (tile.m_Cells.size() > SPARSE_CELLS) {
+            tile.m_Index.resize(TILE_SIZE * TILE_SIZE);
+            for (size_t i = 0; i < tile.m_Slots.size(); i++)
+                tile.m_Index[tile.m_Slots[i]] = static_cast<uint16_t>(i + 1);
+        }
+    }
+    return tile.m_Cells[index - 1];
+}
+
+CCell *CGrid::lookup(const CPos &pos, const double *&number) {
+    // numbers are read from the tile as it is, only cells are changed by the callers
+    number = findNumber(pos);
+    return number ? nullptr : find(pos);
+}
+
+const CCell *CGrid::lookup(const CPos &pos, const double *&number) const {
+    number = findNumber(pos);
+    return number ? nullptr : find(pos);
+}
+
+const double *CGrid::findNumber(const CPos &pos) const {
+    const CTile *found = m_Tiles.find(tileKey(pos.m_Row, pos.m_Column));
+    if (!found) return nullptr;
+    const CTile &tile = *found;
+    int row = pos.m_Row & (TILE_SIZE - 1), column = pos.m_Column & (TILE_SIZE - 1);
+    const CNumberColumn *numbers = numberColumn(tile, column);
+    return numbers ? numberAt(*numbers, row) : nullptr;
+}
+
+void CGrid::setNumber(const CPos &pos, double value) {
+    CTile &tile = tileAt(pos);
+    uint16_t slot = tileSlot(pos.m_Row, pos.m_Column);
+    int row = pos.m_Row & (TILE_SIZE - 1), column = pos.m_Column & (TILE_SIZE - 1);
+    if (cellIndex(tile, slot))
+        eraseCell(tile, slot);
+    else if (!findNumber(pos))
+        m_Size++;
+    CNumberColumn &numbers = editNumberColumn(tile, column);
+    uint64_t bit = uint64_t(1) << row;
+    if (numbers.m_Values.size() != TILE_SIZE && !(numbers.m_Mask & bit)
+        && std::popcount(numbers.m_Mask) == SPARSE_NUMBERS) {
+        // the column becomes full enough to keep a number for every row
+        std::array<double, TILE_SIZE> spread{};
+        columnValues(numbers, spread);
+        numbers.m_Values.assign(spread.begin(), spread.end());
+    }
+    if (numbers.m_Values.size() == TILE_SIZE)
+        numbers.m_Values[row] = value;
+    else {
+        auto at = numbers.m_Values.begin() + std::popcount(numbers.m_Mask & (bit - 1));
+        if (numbers.m_Mask & bit)
+            *at = value;
+        else
+            numbers.m_Values.insert(at, value);
+    }
+    numbers.m_Mask |= bit;
+    tile.m_Table = ETable::Stale;
+}
+
+void CGrid::erase(const CPos &pos) {
+    if (!std::as_const(*this).find(pos) && !findNumber(pos)) return;
+    CTile &tile = *m_Tiles.edit(tileKey(pos.m_Row, pos.m_Column));
+    uint16_t slot = tileSlot(pos.m_Row, pos.m_Column);
+    if (cellIndex(tile, slot)) {
+        eraseCell(tile, slot);
+        m_Size--;
+    } else if (eraseNumber(tile, pos.m_Row & (TILE_SIZE - 1), pos.m_Column & (TILE_SIZE - 1)))
+        m_Size--;
+}
+
+void CGrid::eraseCell(CTile &tile, uint16_t slot) {
+    uint16_t index = cellIndex(tile, slot) - 1;
+    if (index + 1u != tile.m_Cells.size()) {
+        tile.m_Cells[index] = std::move(tile.m_Cells.back());
+        tile.m_Slots[index] = tile.m_Slots.back();
+        if (!tile.m_Index.empty())
+            tile.m_Index[tile.m_Slots[index]] = index + 1;
+    }
+    tile.m_Cells.pop_back();
+    tile.m_Slots.pop_back();
+    if (!tile.m_Index.empty())
+        tile.m_Index[slot] = 0;
+}
+
+void CGrid::prepareRange(const CRange &range) {
+    forEachTileInRange(*this, range, [&](CTile &tile, int, int, int firstColumn, int lastColumn) {
+        if (!tile.m_Numbers.empty() && lastColumn - firstColumn + 1 >= TABLE_MIN_COLUMNS)
+            buildTables(tile);
+    });
+}
+
+uint64_t CGrid::rowMask(int firstRow, int lastRow) {
+    return (lastRow == TILE_SIZE - 1 ? ~uint64_t(0) : (uint64_t(1) << (lastRow + 1)) - 1)
+           & ~((uint64_t(1) << firstRow) - 1);
+}
+
+bool CGrid::buildTables(CTile &tile) {
+    if (tile.m_Table != ETable::Stale)
+        return tile.m_Table == ETable::Built;
+    // differences of infinite sums are undefined, sums of numbers of too different magnitudes lose the small ones
+    double smallest = std::numeric_limits<double>::infinity(), largest = 0;
+    bool finite = true;
+    for (const CShared<CNumberColumn> &numbers: tile.m_Numbers)
+        for (uint64_t mask = numbers->m_Mask; mask; mask &= mask - 1) {
+            double magnitude = std::fabs(*numberAt(*numbers, std::countr_zero(mask)));
+            finite = finite && std::isfinite(magnitude);
+            if (magnitude != 0)
+                smallest = std::min(smallest, magnitude);
+            largest = std::max(largest, magnitude);
+        }
+    if (!finite || largest > std::ldexp(smallest, TABLE_MAX_SPAN)) {
+        tile.m_Tables.reset();
+        tile.m_Table = ETable::Unusable;
+        return false;
+    }
+
+    // copies of the tile keep the tables they share
+    CTables tables;
+    tables.m_SumTable.assign(TABLE_SIZE * TABLE_SIZE, 0);
+    tables.m_SumErrors.assign(TABLE_SIZE * TABLE_SIZE, 0);
+    tables.m_CountTable.assign(TABLE_SIZE * TABLE_SIZE, 0);
+    std::array<const CNumberColumn *, TILE_SIZE> columns;
+    for (int column = 0; column < TILE_SIZE; column++)
+        columns[column] = numberColumn(tile, column);
+    for (int row = 0; row < TILE_SIZE; row++)
+        for (int column = 0; column < TILE_SIZE; column++) {
+            const double *found = columns[column] ? numberAt(*columns[column], row) : nullptr;
+            uint16_t present = found != nullptr;
+            double number = present ? *found : 0;
+            int at = (row + 1) * TABLE_SIZE + column + 1;
+            int left = at - 1, up = at - TABLE_SIZE, diagonal = at - TABLE_SIZE - 1;
+            double sum = number, error = tables.m_SumErrors[left] + tables.m_SumErrors[up]
+                                         - tables.m_SumErrors[diagonal];
+            addCompensated(sum, error, tables.m_SumTable[left]);
+            addCompensated(sum, error, tables.m_SumTable[up]);
+            addCompensated(sum, error, -tables.m_SumTable[diagonal]);
+            // the error is folded into the sum as far as it fits, what is left stays exact
+            double rounded = 0;
+            addCompensated(sum, rounded, error);
+            tables.m_SumTable[at] = sum;
+            tables.m_SumErrors[at] = rounded;
+            tables.m_CountTable[at] = present + tables.m_CountTable[at - 1] + tables.m_CountTable[at - TABLE_SIZE]
+                                      - tables.m_CountTable[at - TABLE_SIZE - 1];
+        }
+    tile.m_Tables.emplace(std::move(tables));
+    tile.m_Table = ETable::Built;
+    return true;
+}
+
+void CGrid::addCompensated(double &sum, double &error, double value) {
+    double total = sum + value;
+    double part = total - sum;
+    error += (sum - (total - part)) + (value - part);
+    sum = total;
+}
+
+size_t CGrid::size() const {
+    return m_Size;
+}
+
+CStringPool &CGrid::strings() const {
+    return *m_Strings;
+}
+
+CGrid::~CGrid() {
+    // the cells release their strings into the pool, so they go first
+    m_Tiles.clear();
+}
+
+void CGrid::clear() {
+    m_Tiles.clear();
+    m_Size = 0;
+}
+
+void CGrid::merge(CGrid &&other) {
+    m_Tiles.merge(std::move(other.m_Tiles), [&](const CTile &tile) {
+        m_Size += tile.m_Cells.size();
+        for (const CShared<CNumberColumn> &numbers: tile.m_Numbers)
+            m_Size += std::popcount(numbers->m_Mask);
+    }, [&](CTile &tile) {
+        for (size_t i = 0; i < tile.m_Cells.size(); i++) {
+            int row = tile.m_Slots[i] >> TILE_BITS, column = tile.m_Slots[i] & (TILE_SIZE - 1);
+            (*this)[CPos(tile.m_Row + row, tile.m_Column + column)] = std::move(tile.m_Cells[i]);
+        }
+        for (int column = 0; column < TILE_SIZE; column++)
+            if (const CNumberColumn *numbers = numberColumn(tile, column))
+                for (uint64_t mask = numbers->m_Mask; mask; mask &= mask - 1) {
+                    int row = std::countr_zero(mask);
+                    setNumber(CPos(tile.m_Row + row, tile.m_Column + column), *numberAt(*numbers, row));
+                }
+    });
+    other.clear();
+}
+
+// *—————————————————————————————————————————————————CEvaluation.cpp——————————————————————————————————————————————————————————————* //
+
+CEvaluation::CEvaluation(CGrid &sheet) : m_Sheet(sheet), m_Writable(&sheet) {
+    m_Sheet.strings().enter();
+}
+
+CEvaluation::CEvaluation(const CGrid &sheet) : m_Sheet(sheet) {
+    m_Sheet.strings().enter();
+}
+
+CEvaluation::~CEvaluation() {
+    m_Sheet.strings().leave();
+}
+
+const CCell *CEvaluation::lookup(const CPos &pos, const double *&number) {
+    return m_Sheet.lookup(pos, number);
+}
+
+bool CEvaluation::cached(const CCell &cell, CCompactValue &value) const {
+    if (cell.m_IsCached) {
+        value = cell.m_Value;
+        return true;
+    }
+    if (m_Values.empty()) return false;
+    auto it = m_Values.find(&cell);
+    if (it == m_Values.end()) return false;
+    value = it->second;
+    return true;
+}
+
+bool CEvaluation::needsEvaluation(const CCell *cell) const {
+    CCompactValue value;
+    return cell && cell->hasFormula() && !cell->m_InCycle && !cached(*cell, value) && !isCalculating(*cell);
+}
+
+bool CEvaluation::isCalculating(const CCell &cell) const {
+    auto end = m_Calculating.begin() + std::min(m_Depth, SHORT_PATH);
+    return std::find(m_Calculating.begin(), end, &cell) != end || (!m_DeepSet.empty() && m_DeepSet.count(&cell));
+}
+
+void CEvaluation::enter(const CCell &cell) {
+    if (m_Depth < SHORT_PATH)
+        m_Calculating[m_Depth] = &cell;
+    else {
+        m_Deep.push_back(&cell);
+        m_DeepSet.insert(&cell);
+    }
+    m_Depth++;
+}
+
+void CEvaluation::leave() {
+    if (--m_Depth >= SHORT_PATH) {
+        m_DeepSet.erase(m_Deep.back());
+        m_Deep.pop_back();
+    }
+}
+
+void CEvaluation::store(const CCell &cell, const CCompactValue &value) {
+    // a writer caches the value in the cell if no copy of the grid shares its tile
+    if (CCell *owned = m_Writable ? m_Writable->owned(cell.m_Pos) : nullptr; owned == &cell) {
+        owned->m_Value = value;
+        owned->m_IsCached = true;
+        return;
+    }
+    if (m_Writable)
+        m_Unstored.push_back(cell.m_Pos);
+    m_Values[&cell] = value;
+}
+
+void CEvaluation::flush() {
+    if (m_Unstored.empty()) return;
+    // the values are found before any tile is copied, the cells they were calculated for move with the copies
+    std::vector<CCompactValue> values;
+    for (const auto &pos: m_Unstored)
+        values.push_back(m_Values.at(m_Sheet.find(pos)));
+    for (size_t i = 0; i < m_Unstored.size(); i++) {
+        CCell *cell = m_Writable->find(m_Unstored[i]);
+        cell->m_Value = values[i];
+        cell->m_IsCached = true;
+    }
+    m_Unstored.clear();
+    m_Values.clear();
+}
+
+void CEvaluation::cycle() {
+    m_Cycles++;
+}
+
+unsigned CEvaluation::cycles() const {
+    return m_Cycles;
+}
+
+template<typename FN, typename FC>
+void CEvaluation::forEachInRange(const CRange &range, FN &&onNumbers, FC &&onCell) {
+    m_Sheet.forEachInRange(range, onNumbers, onCell);
+}
+
+template<typename FN, typename FC>
+void CEvaluation::sumInRange(const CRange &range, double &sum, size_t &count, FN &&onNumbers, FC &&onCell) {
+    // a reader sums the tiles whose tables are stale column by column, a writer builds those it owns
+    if (m_Writable)
+        m_Writable->sumInRange(range, sum, count, onNumbers, onCell);
+    else
+        m_Sheet.sumInRange(range, sum, count, onNumbers, onCell);
+}
+
+CStringPool &CEvaluation::strings() const {
+    return m_Sheet.strings();
+}
+
+// *—————————————————————————————————————————————————CKernels.h——————————————————————————————————————————————————————————————* //
+
+/**
+ * Aggregation kernels over one tile column of numeric literals.
+ * Every kernel takes CGrid::TILE_SIZE numbers and a mask of the rows to use, rows outside the mask are never read
+ * as values. SSE2 is used where available, other targets fall back to scalar loops.
+ */
+class CKernels {
+public:
+    /**
+     * Sum the selected numbers.
+     * @param values - numbers of a tile column
+     * @param mask - rows to use
+     * @return - sum
+     */
+    static double sum(const double *values, uint64_t mask);
+
+    /**
+     * Find the smallest selected number.
+     * @param values - numbers of a tile column
+     * @param mask - rows to use, must not be empty
+     * @return - minimum
+     */
+    static double min(const double *values, uint64_t mask);
+
+    /**
+     * Find the largest selected number.
+     * @param values - numbers of a tile column
+     * @param mask - rows to use, must not be empty
+     * @return - maximum
+     */
+    static double max(const double *values, uint64_t mask);
+
+    /**
+     * Count the selected numbers equal to a value.
+     * @param values - numbers of a tile column
+     * @param mask - rows to use
+     * @param value - compared value
+     * @return - count of equal numbers
+     */
+    static int countEqual(const double *values, uint64_t mask, double value);
+
+private:
+    /**
+     * Masks with fewer rows are cheaper to walk bit by bit.
+     */
+    static constexpr int SPARSE_MASK = 8;
+
+#if defined(__SSE2__)
+    /**
+     * Expand two bits of a row mask to a lane mask.
+     * @param bits - two mask bits
+     * @return - lane mask with all bits of a lane set for a set mask bit
+     */
+    static __m128d laneMask(uint64_t bits);
+#endif
+};
+
+// *—————————————————————————————————————————————————CKernels.cpp——————————————————————————————————————————————————————————————* //
+
+#if defined(__SSE2__)
+
+__m128d CKernels::laneMask(uint64_t bits) {
+    return _mm_castsi128_pd(_mm_set_epi64x(bits & 2 ? -1 : 0, bits & 1 ? -1 : 0));
+}
+
+double CKernels::sum(const double *values, uint64_t mask) {
+    if (std::popcount(mask) < SPARSE_MASK) {
+        double result = 0;
+        for (; mask; mask &= mask - 1)
+            result += values[std::countr_zero(mask)];
+        return result;
+    }
+    __m128d acc0 = _mm_setzero_pd(), acc1 = _mm_setzero_pd();
+    if (mask == ~uint64_t(0)) {
+        for (int i = 0; i < CGrid::TILE_SIZE; i += 4) {
+            acc0 = _mm_add_pd(acc0, _mm_loadu_pd(values + i));
+            acc1 = _mm_add_pd(acc1, _mm_loadu_pd(values + i + 2));
+        }
+    } else {
+        for (int i = 0; i < CGrid::TILE_SIZE; i += 2)
+            if (uint64_t bits = (mask >> i) & 3)
+                acc0 = _mm_add_pd(acc0, _mm_and_pd(_mm_loadu_pd(values + i), laneMask(bits)));
+    }
+    acc0 = _mm_add_pd(acc0, acc1);
+    return _mm_cvtsd_f64(_mm_add_sd(acc0, _mm_unpackhi_pd(acc0, acc0)));
+}
+
+double CKernels::min(const double *values, uint64_t mask) {
+    const __m128d fill = _mm_set1_pd(std::numeric_limits<double>::infinity());
+    __m128d acc = fill;
+    for (int i = 0; i < CGrid::TILE_SIZE; i += 2)
+        if (uint64_t bits = (mask >> i) & 3) {
+            __m128d lanes = laneMask(bits);
+            acc = _mm_min_pd(acc, _mm_or_pd(_mm_and_pd(lanes, _mm_loadu_pd(values + i)), _mm_andnot_pd(lanes, fill)));
+        }
+    return std::min(_mm_cvtsd_f64(acc), _mm_cvtsd_f64(_mm_unpackhi_pd(acc, acc)));
+}
+
+double CKernels::max(const double *values, uint64_t mask) {
+    const __m128d fill = _mm_set1_pd(-std::numeric_limits<double>::infinity());
+    __m128d acc = fill;
+    for (int i = 0; i < CGrid::TILE_SIZE; i += 2)
+        if (uint64_t bits = (mask >> i) & 3) {
+            __m128d lanes = laneMask(bits);
+            acc = _mm_max_pd(acc, _mm_or_pd(_mm_and_pd(lanes, _mm_loadu_pd(values + i)), _mm_andnot_pd(lanes, fill)));
+        }
+    return std::max(_mm_cvtsd_f64(acc), _mm_cvtsd_f64(_mm_unpackhi_pd(acc, acc)));
+}
+
+int CKernels::countEqual(const double *values, uint64_t mask, double value) {
+    const __m128d target = _mm_set1_pd(value);
+    uint64_t equal = 0;
+    for (int i = 0; i < CGrid::TILE_SIZE; i += 2)
+        equal |= static_cast<uint64_t>(_mm_movemask_pd(_mm_cmpeq_pd(_mm_loadu_pd(values + i), target))) << i;
+    return std::popcount(equal & mask);
+}
+
+#else
+
+double CKernels::sum(const double *values, uint64_t mask) {
+    double result = 0;
+    for (; mask; mask &= mask - 1)
+        result += values[std::countr_zero(mask)];
+    return result;
+}
+
+double CKernels::min(const double *values, uint64_t mask) {
+    double result = std::numeric_limits<double>::infinity();
+    for (; mask; mask &= mask - 1)
+        result = std::min(result, values[std::countr_zero(mask)]);
+    return result;
+}
+
+double CKernels::max(const double *values, uint64_t mask) {
+    double result = -std::numeric_limits<double>::infinity();
+    for (; mask; mask &= mask - 1)
+        result = std::max(result, values[std::countr_zero(mask)]);
+    return result;
+}
+
+int CKernels::countEqual(const double *values, uint64_t mask, double value) {
+    int result = 0;
+    for (; mask; mask &= mask - 1)
+        result += values[std::countr_zero(mask)] == value;
+    return result;
+}
+
+#endif
+
+// *—————————————————————————————————————————————————CFunctionRegistry.cpp——————————————————————————————————————————————————————————————* //
+
+/**
+ * Visit the values of a range, numeric literals tile column by tile column, other cells one by one.
+ * @param evaluation - evaluation the cells are read in
+ * @param range - range of cells
+ * @param onNumbers - function called with an array of numbers and a mask of the rows to use
+ * @param onValue - function called with the value of every other non-empty cell
+ */
+template<typename FN, typename FV>
+static void visitRange(CEvaluation &evaluation, const CRange &range, FN &&onNumbers, FV &&onValue) {
+    evaluation.forEachInRange(range, onNumbers, [&](const CPos &, const CCell &cell) {
+        if (cell.hasFormula())
+            onValue(cell.calculateCell(evaluation));
+    });
+}
+
+static CCompactValue functionSum(const CCompactValue *, const CRange *const *ranges, CEvaluation &evaluation) {
+    double sum = 0;
+    size_t count = 0;
+    evaluation.sumInRange(*ranges[0], sum, count, [&](const double *numbers, uint64_t mask) {
+        sum += CKernels::sum(numbers, mask);
+        count += std::popcount(mask);
+    }, [&](const CPos &, const CCell &cell) {
+        if (!cell.hasFormula()) return;
+        CCompactValue value = cell.calculateCell(evaluation);
+        if (value.isNumber()) {
+            sum += value.number();
+            count++;
+        }
+    });
+    return count ? CCompactValue(sum) : CCompactValue();
+}
+
+static CCompactValue functionCount(const CCompactValue *, const CRange *const *ranges, CEvaluation &evaluation) {
+    double sum = 0;
+    size_t count = 0;
+    evaluation.sumInRange(*ranges[0], sum, count, [&](const double *, uint64_t mask) {
+        count += std::popcount(mask);
+    }, [&](const CPos &, const CCell &cell) {
+        if (cell.hasFormula() && !cell.calculateCell(evaluation).isUndefined())
+            count++;
+    });
+    return static_cast<double>(count);
+}
+
+static CCompactValue functionMin(const CCompactValue *, const CRange *const *ranges, CEvaluation &evaluation) {
+    double min = std::numeric_limits<double>::infinity();
+    bool any = false;
+    visitRange(evaluation, *ranges[0], [&](const double *numbers, uint64_t mask) {
+        min = std::min(min, CKernels::min(numbers, mask));
+        any = true;
+    }, [&](const CCompactValue &value) {
+        if (value.isNumber()) {
+            min = std::min(min, value.number());
+            any = true;
+        }
+    });
+    return any ? CCompactValue(min) : CCompactValue();
+}
+
+static CCompactValue functionMax(const CCompactValue *, const CRange *const *ranges, CEvaluation &evaluation) {
+    double max = -std::numeric_limits<double>::infinity();
+    bool any = false;
+    visitRange(evaluation, *ranges[0], [&](const double *numbers, uint64_t mask) {
+        max = std::max(max, CKernels::max(numbers, mask));
+        any = true;
+    }, [&](const CCompactValue &value) {
+        if (value.isNumber()) {
+            max = std::max(max, value.number());
+            any = true;
+        }
+    });
+    return any ? CCompactValue(max) : CCompactValue();
+}
+
+static CCompactValue functionCountVal(const CCompactValue *values, const CRange *const *ranges, CEvaluation &evaluation) {
+    const CCompactValue &wanted = values[0];
+    double count = 0;
+    if (wanted.isUndefined())
+        return count;
+    visitRange(evaluation, *ranges[1], [&](const double *numbers, uint64_t mask) {
+        if (wanted.isNumber())
+            count += CKernels::countEqual(numbers, mask, wanted.number());
+    }, [&](const CCompactValue &value) {
+        if (value == wanted)
+            count++;
+    });
+    return count;
+}
+
+static CCompactValue functionIf(const CCompactValue *values, const CRange *const *, CEvaluation &) {
+    if (!values[0].isNumber()) return {};
+    return values[0].number() != 0 ? values[1] : values[2];
+}
+
+/**
+ * built-in functions indexed by id
+ */
+static const CFunction FUNCTIONS[] = {
+        {"sum",      1, 0b001, functionSum},
+        {"count",    1, 0b001, functionCount},
+        {"min",      1, 0b001, functionMin},
+        {"max",      1, 0b001, functionMax},
+        {"countval", 2, 0b010, functionCountVal},
+        {"if",       3, 0b000, functionIf},
+};
+
+int CFunctionRegistry::find(std::string_view name) {
+    for (int i = 0; i < size(); i++)
+        if (name == FUNCTIONS[i].m_Name)
+            return i;
+    return -1;
+}
+
+const CFunction &CFunctionRegistry::get(int id) {
+    return FUNCTIONS[id];
+}
+
+int CFunctionRegistry::size() {
+    return static_cast<int>(std::size(FUNCTIONS));
+}
+
+// *—————————————————————————————————————————————————CFormula.cpp————————————————————————————————————————————* //
+
+void CFormula::emit(EOpCode op, uint32_t arg) {
+    CInstruction instruction{};
+    instruction.m_Op = op;
+    instruction.m_Arg = arg;
+    m_Code.push_back(instruction);
+}
+
+void CFormula::emitNumber(double value) {
+    CInstruction instruction{};
+    instruction.m_Op = EOpCode::Number;
+    instruction.m_Number = value;
+    m_Code.push_back(instruction);
+}
+
+void CFormula::emitString(const std::string &value) {
+    CInstruction instruction{};
+    instruction.m_Op = EOpCode::String;
+    instruction.m_Arg = static_cast<uint32_t>(m_Strings.size());
+    m_Strings.push_back(value);
+    m_Code.push_back(instruction);
+}
+
+void CFormula::emitReference(const CPos &pos) {
+    CInstruction instruction{};
+    instruction.m_Op = EOpCode::Reference;
+    instruction.setPos(pos);
+    m_Code.push_back(instruction);
+}
+
+void CFormula::emitCall(int function, int paramCount) {
+    CInstruction instruction{};
+    instruction.m_Op = EOpCode::FuncCall;
+    instruction.m_Arg = static_cast<uint32_t>(m_Calls.size());
+    m_Calls.push_back({static_cast<uint32_t>(function), static_cast<uint32_t>(paramCount), {}});
+    m_Code.push_back(instruction);
+}
+
+void CFormula::emitRange(const CRange &range) {
+    CInstruction instruction{};
+    instruction.m_Op = EOpCode::Range;
+    instruction.m_Arg = static_cast<uint32_t>(m_Ranges.size());
+    m_Ranges.push_back(range);
+    m_Code.push_back(instruction);
+}
+
+bool CFormula::finalize(CStringPool &strings) {
+    if (!analyze()) return false;
+    fold();
+    analyze();
+    m_Handles.assign(strings, m_Strings);
+    return true;
+}
+
+bool CFormula::analyze() {
+    // range index of every value stack slot, ranges may only be passed to range parameters of functions
+    constexpr int32_t NO_RANGE = -1;
+    std::vector<int32_t> slots;
+    m_MaxDepth = 0;
+    for (const auto &instruction: m_Code) {
+        size_t depth = slots.size();
+        switch (instruction.m_Op) {
+            case EOpCode::String:
+                if (instruction.m_Arg >= m_Strings.size()) return false;
+                slots.push_back(NO_RANGE);
+                break;
+            case EOpCode::Range:
+                if (instruction.m_Arg >= m_Ranges.size()) return false;
+                slots.push_back(static_cast<int32_t>(instruction.m_Arg));
+                break;
+            case EOpCode::Number:
+            case EOpCode::Reference:
+                slots.push_back(NO_RANGE);
+                break;
+            case EOpCode::Neg:
+                if (depth < 1 || slots.back() != NO_RANGE) return false;
+                break;
+            case EOpCode::FuncCall: {
+                if (instruction.m_Arg >= m_Calls.size()) return false;
+                CCallSite &call = m_Calls[instruction.m_Arg];
+                if (call.m_Function >= static_cast<uint32_t>(CFunctionRegistry::size())) return false;
+                const CFunction &function = CFunctionRegistry::get(static_cast<int>(call.m_Function));
+                if (call.m_ParamCount != static_cast<uint32_t>(function.m_ParamCount) || depth < call.m_ParamCount)
+                    return false;
+                for (uint32_t i = 0; i < call.m_ParamCount; i++) {
+                    int32_t range = slots[depth - call.m_ParamCount + i];
+                    if ((range != NO_RANGE) != static_cast<bool>((function.m_RangeParams >> i) & 1)) return false;
+                    call.m_Ranges[i] = range;
+                }
+                slots.resize(depth - call.m_ParamCount);
+                slots.push_back(NO_RANGE);
+                break;
+            }
+            case EOpCode::Add:
+            case EOpCode::Sub:
+            case EOpCode::Mul:
+            case EOpCode::Div:
+            case EOpCode::Pow:
+            case EOpCode::Eq:
+            case EOpCode::Ne:
+            case EOpCode::Lt:
+            case EOpCode::Le:
+            case EOpCode::Gt:
+            case EOpCode::Ge:
+                if (depth < 2 || slots[depth - 1] != NO_RANGE || slots[depth - 2] != NO_RANGE) return false;
+                slots.pop_back();
+                break;
+            default:
+                return false;
+        }
+        m_MaxDepth = std::max(m_MaxDepth, static_cast<uint32_t>(slots.size()));
+    }
+    return m_Code.empty() || (slots.size() == 1 && slots[0] == NO_RANGE);
+}
+
+CCompactValue CFormula::evaluate(CGrid &sheet, const CPos &origin) const {
+    // short formulas fit a value stack on the native stack, longer ones get a heap one
+    constexpr uint32_t SMALL_STACK = 8;
+    std::array<CCompactValue, SMALL_STACK> small;
+    std::vector<CCompactValue> large;
+    if (stackSize() > SMALL_STACK)
+        large.resize(stackSize());
+    CCompactValue *values = large.empty() ? small.data() : large.data();
+
+    CEvaluation evaluation(sheet);
+    CState state;
+    std::vector<const CCell *> wait;
+    for (;;) {
+        wait.clear();
+        switch (resume(evaluation, origin, values, state, wait)) {
+            case EStep::Done:
+                return values[0];
+            case EStep::Reference:
+                values[state.m_Top++] = wait[0]->calculateCell(evaluation);
+                state.m_Pc++;
+                break;
+            case EStep::Ranges:
+                // the function evaluates the cells of its ranges itself
+                break;
+        }
+    }
+}
+
+uint32_t CFormula::stackSize() const {
+    return std::max<uint32_t>(m_MaxDepth, 1);
+}
+
+/**
+ * apply a binary operator, the result replaces the left operand
+ * @param op opcode of the operator
+ * @param left left operand and result
+ * @param right right operand
+ * @param strings string pool of the sheet, concatenated strings are interned in it
+ */
+static void applyBinary(EOpCode op, CCompactValue &left, const CCompactValue &right, CStringPool &strings) {
+    if (left.isNumber() && right.isNumber()) {
+        double l = left.number(), r = right.number();
+        switch (op) {
+            case EOpCode::Add:
+                left = l + r;
+                return;
+            case EOpCode::Sub:
+                left = l - r;
+                return;
+            case EOpCode::Mul:
+                left = l * r;
+                return;
+            case EOpCode::Div:
+                if (r == 0) left = CCompactValue();
+                else left = l / r;
+                return;
+            case EOpCode::Pow:
+                left = r == 0 ? 1.0 : std::pow(l, r);
+                return;
+            case EOpCode::Eq:
+                left = l == r ? 1.0 : 0.0;
+                return;
+            case EOpCode::Ne:
+                left = l != r ? 1.0 : 0.0;
+                return;
+            case EOpCode::Lt:
+                left = l < r ? 1.0 : 0.0;
+                return;
+            case EOpCode::Le:
+                left = l <= r ? 1.0 : 0.0;
+                return;
+            case EOpCode::Gt:
+                left = l > r ? 1.0 : 0.0;
+                return;
+            case EOpCode::Ge:
+                left = l >= r ? 1.0 : 0.0;
+                return;
+            default:
+                left = CCompactValue();
+                return;
+        }
+    }
+
+    if (left.isString() && right.isString()) {
+        // interned strings are equal exactly when their handles are, only ordering looks at the characters
+        bool same = left.handle() == right.handle();
+        switch (op) {
+            case EOpCode::Add:
+                left = strings.intern(left.string() + right.string());
+                return;
+            case EOpCode::Eq:
+                left = same ? 1.0 : 0.0;
+                return;
+            case EOpCode::Ne:
+                left = same ? 0.0 : 1.0;
+                return;
+            case EOpCode::Lt:
+                left = !same && left.string() < right.string() ? 1.0 : 0.0;
+                return;
+            case EOpCode::Le:
+                left = same || left.string() < right.string() ? 1.0 : 0.0;
+                return;
+            case EOpCode::Gt:
+                left = !same && left.string() > right.string() ? 1.0 : 0.0;
+                return;
+            case EOpCode::Ge:
+                left = same || left.string() > right.string() ? 1.0 : 0.0;
+                return;
+            default:
+                break;
+        }
+    }
+    left = CCompactValue();
+}
+
+void CFormula::fold() {
+    // what the value of a slot of the value stack is known to be
+    enum class EKind : uint8_t {
+        Number, String, Undefined,
+        /**
+         * computed when evaluated
+         */
+        Other
+    };
+    struct CSlot {
+        /**
+         * first instruction computing the slot, it ends where the next slot starts
+         */
+        size_t m_Start;
+        EKind m_Kind;
+        /**
+         * the value is a number or undefined, never a string
+         */
+        bool m_Numeric;
+        bool m_Range;
+        /**
+         * the slot negates a number or undefined
+         */
+        bool m_NegatesNumeric;
+
+        bool numeric() const {
+            return m_Kind == EKind::Number || m_Kind == EKind::Undefined || m_Numeric;
+        }
+    };
+    std::vector<CInstruction> code;
+    std::vector<CSlot> slots;
+    CStringPool strings;
+
+    auto valueOf = [&](const CSlot &slot) -> CCompactValue {
+        if (slot.m_Kind == EKind::Number) return code[slot.m_Start].m_Number;
+        if (slot.m_Kind == EKind::String) return strings.intern(m_Strings[code[slot.m_Start].m_Arg]);
+        return {};
+    };
+    // replace the instructions from start on by a constant
+    auto pushConstant = [&](size_t start, const CCompactValue &value) {
+        code.resize(start);
+        CInstruction instruction{};
+        if (value.isNumber()) {
+            instruction.m_Op = EOpCode::Number;
+            instruction.m_Number = value.number();
+            code.push_back(instruction);
+            slots.push_back({start, EKind::Number, true, false, false});
+        } else if (value.isString()) {
+            instruction.m_Op = EOpCode::String;
+            instruction.m_Arg = static_cast<uint32_t>(m_Strings.size());
+            m_Strings.push_back(value.string());
+            code.push_back(instruction);
+            slots.push_back({start, EKind::String, false, false, false});
+        } else {
+            // there is no undefined constant, zero divided by zero is the shortest expression giving it
+            instruction.m_Op = EOpCode::Number;
+            code.push_back(instruction);
+            code.push_back(instruction);
+            instruction.m_Op = EOpCode::Div;
+            code.push_back(instruction);
+            slots.push_back({start, EKind::Undefined, true, false, false});
+        }
+    };
+    auto isConstant = [](const CSlot &slot) { return slot.m_Kind != EKind::Other; };
+    auto isNumber = [&](const CSlot &slot, double value) {
+        return slot.m_Kind == EKind::Number && code[slot.m_Start].m_Number == value
+               && !std::signbit(code[slot.m_Start].m_Number);
+    };
+
+    for (const auto &instruction: m_Code) {
+        switch (instruction.m_Op) {
+            case EOpCode::Number:
+                slots.push_back({code.size(), EKind::Number, true, false, false});
+                code.push_back(instruction);
+                break;
+            case EOpCode::String:
+                slots.push_back({code.size(), EKind::String, false, false, false});
+                code.push_back(instruction);
+                break;
+            case EOpCode::Reference:
+            case EOpCode::Range:
+                slots.push_back({code.size(), EKind::Other, false, instruction.m_Op == EOpCode::Range, false});
+                code.push_back(instruction);
+                break;
+            case EOpCode::Neg: {
+                CSlot operand = slots.back();
+                slots.pop_back();
+                if (operand.m_Range) {
+                    code.push_back(instruction);
+                    slots.push_back({operand.m_Start, EKind::Other, true, false, false});
+                } else if (isConstant(operand)) {
+                    CCompactValue value = valueOf(operand);
+                    pushConstant(operand.m_Start, value.isNumber() ? CCompactValue(-value.number()) : CCompactValue());
+                } else if (operand.m_NegatesNumeric) {
+                    // negating twice gives back the number
+                    code.pop_back();
+                    slots.push_back({operand.m_Start, EKind::Other, true, false, false});
+                } else {
+                    code.push_back(instruction);
+                    slots.push_back({operand.m_Start, EKind::Other, true, false, operand.m_Numeric});
+                }
+                break;
+            }
+            case EOpCode::FuncCall: {
+                const CCallSite &call = m_Calls[instruction.m_Arg];
+                std::string_view name = CFunctionRegistry::get(static_cast<int>(call.m_Function)).m_Name;
+                size_t first = slots.size() - call.m_ParamCount;
+                if (name == "if" && isConstant(slots[first])) {
+                    CCompactValue condition = valueOf(slots[first]);
+                    // branches reading cells are kept, their references are dependencies of the cell
+                    if (!condition.isNumber()) {
+                        if (isConstant(slots[first + 1]) && isConstant(slots[first + 2])) {
+                            pushConstant(slots[first].m_Start, CCompactValue());
+                            slots.erase(slots.end() - 4, slots.end() - 1);
+                            break;
+                        }
+                    } else {
+                        const CSlot &chosen = slots[first + (condition.number() != 0 ? 1 : 2)];
+                        const CSlot &other = slots[first + (condition.number() != 0 ? 2 : 1)];
+                        if (isConstant(other) && !chosen.m_Range) {
+                            size_t end = &chosen == &slots.back() ? code.size() : other.m_Start;
+                            CSlot result = chosen;
+                            result.m_Start = slots[first].m_Start;
+                            code.erase(code.begin() + static_cast<ptrdiff_t>(end), code.end());
+                            code.erase(code.begin() + static_cast<ptrdiff_t>(result.m_Start),
+                                       code.begin() + static_cast<ptrdiff_t>(chosen.m_Start));
+                            slots.resize(first);
+                            slots.push_back(result);
+                            break;
+                        }
+                    }
+                }
+                bool numeric = name != "if" || (slots[first + 1].numeric() && slots[first + 2].numeric());
+                size_t start = call.m_ParamCount ? slots[first].m_Start : code.size();
+                slots.resize(first);
+                code.push_back(instruction);
+                slots.push_back({start, EKind::Other, numeric, false, false});
+                break;
+            }
+            default: {
+                CSlot right = slots.back();
+                slots.pop_back();
+                CSlot left = slots.back();
+                slots.pop_back();
+                EOpCode op = instruction.m_Op;
+                if (left.m_Range || right.m_Range) {
+                    code.push_back(instruction);
+                    slots.push_back({left.m_Start, EKind::Other, true, false, false});
+                } else if (isConstant(left) && isConstant(right)) {
+                    CCompactValue value = valueOf(left);
+                    applyBinary(op, value, valueOf(right), strings);
+                    pushConstant(left.m_Start, value);
+                } else if (left.m_Numeric && ((op == EOpCode::Mul && isNumber(right, 1))
+                                              || (op == EOpCode::Div && isNumber(right, 1))
+                                              || (op == EOpCode::Pow && isNumber(right, 1))
+                                              || (op == EOpCode::Sub && isNumber(right, 0)))) {
+                    code.resize(right.m_Start);
+                    slots.push_back(left);
+                } else if (right.m_Numeric && op == EOpCode::Mul && isNumber(left, 1)) {
+                    code.erase(code.begin() + static_cast<ptrdiff_t>(left.m_Start),
+                               code.begin() + static_cast<ptrdiff_t>(right.m_Start));
+                    right.m_Start = left.m_Start;
+                    slots.push_back(right);
+                } else {
+                    code.push_back(instruction);
+                    bool numeric = op != EOpCode::Add || left.numeric() || right.numeric();
+                    slots.push_back({left.m_Start, EKind::Other, numeric, false, false});
+                }
+                break;
+            }
+        }
+    }
+
+    // the tables keep only the operands of the remaining instructions, in the order they are used
+    std::vector<std::string> usedStrings;
+    std::vector<CRange> usedRanges;
+    std::vector<CCallSite> usedCalls;
+    for (auto &instruction: code) {
+        switch (instruction.m_Op) {
+            case EOpCode::String:
+                usedStrings.push_back(m_Strings[instruction.m_Arg]);
+                instruction.m_Arg = static_cast<uint32_t>(usedStrings.size() - 1);
+                break;
+            case EOpCode::Range:
+                usedRanges.push_back(m_Ranges[instruction.m_Arg]);
+                instruction.m_Arg = static_cast<uint32_t>(usedRanges.size() - 1);
+                break;
+            case EOpCode::FuncCall:
+                usedCalls.push_back(m_Calls[instruction.m_Arg]);
+                instruction.m_Arg = static_cast<uint32_t>(usedCalls.size() - 1);
+                break;
+            default:
+                break;
+        }
+    }
+    m_Code = std::move(code);
+    m_Strings = std::move(usedStrings);
+    m_Ranges = std::move(usedRanges);
+    m_Calls = std::move(usedCalls);
+}
+
+CFormula::EStep CFormula::resume(CEvaluation &evaluation, const CPos &origin, CCompactValue *values, CState &state,
+                                 std::vector<const CCell *> &wait) const {
+    CCompactValue *top = values + state.m_Top;
+    for (; state.m_Pc < m_Code.size(); state.m_Pc++) {
+        const CInstruction &instruction = m_Code[state.m_Pc];
+        switch (instruction.m_Op) {
+            case EOpCode::Number:
+                *top++ = instruction.m_Number;
+                break;
+            case EOpCode::String:
+                *top++ = m_Handles[instruction.m_Arg];
+                break;
+            case EOpCode::Reference: {
+                CPos pos = instruction.getPos();
+                pos.relocate(origin.m_Row, origin.m_Column);
+                const double *number;
+                const CCell *cell = evaluation.lookup(pos, number);
+                if (number)
+                    *top++ = *number;
+                else if (evaluation.needsEvaluation(cell)) {
+                    wait.push_back(cell);
+                    state.m_Top = static_cast<uint32_t>(top - values);
+                    return EStep::Reference;
+                } else if (cell && cell->hasFormula())
+                    *top++ = cell->calculateCell(evaluation);
+                else
+                    *top++ = CCompactValue();
+                break;
+            }
+            case EOpCode::Range:
+                // a range has no value of its own, functions read its cells through the range table
+                *top++ = CCompactValue();
+                break;
+            case EOpCode::FuncCall: {
+                const CCallSite &call = m_Calls[instruction.m_Arg];
+                std::array<CRange, CFunction::MAX_PARAMS> resolved;
+                const CRange *ranges[CFunction::MAX_PARAMS];
+                for (uint32_t i = 0; i < call.m_ParamCount; i++) {
+                    ranges[i] = nullptr;
+                    if (call.m_Ranges[i] < 0) continue;
+                    resolved[i] = m_Ranges[call.m_Ranges[i]];
+                    resolved[i].relocate(origin.m_Row, origin.m_Column);
+                    ranges[i] = &resolved[i];
+                }
+                if (!state.m_RangesReady) {
+                    for (uint32_t i = 0; i < call.m_ParamCount; i++)
+                        if (ranges[i])
+                            evaluation.forEachInRange(*ranges[i], [](const double *, uint64_t) {},
+                                                      [&](const CPos &, const CCell &cell) {
+                                                          if (evaluation.needsEvaluation(&cell))
+                                                              wait.push_back(&cell);
+                                                      });
+                    if (!wait.empty()) {
+                        state.m_RangesReady = true;
+                        state.m_Top = static_cast<uint32_t>(top - values);
+                        return EStep::Ranges;
+                    }
+                }
+                state.m_RangesReady = false;
+                top -= call.m_ParamCount;
+                *top = CFunctionRegistry::get(static_cast<int>(call.m_Function)).m_Evaluate(top, ranges, evaluation);
+                top++;
+                break;
+            }
+            case EOpCode::Neg:
+                top[-1] = top[-1].isNumber() ? CCompactValue(-top[-1].number()) : CCompactValue();
+                break;
+            default:
+                --top;
+                applyBinary(instruction.m_Op, top[-1], *top, evaluation.strings());
+                break;
+        }
+    }
+    state.m_Top = static_cast<uint32_t>(top - values);
+    return EStep::Done;
+}
+
+void CFormula::relocate(int rowOffset, int columnOffset) {
+    for (auto &instruction: m_Code) {
+        if (instruction.m_Op != EOpCode::Reference) continue;
+        CPos pos = instruction.getPos();
+        pos.relocate(rowOffset, columnOffset);
+        instruction.setPos(pos);
+    }
+    for (auto &range: m_Ranges)
+        range.relocate(rowOffset, columnOffset);
+}
+
+void CFormula::getReferences(const CPos &origin, std::vector<CPos> &refs) const {
+    for (const auto &instruction: m_Code)
+        if (instruction.m_Op == EOpCode::Reference) {
+            refs.push_back(instruction.getPos());
+            refs.back().relocate(origin.m_Row, origin.m_Column);
+        }
+}
+
+void CFormula::getRanges(const CPos &origin, std::vector<CRange> &ranges) const {
+    for (const auto &range: m_Ranges) {
+        ranges.push_back(range);
+        ranges.back().relocate(origin.m_Row, origin.m_Column);
+    }
+}
+
+bool CFormula::empty() const {
+    return m_Code.empty();
+}
+
+bool CFormula::getNumber(double &value) const {
+    if (m_Code.size() != 1 || m_Code[0].m_Op != EOpCode::Number) return false;
+    value = m_Code[0].m_Number;
+    return true;
+}
+
+void CFormula::decompile(CArena &arena, const CPos &origin, std::vector<COperation *> &stack) const {
+    for (const auto &instruction: m_Code) {
+        switch (instruction.m_Op) {
+            case EOpCode::Number:
+                stack.push_back(arena.make<CNumber>(instruction.m_Number));
+                break;
+            case EOpCode::String:
+                stack.push_back(arena.make<CString>(m_Strings[instruction.m_Arg]));
+                break;
+            case EOpCode::Reference: {
+                CPos pos = instruction.getPos();
+                pos.relocate(origin.m_Row, origin.m_Column);
+                stack.push_back(arena.make<CReference>(pos));
+                break;
+            }
+            case EOpCode::Range: {
+                CRange range = m_Ranges[instruction.m_Arg];
+                range.relocate(origin.m_Row, origin.m_Column);
+                stack.push_back(arena.make<CValRange>(range));
+                break;
+            }
+            case EOpCode::FuncCall: {
+                const CCallSite &call = m_Calls[instruction.m_Arg];
+                stack.push_back(arena.make<CFuncCall>(static_cast<int>(call.m_Function),
+                                                      static_cast<int>(call.m_ParamCount)));
+                break;
+            }
+            default:
+                // operators have no operands, their opcodes are their type ids
+                stack.push_back(COperation::createOperationFromType(static_cast<int>(instruction.m_Op), arena));
+                break;
+        }
+    }
+}
+
+bool CFormula::saveBinary(CByteWriter &out, std::unordered_map<std::string, uint32_t> &strings) const {
+    out.putVarint(m_Code.size());
+    for (const auto &instruction: m_Code) {
+        out.putByte(static_cast<uint8_t>(instruction.m_Op));
+        switch (instruction.m_Op) {
+            case EOpCode::Number:
+                out.putDouble(instruction.m_Number);
+                break;
+            case EOpCode::String: {
+                auto [it, added] = strings.try_emplace(m_Strings[instruction.m_Arg],
+                                                       static_cast<uint32_t>(strings.size()));
+                out.putVarint(it->second);
+                break;
+            }
+            case EOpCode::Reference:
+                out.putPos(instruction.getPos());
+                break;
+            case EOpCode::Range:
+                out.putPos(m_Ranges[instruction.m_Arg].m_From);
+                out.putPos(m_Ranges[instruction.m_Arg].m_To);
+                break;
+            case EOpCode::FuncCall:
+                out.putVarint(m_Calls[instruction.m_Arg].m_Function);
+                out.putVarint(m_Calls[instruction.m_Arg].m_ParamCount);
+                break;
+            default:
+                break;
+        }
+    }
+    return true;
+}
+
+bool CFormula::loadBinary(CByteReader &in, std::span<const std::string_view> strings) {
+    uint64_t size;
+    // every instruction takes at least a byte
+    if (!in.getVarint(size) || size > in.remaining()) return false;
+    for (uint64_t i = 0; i < size; i++) {
+        uint8_t op;
+        if (!in.getByte(op) || op < static_cast<uint8_t>(EOpCode::Add) || op > static_cast<uint8_t>(EOpCode::FuncCall))
+            return false;
+        switch (static_cast<EOpCode>(op)) {
+            case EOpCode::Number: {
+                double value;
+                if (!in.getDouble(value)) return false;
+                emitNumber(value);
+                break;
+            }
+            case EOpCode::String: {
+                uint64_t id;
+                if (!in.getVarint(id) || id >= strings.size()) return false;
+                emitString(std::string(strings[id]));
+                break;
+            }
+            case EOpCode::Reference: {
+                CPos pos;
+                if (!in.getPos(pos)) return false;
+                emitReference(pos);
+                break;
+            }
+            case EOpCode::Range: {
+                CRange range;
+                if (!in.getPos(range.m_From) || !in.getPos(range.m_To)) return false;
+                emitRange(range);
+                break;
+            }
+            case EOpCode::FuncCall: {
+                uint64_t function, paramCount;
+                if (!in.getVarint(function) || !in.getVarint(paramCount)
+                    || function >= static_cast<uint64_t>(CFunctionRegistry::size()) || paramCount > CFunction::MAX_PARAMS)
+                    return false;
+                emitCall(static_cast<int>(function), static_cast<int>(paramCount));
+                break;
+            }
+            default:
+                emit(static_cast<EOpCode>(op));
+                break;
+        }
+    }
+    return true;
+}
+
+bool CFormula::skipBinary(CByteReader &in, size_t strings) {
+    uint64_t size;
+    if (!in.getVarint(size) || size > in.remaining()) return false;
+    for (uint64_t i = 0; i < size; i++) {
+        uint8_t op;
+        if (!in.getByte(op) || op < static_cast<uint8_t>(EOpCode::Add) || op > static_cast<uint8_t>(EOpCode::FuncCall))
+            return false;
+        std::string_view bytes;
+        uint64_t id, paramCount;
+        CPos pos;
+        switch (static_cast<EOpCode>(op)) {
+            case EOpCode::Number:
+                if (!in.getBytes(sizeof(double), bytes)) return false;
+                break;
+            case EOpCode::String:
+                if (!in.getVarint(id) || id >= strings) return false;
+                break;
+            case EOpCode::Reference:
+                if (!in.getPos(pos)) return false;
+                break;
+            case EOpCode::Range:
+                if (!in.getPos(pos) || !in.getPos(pos)) return false;
+                break;
+            case EOpCode::FuncCall:
+                if (!in.getVarint(id) || !in.getVarint(paramCount)
+                    || id >= static_cast<uint64_t>(CFunctionRegistry::size()) || paramCount > CFunction::MAX_PARAMS)
+                    return false;
+                break;
+            default:
+                break;
+        }
+    }
+    return true;
+}
+
+/**
+ * mix a value into a hash
+ * @param seed hash, updated
+ * @param value value to mix in
+ */
+static void hashCombine(size_t &seed, size_t value) {
+    seed ^= value + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2);
+}
+
+/**
+ * hash a position including its absolute flags
+ * @param pos position
+ * @return hash
+ */
+static size_t hashPos(const CPos &pos) {
+    return (static_cast<size_t>(static_cast<uint32_t>(pos.m_Row)) << 32 | static_cast<uint32_t>(pos.m_Column))
+           ^ (static_cast<size_t>(pos.m_AbsRow) << 30) ^ (static_cast<size_t>(pos.m_AbsColumn) << 31);
+}
+
+/**
+ * compare positions including their absolute flags
+ * @param a position
+ * @param b position
+ * @return true if they are the same
+ */
+static bool samePos(const CPos &a, const CPos &b) {
+    return (a <=> b) == 0 && a.m_AbsRow == b.m_AbsRow && a.m_AbsColumn == b.m_AbsColumn;
+}
+
+size_t CFormula::hash() const {
+    size_t seed = m_Code.size();
+    // the union is zeroed by the emit methods for instructions without an operand
+    for (const auto &instruction: m_Code) {
+        hashCombine(seed, static_cast<size_t>(instruction.m_Op) | instruction.m_Flags << 8
+                          | static_cast<size_t>(instruction.m_Arg) << 16);
+        hashCombine(seed, instruction.m_Pos);
+    }
+    for (const auto &string: m_Strings)
+        hashCombine(seed, std::hash<std::string>()(string));
+    for (const auto &range: m_Ranges) {
+        hashCombine(seed, hashPos(range.m_From));
+        hashCombine(seed, hashPos(range.m_To));
+    }
+    for (const auto &call: m_Calls)
+        hashCombine(seed, call.m_Function);
+    return seed;
+}
+
+bool CFormula::operator==(const CFormula &other) const {
+    auto sameInstruction = [](const CInstruction &a, const CInstruction &b) {
+        return a.m_Op == b.m_Op && a.m_Flags == b.m_Flags && a.m_Arg == b.m_Arg && a.m_Pos == b.m_Pos;
+    };
+    auto sameRange = [](const CRange &a, const CRange &b) {
+        return samePos(a.m_From, b.m_From) && samePos(a.m_To, b.m_To);
+    };
+    auto sameCall = [](const CCallSite &a, const CCallSite &b) {
+        return a.m_Function == b.m_Function && a.m_ParamCount == b.m_ParamCount;
+    };
+    return std::equal(m_Code.begin(), m_Code.end(), other.m_Code.begin(), other.m_Code.end(), sameInstruction)
+           && m_Strings == other.m_Strings
+           && std::equal(m_Ranges.begin(), m_Ranges.end(), other.m_Ranges.begin(), other.m_Ranges.end(), sameRange)
+           && std::equal(m_Calls.begin(), m_Calls.end(), other.m_Calls.begin(), other.m_Calls.end(), sameCall);
+}
+
+// *—————————————————————————————————————————————————CFormulaPool.cpp————————————————————————————————————————————* //
+
+std::shared_ptr<const CFormula> CFormulaPool::intern(CFormula &&formula) {
+    size_t hash = formula.hash();
+    std::lock_guard lock(m_Mutex);
+    auto [first, last] = m_Templates.equal_range(hash);
+    for (auto it = first; it != last; ++it)
+        if (auto shared = it->second.lock(); shared && *shared == formula)
+            return shared;
+    auto shared = std::make_shared<const CFormula>(std::move(formula));
+    m_Templates.emplace(hash, shared);
+    if (m_Templates.size() >= 2 * m_Swept + 64)
+        sweep();
+    return shared;
+}
+
+size_t CFormulaPool::size() const {
+    std::lock_guard lock(m_Mutex);
+    return std::count_if(m_Templates.begin(), m_Templates.end(), [](const auto &entry) {
+        return !entry.second.expired();
+    });
+}
+
+void CFormulaPool::sweep() {
+    std::erase_if(m_Templates, [](const auto &entry) {
+        return entry.second.expired();
+    });
+    m_Swept = m_Templates.size();
+}
+
+// *—————————————————————————————————————————————————CParseCache.h————————————————————————————————————————————* //
+
+/**
+ * cache of compiled formulas keyed by their text with references rewritten relative to the cell, formulas of the
+ * same shape in different cells share the key and, being templates with relative references, the compiled formula
+ * entries do not keep the templates alive
+ */
+class CParseCache {
+public:
+    /**
+     * hit and miss counts of the lookups
+     */
+    struct CStats {
+        size_t m_Hits = 0;
+        size_t m_Misses = 0;
+    };
+
+    CParseCache() = default;
+
+    /**
+     * copies keep the statistics but start without formulas, so that copying a sheet stays cheap
+     * @param other cache to copy
+     */
+    CParseCache(const CParseCache &other);
+
+    CParseCache &operator=(const CParseCache &other);
+
+    /**
+     * rewrite the references of formula text as offsets from the cell, absolute parts stay as they are
+     * string literals and function names are kept, anything that is not surely a reference makes the text uncacheable
+     * @param formula formula text
+     * @param pos position of the cell
+     * @param key receives the normalised text
+     * @return false if the text cannot be normalised safely
+     */
+    static bool normalize(std::string_view formula, const CPos &pos, std::string &key);
+
+    /**
+     * look up a normalised formula and count the lookup
+     * @param key normalised text
+     * @return template, nullptr on a miss
+     */
+    std::shared_ptr<const CFormula> find(const std::string &key);
+
+    /**
+     * remember the template compiled from a normalised formula
+     * @param key normalised text
+     * @param formula template
+     */
+    void insert(std::string &&key, const std::shared_ptr<const CFormula> &formula);
+
+    /**
+     * forget all formulas, the statistics are kept
+     */
+    void clear();
+
+    CStats stats() const;
+
+private:
+    /**
+     * drop the entries whose templates no cell holds anymore, or all of them once there are too many
+     */
+    void sweep();
+
+    static constexpr size_t MAX_ENTRIES = 1 << 16;
+
+    std::unordered_map<std::string, std::weak_ptr<const CFormula>> m_Entries;
+
+    /**
+     * number of entries after the last sweep, the next one runs when it doubles
+     */
+    size_t m_Swept = 0;
+
+    CStats m_Stats;
+};
+
+// *—————————————————————————————————————————————————CParseCache.cpp————————————————————————————————————————————* //
+
+bool CParseCache::normalize(std::string_view formula, const CPos &pos, std::string &key) {
+    // longer column names or row numbers could overflow an int
+    constexpr size_t MAX_LETTERS = 6, MAX_DIGITS = 9;
+    auto isAlpha = [](char c) { return std::isalpha(static_cast<unsigned char>(c)) != 0; };
+    auto isDigit = [](char c) { return std::isdigit(static_cast<unsigned char>(c)) != 0; };
+    auto isWord = [&](char c) { return isAlpha(c) || isDigit(c) || c == '_' || c == '$' || c == '.'; };
+    auto append = [&](int value) {
+        std::array<char, 16> buffer;
+        auto end = std::to_chars(buffer.data(), buffer.data() + buffer.size(), value).ptr;
+        key.append(buffer.data(), end);
+    };
+
+    key.clear();
+    size_t i = 0, size = formula.size();
+    while (i < size) {
+        char c = formula[i];
+        if (c == '"') {
+            // string literals are copied with their doubled quotes
+            size_t end = i + 1;
+            while (end < size && (formula[end] != '"' || (end + 1 < size && formula[end + 1] == '"')))
+                end += formula[end] == '"' ? 2 : 1;
+            if (end >= size) return false;
+            key.append(formula.substr(i, end + 1 - i));
+            i = end + 1;
+        } else if (isDigit(c) || c == '.') {
+            // numbers are copied with their exponents
+            size_t end = i;
+            while (end < size && (isDigit(formula[end]) || formula[end] == '.'))
+                end++;
+            if (end < size && (formula[end] == 'e' || formula[end] == 'E')) {
+                end++;
+                if (end < size && (formula[end] == '+' || formula[end] == '-'))
+                    end++;
+                while (end < size && isDigit(formula[end]))
+                    end++;
+            }
+            if (end < size && isWord(formula[end])) return false;
+            key.append(formula.substr(i, end - i));
+            i = end;
+        } else if (isAlpha(c) || c == '$') {
+            size_t start = i;
+            bool absColumn = formula[i] == '$';
+            i += absColumn;
+            size_t letters = i;
+            while (i < size && isAlpha(formula[i]))
+                i++;
+            size_t lettersEnd = i;
+            bool absRow = i < size && formula[i] == '$';
+            i += absRow;
+            size_t digits = i;
+            while (i < size && isDigit(formula[i]))
+                i++;
+            if (i < size && isWord(formula[i])) return false;
+            if (!absColumn && !absRow && digits == i && lettersEnd > letters) {
+                // a function name, it has to be followed by its parameters
+                size_t next = i;
+                while (next < size && std::isspace(static_cast<unsigned char>(formula[next])))
+                    next++;
+                if (next == size || formula[next] != '(') return false;
+                key.append(formula.substr(start, i - start));
+                continue;
+            }
+            if (lettersEnd == letters || lettersEnd - letters > MAX_LETTERS || digits == i || i - digits > MAX_DIGITS)
+                return false;
+            // the key has to stand for text the parser accepts as a reference
+            if (std::any_of(formula.begin() + letters, formula.begin() + lettersEnd, [](char l) { return l < 'A' || l > 'Z'; }))
+                return false;
+            size_t next = i;
+            while (next < size && std::isspace(static_cast<unsigned char>(formula[next])))
+                next++;
+            if (next < size && formula[next] == '(') return false;
+            int column = CPos::convertColumn(formula.substr(letters, lettersEnd - letters));
+            int row = 0;
+            std::from_chars(formula.data() + digits, formula.data() + i, row);
+            key.push_back('\x01');
+            if (absColumn)
+                key.push_back('$');
+            append(absColumn ? column : column - pos.m_Column);
+            key.push_back(',');
+            if (absRow)
+                key.push_back('$');
+            append(absRow ? row : row - pos.m_Row);
+            key.push_back('\x01');
+        } else {
+            key.push_back(c);
+            i++;
+        }
+    }
+    return true;
+}
+
+CParseCache::CParseCache(const CParseCache &other) : m_Stats(other.m_Stats) {}
+
+CParseCache &CParseCache::operator=(const CParseCache &other) {
+    m_Entries.clear();
+    m_Swept = 0;
+    m_Stats = other.m_Stats;
+    return *this;
+}
+
+std::shared_ptr<const CFormula> CParseCache::find(const std::string &key) {
+    auto it = m_Entries.find(key);
+    if (it != m_Entries.end())
+        if (auto formula = it->second.lock()) {
+            m_Stats.m_Hits++;
+            return formula;
+        }
+    m_Stats.m_Misses++;
+    return nullptr;
+}
+
+void CParseCache::insert(std::string &&key, const std::shared_ptr<const CFormula> &formula) {
+    m_Entries.insert_or_assign(std::move(key), formula);
+    if (m_Entries.size() >= 2 * m_Swept + 64)
+        sweep();
+}
+
+void CParseCache::clear() {
+    m_Entries.clear();
+    m_Swept = 0;
+}
+
+CParseCache::CStats CParseCache::stats() const {
+    return m_Stats;
+}
+
+void CParseCache::sweep() {
+    std::erase_if(m_Entries, [](const auto &entry) {
+        return entry.second.expired();
+    });
+    if (m_Entries.size() > MAX_ENTRIES)
+        m_Entries.clear();
+    m_Swept = m_Entries.size();
+}
+
+// *—————————————————————————————————————————————————CMyExpressionBuilder.h——————————————————————————————————————————————————————* //
+
+class CMyExpressionBuilder : public CExprBuilder {
+public:
+    /**
+     * Constructor.
+     * @param arena - arena to allocate the operations from, they stay valid until its reset
+     */
+    CMyExpressionBuilder(CArena &arena);
+
+    /**
+     * Add operation to the stack.
+     */
+    void opAdd() override;
+
+    /**
+     * Subtract operation from the stack.
+     */
+    void opSub() override;
+
+    /**
+     * Multiply operation from the stack.
+     */
+    void opMul() override;
+
+    /**
+     * Divide operation from the stack.
+     */
+    void opDiv() override;
+
+    /**
+     * Power operation from the stack.
+     */
+    void opPow() override;
+
+    /**
+     * Negation operation from the stack.
+     */
+    void opNeg() override;
+
+    /**
+     * Equal operation from the stack.
+     */
+    void opEq() override;
+
+    /**
+     * Not equal operation from the stack.
+     */
+    void opNe() override;
+
+    /**
+     * Less than operation from the stack.
+     */
+    void opLt() override;
+
+    /**
+     * Less equal operation from the stack.
+     */
+    void opLe() override;
+
+    /**
+     * Greater than operation from the stack.
+     */
+    void opGt() override;
+
+    /**
+     * Greater equal operation from the stack.
+     */
+    void opGe() override;
+
+    /**
+     * Add number to the stack.
+     * @param val - number
+     */
+    void valNumber(double val) override;
+
+    /**
+     * Add string to the stack.
+     * @param val - string
+     */
+    void valString(std::string val) override;
+
+    /**
+     * Add reference on cell to the stack.
+     * @param val - reference on cell
+     */
+    void valReference(std::string val) override;
+
+    /**
+     * Add range of cells to the stack.
+     * @param val - range of cells
+     */
+    void valRange(std::string val) override;
+
+    /**
+     * Add function call to the stack.
+     * @param fnName - function name
+     * @param paramCount - count of parameters
+     */
+    void funcCall(std::string fnName, int paramCount) override; // function call
+
+    /**
+     * Get the stack of operations.
+     * @return - stack of operations
+     */
+    const std::vector<COperation *> &getStack() const;
+
+private:
+    CArena &m_Arena;
+
+    /**
+     * Stack of operations.
+     */
+    std::vector<COperation *> m_Stack;
+};
+
+
+// *—————————————————————————————————————————————————CMyExpressionBuilder.cpp——————————————————————————————————————————————————————* //
+
+CMyExpressionBuilder::CMyExpressionBuilder(CArena &arena) : m_Arena(arena) {}
+
+void CMyExpressionBuilder::opAdd() {
+    m_Stack.push_back(m_Arena.make<CAddition>());
+}
+
+void CMyExpressionBuilder::opSub() {
+    m_Stack.push_back(m_Arena.make<CSubtraction>());
+}
+
+void CMyExpressionBuilder::opMul() {
+    m_Stack.push_back(m_Arena.make<CMultiplication>());
+}
+
+void CMyExpressionBuilder::opDiv() {
+    m_Stack.push_back(m_Arena.make<CDivision>());
+}
+
+void CMyExpressionBuilder::opPow() {
+    m_Stack.push_back(m_Arena.make<CPower>());
+}
+
+void CMyExpressionBuilder::opNeg() {
+    m_Stack.push_back(m_Arena.make<CNegation>());
+}
+
+void CMyExpressionBuilder::opEq() {
+    m_Stack.push_back(m_Arena.make<CEqual>());
+}
+
+void CMyExpressionBuilder::opNe() {
+    m_Stack.push_back(m_Arena.make<CNotEqual>());
+}
+
+void CMyExpressionBuilder::opLt() {
+    m_Stack.push_back(m_Arena.make<CLessThan>());
+}
+
+void CMyExpressionBuilder::opLe() {
+    m_Stack.push_back(m_Arena.make<CLessEqual>());
+}
+
+void CMyExpressionBuilder::opGt() {
+    m_Stack.push_back(m_Arena.make<CGreaterThan>());
+}
+
+void CMyExpressionBuilder::opGe() {
+    m_Stack.push_back(m_Arena.make<CGreaterEqual>());
+}
+
+void CMyExpressionBuilder::valNumber(double val) {
+    m_Stack.push_back(m_Arena.make<CNumber>(val));
+}
+
+void CMyExpressionBuilder::valString(std::string val) {
+    m_Stack.push_back(m_Arena.make<CString>(val));
+}
+
+void CMyExpressionBuilder::valReference(std::string val) {
+    m_Stack.push_back(m_Arena.make<CReference>(val));
+}
+
+void CMyExpressionBuilder::valRange(std::string val) {
+    m_Stack.push_back(m_Arena.make<CValRange>(val));
+}
+
+void CMyExpressionBuilder::funcCall(std::string fnName, int paramCount) {
+    int function = CFunctionRegistry::find(fnName);
+    if (function < 0)
+        throw std::invalid_argument("Unknown function " + fnName);
+    m_Stack.push_back(m_Arena.make<CFuncCall>(function, paramCount));
+}
+
+const std::vector<COperation *> &CMyExpressionBuilder::getStack() const {
+    return m_Stack;
+}
+
+// *—————————————————————————————————————————————————CTaskPool.h——————————————————————————————————————————————————————* //
+
+/**
+ * Runs tasks identified by integers on a pool of threads started once and kept for the whole program.
+ * Every thread of a run owns a deque of ready tasks, takes work from its back and steals from the front of the other
+ * deques when its own one runs dry. Tasks may make further tasks ready while they run. Threads without a task wait on
+ * a condition variable, between runs as well as within a run.
+ * One run uses the pool at a time, a run started while the pool is busy, also from a task, runs on the calling
+ * thread alone.
+ */
+class CTaskPool {
+public:
+    /**
+     * Run the tasks and the tasks they make ready until none are left.
+     * @param threads - number of threads, the calling thread is one of them
+     * @param ready - tasks ready at the start
+     * @param fn - function called with a task and a function that makes another task ready
+     */
+    template<typename F>
+    static void run(unsigned threads, const std::vector<int> &ready, F &&fn);
+
+    ~CTaskPool();
+
+private:
+    /**
+     * Call the function of a run with a task.
+     * @param function - function of the run
+     * @param task - task
+     * @param made - receives the tasks made ready by the task
+     */
+    using CCall = void (*)(void *function, int task, std::vector<int> &made);
+
+    struct CQueue {
+        std::mutex m_Mutex;
+        std::deque<int> m_Tasks;
+    };
+
+    /**
+     * Get the pool shared by all runs, its threads are started by the first runs that need them.
+     * @return - the pool
+     */
+    static CTaskPool &instance();
+
+    /**
+     * Run the tasks on the pool or on the calling thread if the pool is busy.
+     * @param threads - number of threads, the calling thread is one of them
+     * @param ready - tasks ready at the start
+     * @param call - calls the function of the run
+     * @param function - function of the run
+     */
+    void execute(unsigned threads, const std::vector<int> &ready, CCall call, void *function);
+
+    /**
+     * Wait for runs and take part in them, the loop of every thread of the pool.
+     * @param self - index of the queue of the thread
+     */
+    void loop(size_t self);
+
+    /**
+     * Run tasks of the current run until none are left.
+     * @param self - index of the own queue
+     */
+    void work(size_t self);
+
+    /**
+     * Take a task from the own queue or steal one from another queue.
+     * @param self - index of the own queue
+     * @param task - set to the taken task
+     * @return - false if all queues are empty
+     */
+    bool take(size_t self, int &task);
+
+    std::vector<std::thread> m_Workers;
+
+    /**
+     * Queues of the threads, the calling thread of a run has the first one. A deque keeps the queues in place as it
+     * grows.
+     */
+    std::deque<CQueue> m_Queues;
+
+    /**
+     * Set while a run uses the pool.
+     */
+    std::atomic<bool> m_Busy = false;
+
+    /**
+     * Guards the fields below that are not atomic, the condition variables wait on it.
+     */
+    std::mutex m_Mutex;
+
+    /**
+     * Wakes the pool threads for a run and to stop.
+     */
+    std::condition_variable m_Wake;
+
+    /**
+     * Wakes the threads of a run waiting for a task or for the end of the run.
+     */
+    std::condition_variable m_Ready;
+
+    /**
+     * Wakes the calling thread once the pool threads have left the run.
+     */
+    std::condition_variable m_Done;
+
+    bool m_Stop = false;
+
+    /**
+     * Number of the current or the last run.
+     */
+    uint64_t m_Run = 0;
+
+    /**
+     * Threads of the current run, zero between runs.
+     */
+    size_t m_Threads = 0;
+
+    /**
+     * Pool threads inside the current run.
+     */
+    size_t m_Active = 0;
+
+    CCall m_Call = nullptr;
+    void *m_Function = nullptr;
+
+    /**
+     * Tasks queued or running, no task can become ready once it drops to zero.
+     */
+    std::atomic<size_t> m_Pending = 0;
+
+    /**
+     * Tasks in the queues, changed under the mutex of the queue.
+     */
+    std::atomic<size_t> m_Queued = 0;
+
+    /**
+     * Threads of the run waiting for a task, a thread queuing tasks wakes them only if there are any.
+     */
+    std::atomic<size_t> m_Sleeping = 0;
+};
+
+template<typename F>
+void CTaskPool::run(unsigned threads, const std::vector<int> &ready, F &&fn) {
+    using CFunction = std::remove_reference_t<F>;
+    CCall call = [](void *function, int task, std::vector<int> &made) {
+        (*static_cast<CFunction *>(function))(task, [&](int next) { made.push_back(next); });
+    };
+    instance().execute(threads, ready, call, const_cast<void *>(static_cast<const void *>(std::addressof(fn))));
+}
+
+// *—————————————————————————————————————————————————CTaskPool.cpp——————————————————————————————————————————————————————* //
+
+CTaskPool::~CTaskPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Stop = true;
+    }
+    m_Wake.notify_all();
+    for (auto &worker: m_Workers)
+        worker.join();
+}
+
+CTaskPool &CTaskPool::instance() {
+    static CTaskPool pool;
+    return pool;
+}
+
+void CTaskPool::execute(unsigned threads, const std::vector<int> &ready, CCall call, void *function) {
+    if (ready.empty()) return;
+    if (threads <= 1 || m_Busy.exchange(true, std::memory_order_acquire)) {
+        // the tasks made ready are taken first, like from the own queue of a thread of the pool
+        std::vector<int> tasks(ready);
+        while (!tasks.empty()) {
+            int task = tasks.back();
+            tasks.pop_back();
+            call(function, task, tasks);
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        while (m_Workers.size() + 1 < threads)
+            m_Workers.emplace_back(&CTaskPool::loop, this, m_Workers.size() + 1);
+        while (m_Queues.size() < threads)
+            m_Queues.emplace_back();
+        for (size_t i = 0; i < ready.size(); i++)
+            m_Queues[i % threads].m_Tasks.push_back(ready[i]);
+        m_Queued.store(ready.size());
+        m_Pending.store(ready.size());
+        m_Call = call;
+        m_Function = function;
+        m_Threads = threads;
+        m_Run++;
+    }
+    m_Wake.notify_all();
+    work(0);
+
+    // the pool threads use the function of the run until they leave it, a thread that wakes later stays out
+    {
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        m_Done.wait(lock, [&] { return !m_Active; });
+        m_Threads = 0;
+    }
+    m_Busy.store(false, std::memory_order_release);
+}
+
+void CTaskPool::loop(size_t self) {
+    uint64_t joined = 0;
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    while (true) {
+        m_Wake.wait(lock, [&] { return m_Stop || m_Run != joined; });
+        if (m_Stop) return;
+        joined = m_Run;
+        if (self >= m_Threads) continue;
+        m_Active++;
+        lock.unlock();
+        work(self);
+        lock.lock();
+        if (!--m_Active)
+            m_Done.notify_one();
+    }
+}
+
+void CTaskPool::work(size_t self) {
+    std::vector<int> made;
+    int task;
+    while (m_Pending.load(std::memory_order_acquire)) {
+        if (!take(self, task)) {
+            // a thread queuing a task sees the sleeping thread or the thread sees the queued task
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            m_Sleeping++;
+            m_Ready.wait(lock, [&] { return m_Queued.load() || !m_Pending.load(); });
+            m_Sleeping--;
+            continue;
+        }
+        m_Call(m_Function, task, made);
+        if (!made.empty()) {
+            m_Pending.fetch_add(made.size(), std::memory_order_relaxed);
+            {
+                std::lock_guard<std::mutex> lock(m_Queues[self].m_Mutex);
+                m_Queues[self].m_Tasks.insert(m_Queues[self].m_Tasks.end(), made.begin(), made.end());
+                m_Queued += made.size();
+            }
+            if (m_Sleeping.load()) {
+                std::lock_guard<std::mutex> lock(m_Mutex);
+                m_Ready.notify_all();
+            }
+            made.clear();
+        }
+        if (m_Pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_Ready.notify_all();
+        }
+    }
+}
+
+bool CTaskPool::take(size_t self, int &task) {
+    for (size_t i = 0; i < m_Threads; i++) {
+        CQueue &queue = m_Queues[(self + i) % m_Threads];
+        std::lock_guard<std::mutex> lock(queue.m_Mutex);
+        if (queue.m_Tasks.empty()) continue;
+        // the own queue is used as a stack, the other ones are stolen from the oldest task
+        if (!i) {
+            task = queue.m_Tasks.back();
+            queue.m_Tasks.pop_back();
+        } else {
+            task = queue.m_Tasks.front();
+            queue.m_Tasks.pop_front();
+        }
+        m_Queued--;
+        return true;
+    }
+    return false;
+}
+
+// *—————————————————————————————————————————————————CSheetFile.h——————————————————————————————————————————————————————* //
+
+/**
+ * Saved file of a spreadsheet. Opening a file reads only the positions of its cells and the offsets of their records,
+ * cells and the formula templates they share are decoded on demand.
+ * The cells are split into chunks of whole bands of tile rows, every chunk with its own length and checksum, so that
+ * chunks are encoded and decoded in parallel and the cells decoded from different chunks never share a tile. The
+ * checksum of a chunk is checked on the first decode from it, opening reads only the header and the positions.
+ */
+class CSheetFile {
+public:
+    /**
+     * First bytes of a saved file. Files of version 1 start with the count of cells instead, its lowest byte would
+     * have to be 0x89 and the count above two billion to be mistaken for the magic.
+     */
+    static constexpr char FILE_MAGIC[4] = {'\x89', 'S', 'P', 'S'};
+
+    /**
+     * Version 2 stored the cells in one block with one checksum of the whole file, it is still read.
+     */
+    static constexpr uint64_t FORMAT_VERSION = 3;
+
+    /**
+     * Bands of tile rows are added to a chunk until it has at least this many cells.
+     */
+    static constexpr size_t CHUNK_CELLS = 1 << 16;
+
+    /**
+     * Kinds of cell records in a saved file.
+     */
+    enum class ERecord : uint8_t {
+        Formula, Number, Integer
+    };
+
+    /**
+     * Cell of the file that has not been decoded yet.
+     */
+    struct CEntry {
+        int m_Row;
+        int m_Column;
+        /**
+         * Offset of the record of the cell, DECODED once the cell is decoded or overwritten.
+         */
+        uint64_t m_Offset;
+    };
+
+    static constexpr uint64_t DECODED = UINT64_MAX;
+
+    /**
+     * Write the cells of a sheet in the current format.
+     * @param os - output stream
+     * @param sheet - cells
+     * @param threads - number of threads encoding the chunks, zero for the number of hardware threads
+     * @return - true if success, false otherwise
+     */
+    static bool write(std::ostream &os, const CGrid &sheet, unsigned threads = 0);
+
+    /**
+     * Index a file in memory, the data has to outlive the index.
+     * @param data - content of the file
+     * @param threads - number of threads indexing the chunks, zero for the number of hardware threads
+     * @return - true if the data is a valid file of version 2 or of the current format
+     */
+    bool open(std::string_view data, unsigned threads = 0);
+
+    /**
+     * Map a file to memory and index it, the mapping is released with the last copy of the index.
+     * The file must not be truncated or written over in place meanwhile, a file replaced by renaming another one over
+     * its path leaves the mapping reading the content it was opened with.
+     * @param path - path to the file
+     * @param threads - number of threads indexing the chunks, zero for the number of hardware threads
+     * @return - true if the file is a valid file of version 2 or of the current format
+     */
+    bool map(const std::string &path, unsigned threads = 0);
+
+    /**
+     * Find the entry of a cell that has not been decoded yet.
+     * @param pos - position of the cell
+     * @return - pointer to the entry or nullptr if the file has no such cell left
+     */
+    CEntry *find(const CPos &pos);
+
+    const CEntry *find(const CPos &pos) const;
+
+    /**
+     * Call a function for every entry inside a range that has not been decoded yet.
+     * @param range - range of cells
+     * @param fn - function called with the entry
+     */
+    template<typename F>
+    void forEachInRange(const CRange &range, F &&fn) const;
+
+    /**
+     * Call a function for every entry that has not been decoded yet, in row-major order.
+     * @param fn - function called with the entry
+     */
+    template<typename F>
+    void forEachPending(F &&fn) const;
+
+    /**
+     * Decode the cell of an entry into the sheet, the entry is marked decoded even if it fails.
+     * @param entry - entry of the cell
+     * @param sheet - sheet to store the cell to
+     * @param formulas - pool to share the decoded templates through
+     * @return - false if the chunk of the cell is damaged or its record or formula template is malformed
+     */
+    bool decode(CEntry &entry, CGrid &sheet, CFormulaPool &formulas);
+
+    /**
+     * Decode all cells not decoded yet, the templates and then the chunks in parallel. The cells of every chunk are
+     * decoded into a grid of their own, the grids are merged into the sheet.
+     * @param sheet - sheet to store the cells to, it holds none of the positions of the entries
+     * @param formulas - pool to share the decoded templates through
+     * @param threads - number of threads, zero for the number of hardware threads
+     * @return - false if a chunk is damaged or a formula template is malformed, their cells are left out
+     */
+    bool decodeAll(CGrid &sheet, CFormulaPool &formulas, unsigned threads = 0);
+
+    /**
+     * Mark the cell as decoded without decoding it, when it is overwritten.
+     * @param pos - position of the cell
+     */
+    void discard(const CPos &pos);
+
+    /**
+     * Get the number of cells not decoded yet.
+     * @return - number of entries
+     */
+    size_t pending() const;
+
+private:
+    /**
+     * Block of cell records.
+     */
+    struct CChunk {
+        /**
+         * Offset and size of the records in the data.
+         */
+        uint64_t m_Offset;
+        uint64_t m_Size;
+
+        /**
+         * Index of the first entry of the chunk and the count of its entries.
+         */
+        size_t m_First;
+        size_t m_Count;
+
+        /**
+         * Whether the checksum of the records has been checked and whether it matched.
+         */
+        bool m_Checked = false;
+        bool m_Valid = false;
+    };
+
+    static constexpr size_t CRC_SIZE = sizeof(uint32_t);
+
+    /**
+     * Get the number of threads to run tasks on.
+     * @param threads - requested number, zero for the number of hardware threads
+     * @param tasks - number of tasks
+     * @return - number of threads, at least one and at most one per task
+     */
+    static unsigned workers(unsigned threads, size_t tasks);
+
+    /**
+     * Check the records of a chunk and fill its entries.
+     * @param chunk - chunk
+     * @return - true if the records are well-formed and their positions grow
+     */
+    bool indexChunk(const CChunk &chunk);
+
+    /**
+     * Check the checksum of a chunk, only the first time.
+     * @param chunk - chunk
+     * @return - true if the checksum matches the records
+     */
+    bool checkChunk(CChunk &chunk);
+
+    /**
+     * Decode a formula template.
+     * @param id - id of the template
+     * @param strings - string pool of the sheet
+     * @param formula - decoded formula
+     * @return - true if the template is well-formed
+     */
+    bool decodeTemplate(uint64_t id, CStringPool &strings, CFormula &formula) const;
+
+    /**
+     * Decode the cell of an entry, the entry is left as it is.
+     * @param entry - entry of the cell
+     * @param sheet - sheet to store the cell to
+     * @param formulas - pool to share a template decoded on the way through, nullptr if the templates are decoded
+     * @param templates - receives the template decoded on the way, nullptr to drop it after use
+     * @return - false if the record or the formula template of the cell is malformed
+     */
+    bool decodeRecord(const CEntry &entry, CGrid &sheet, CFormulaPool *formulas,
+                      std::vector<std::shared_ptr<const CFormula>> *templates) const;
+
+    /**
+     * Mapping of the file, if the index owns the data.
+     */
+    std::shared_ptr<const char> m_Mapping;
+
+    /**
+     * Content of the file, offsets are relative to it.
+     */
+    std::string_view m_Data;
+
+    /**
+     * String table of the file, viewed in the data.
+     */
+    std::vector<std::string_view> m_Strings;
+
+    /**
+     * Offsets of the formula templates.
+     */
+    std::vector<uint64_t> m_TemplateOffsets;
+
+    /**
+     * Templates decoded so far, indexed the same as m_TemplateOffsets.
+     */
+    std::vector<std::shared_ptr<const CFormula>> m_Templates;
+
+    std::vector<CChunk> m_Chunks;
+
+    /**
+     * Cells sorted in row-major order, the entries of every chunk follow the ones of the previous chunk.
+     */
+    std::vector<CEntry> m_Entries;
+
+    size_t m_Pending = 0;
+};
+
+template<typename F>
+void CSheetFile::forEachInRange(const CRange &range, F &&fn) const {
+    auto first = [&](int row) {
+        return std::lower_bound(m_Entries.begin(), m_Entries.end(), std::pair(row, range.left()),
+                                [](const CEntry &entry, const std::pair<int, int> &pos) {
+                                    return std::pair(entry.m_Row, entry.m_Column) < pos;
+                                });
+    };
+    // rows without entries inside the range are skipped by a search for the next row
+    for (auto it = first(range.top()); it != m_Entries.end() && it->m_Row <= range.bottom();) {
+        if (it->m_Column > range.right()) {
+            if (it->m_Row == INT_MAX) break;
+            it = first(it->m_Row + 1);
+            continue;
+        }
+        if (it->m_Offset != DECODED)
+            fn(*it);
+        ++it;
+    }
+}
+
+template<typename F>
+void CSheetFile::forEachPending(F &&fn) const {
+    for (const auto &entry: m_Entries)
+        if (entry.m_Offset != DECODED)
+            fn(entry);
+}
+
+// *—————————————————————————————————————————————————CSheetFile.cpp——————————————————————————————————————————————————————* //
+
+unsigned CSheetFile::workers(unsigned threads, size_t tasks) {
+    if (!threads)
+        threads = std::thread::hardware_concurrency();
+    return static_cast<unsigned>(std::max<size_t>(1, std::min<size_t>(threads, tasks)));
+}
+
+bool CSheetFile::write(std::ostream &os, const CGrid &sheet, unsigned threads) {
+    // a record for every cell, formulas refer to the dictionary of templates
+    struct CRecord {
+        CPos m_Pos;
+        const CFormula *m_Formula;
+        double m_Number;
+    };
+
+    // records are gathered by bands of tile rows, a chunk takes whole bands
+    std::unordered_map<int, std::vector<CRecord>> bands;
+    sheet.forEach([&](const CPos &pos, const CCell &cell) {
+        if (cell.m_Formula)
+            bands[pos.m_Row >> CGrid::TILE_BITS].push_back({pos, cell.m_Formula.get(), 0});
+    });
+    sheet.forEachNumber([&](const CPos &pos, double number) {
+        bands[pos.m_Row >> CGrid::TILE_BITS].push_back({pos, nullptr, number});
+    });
+    std::vector<int> bandKeys;
+    for (const auto &[band, records]: bands)
+        bandKeys.push_back(band);
+    std::sort(bandKeys.begin(), bandKeys.end());
+
+    struct CChunkData {
+        std::vector<CRecord> m_Records;
+        /**
+         * Templates in the order of their first use.
+         */
+        std::vector<const CFormula *> m_Templates;
+        size_t m_Count = 0;
+        /**
+         * Encoded records followed by their checksum.
+         */
+        CByteWriter m_Bytes;
+    };
+    std::vector<CChunkData> chunks;
+    for (int band: bandKeys) {
+        if (chunks.empty() || chunks.back().m_Records.size() >= CHUNK_CELLS)
+            chunks.emplace_back();
+        auto &records = bands[band];
+        chunks.back().m_Records.insert(chunks.back().m_Records.end(), records.begin(), records.end());
+        std::vector<CRecord>().swap(records);
+    }
+
+    std::vector<int> tasks(chunks.size());
+    for (size_t i = 0; i < tasks.size(); i++)
+        tasks[i] = static_cast<int>(i);
+    CTaskPool::run(workers(threads, chunks.size()), tasks, [&](int id, auto &&) {
+        CChunkData &chunk = chunks[id];
+        std::sort(chunk.m_Records.begin(), chunk.m_Records.end(), [](const CRecord &a, const CRecord &b) {
+            return (a.m_Pos <=> b.m_Pos) < 0;
+        });
+        std::unordered_set<const CFormula *> seen;
+        for (const auto &record: chunk.m_Records)
+            if (record.m_Formula && seen.insert(record.m_Formula).second)
+                chunk.m_Templates.push_back(record.m_Formula);
+    });
+
+    // templates are numbered by their first use in row-major order, the same whatever the number of threads
+    std::unordered_map<const CFormula *, uint32_t> formulaIds;
+    std::unordered_map<std::string, uint32_t> stringIds;
+    CByteWriter formulas;
+    for (const auto &chunk: chunks)
+        for (const CFormula *formula: chunk.m_Templates)
+            if (formulaIds.try_emplace(formula, static_cast<uint32_t>(formulaIds.size())).second
+                && !formula->saveBinary(formulas, stringIds))
+                return false;
+
+    CTaskPool::run(workers(threads, chunks.size()), tasks, [&](int id, auto &&) {
+        CChunkData &chunk = chunks[id];
+        CByteWriter &cells = chunk.m_Bytes;
+        int64_t row = 0, column = 0;
+        for (size_t i = 0; i < chunk.m_Records.size(); i++) {
+            const CRecord &record = chunk.m_Records[i];
+            // rows only grow, within a row the column is coded as the gap after the previous cell
+            int64_t rowDelta = int64_t(record.m_Pos.m_Row) - row;
+            cells.putZigzag(rowDelta);
+            if (i && !rowDelta)
+                cells.putVarint(static_cast<uint64_t>(record.m_Pos.m_Column - column - 1));
+            else
+                cells.putZigzag(record.m_Pos.m_Column);
+            row = record.m_Pos.m_Row;
+            column = record.m_Pos.m_Column;
+
+            double number = record.m_Number;
+            if (record.m_Formula) {
+                cells.putByte(static_cast<uint8_t>(ERecord::Formula));
+                cells.putVarint(formulaIds.at(record.m_Formula));
+            } else if (std::trunc(number) == number && std::fabs(number) < 0x1p53
+                       && !(number == 0 && std::signbit(number))) {
+                // integral numbers are mostly small, negative zero has to stay a double
+                cells.putByte(static_cast<uint8_t>(ERecord::Integer));
+                cells.putZigzag(static_cast<int64_t>(number));
+            } else {
+                cells.putByte(static_cast<uint8_t>(ERecord::Number));
+                cells.putDouble(number);
+            }
+        }
+        cells.putFixed32(CCrc32::compute(cells.data()));
+        chunk.m_Count = chunk.m_Records.size();
+        std::vector<CRecord>().swap(chunk.m_Records);
+    });
+
+    std::vector<const std::string *> table(stringIds.size());
+    for (const auto &[string, id]: stringIds)
+        table[id] = &string;
+
+    // the header ends with the sizes of the chunks and its own checksum, the chunks follow
+    CByteWriter header;
+    header.putBytes(std::string_view(FILE_MAGIC, sizeof(FILE_MAGIC)));
+    header.putVarint(FORMAT_VERSION);
+    header.putVarint(table.size());
+    for (const auto *string: table)
+        header.putString(*string);
+    header.putVarint(formulaIds.size());
+    header.putBytes(formulas.data());
+    header.putVarint(chunks.size());
+    for (const auto &chunk: chunks) {
+        header.putVarint(chunk.m_Bytes.data().size() - sizeof(uint32_t));
+        header.putVarint(chunk.m_Count);
+    }
+    header.putFixed32(CCrc32::compute(header.data()));
+    os.write(header.data().data(), static_cast<std::streamsize>(header.data().size()));
+    for (const auto &chunk: chunks)
+        os.write(chunk.m_Bytes.data().data(), static_cast<std::streamsize>(chunk.m_Bytes.data().size()));
+    return os.good();
+}
+
+bool CSheetFile::open(std::string_view data, unsigned threads) {
+    CByteReader in(data);
+    std::string_view magic;
+    uint64_t version, count;
+    if (!in.getBytes(sizeof(FILE_MAGIC), magic) || magic != std::string_view(FILE_MAGIC, sizeof(FILE_MAGIC))
+        || !in.getVarint(version) || (version != 2 && version != FORMAT_VERSION))
+        return false;
+    if (version == 2) {
+        // the checksum of the whole file ends it
+        uint32_t crc;
+        CByteReader trailer(data.substr(data.size() - std::min(data.size(), CRC_SIZE)));
+        if (data.size() < in.offset() + CRC_SIZE || !trailer.getFixed32(crc)) return false;
+        data.remove_suffix(CRC_SIZE);
+        if (crc != CCrc32::compute(data)) return false;
+        size_t offset = in.offset();
+        in = CByteReader(data);
+        std::string_view header;
+        in.getBytes(offset, header);
+    }
+
+    // counts are checked against the remaining bytes before anything is allocated for them
+    if (!in.getVarint(count) || count > in.remaining()) return false;
+    m_Strings.resize(count);
+    for (auto &string: m_Strings)
+        if (!in.getString(string)) return false;
+
+    if (!in.getVarint(count) || count > in.remaining()) return false;
+    m_TemplateOffsets.resize(count);
+    m_Templates.assign(count, nullptr);
+    for (auto &offset: m_TemplateOffsets) {
+        offset = in.offset();
+        if (!CFormula::skipBinary(in, m_Strings.size())) return false;
+    }
+
+    size_t entries = 0;
+    if (version == 2) {
+        // one chunk of all cells, checked with the whole file
+        if (!in.getVarint(count) || count > in.remaining()) return false;
+        m_Chunks.push_back({in.offset(), in.remaining(), 0, count, true, true});
+        entries = count;
+    } else {
+        if (!in.getVarint(count) || count > in.remaining()) return false;
+        m_Chunks.resize(count);
+        for (auto &chunk: m_Chunks) {
+            // every record takes at least three bytes
+            if (!in.getVarint(chunk.m_Size) || !in.getVarint(chunk.m_Count) || !chunk.m_Count
+                || chunk.m_Count > chunk.m_Size)
+                return false;
+            chunk.m_First = entries;
+            entries += chunk.m_Count;
+        }
+        uint32_t crc;
+        size_t offset = in.offset();
+        if (!in.getFixed32(crc) || crc != CCrc32::compute(data.substr(0, offset))) return false;
+        offset = in.offset();
+        for (auto &chunk: m_Chunks) {
+            if (chunk.m_Size > data.size() - offset || CRC_SIZE > data.size() - offset - chunk.m_Size) return false;
+            chunk.m_Offset = offset;
+            offset += chunk.m_Size + CRC_SIZE;
+        }
+        if (offset != data.size()) return false;
+    }
+
+    m_Data = data;
+    m_Entries.resize(entries);
+    std::vector<int> tasks(m_Chunks.size());
+    std::vector<uint8_t> valid(m_Chunks.size());
+    for (size_t i = 0; i < tasks.size(); i++)
+        tasks[i] = static_cast<int>(i);
+    CTaskPool::run(workers(threads, m_Chunks.size()), tasks, [&](int id, auto &&) {
+        valid[id] = indexChunk(m_Chunks[id]);
+    });
+    if (std::find(valid.begin(), valid.end(), 0) != valid.end()) return false;
+    // chunks hold whole bands of tile rows, in order
+    for (size_t i = 1; i < m_Chunks.size(); i++) {
+        size_t first = m_Chunks[i].m_First;
+        if (m_Entries[first - 1].m_Row >> CGrid::TILE_BITS >= m_Entries[first].m_Row >> CGrid::TILE_BITS)
+            return false;
+    }
+    m_Pending = m_Entries.size();
+    return true;
+}
+
+bool CSheetFile::indexChunk(const CChunk &chunk) {
+    CByteReader in(m_Data.substr(chunk.m_Offset, chunk.m_Size));
+    int64_t row = 0, column = 0;
+    for (size_t i = 0; i < chunk.m_Count; i++) {
+        // positions have to grow for the entries to be searchable
+        int64_t rowDelta;
+        if (!in.getZigzag(rowDelta) || (i && rowDelta < 0)) return false;
+        row += rowDelta;
+        if (i && !rowDelta) {
+            uint64_t gap;
+            if (!in.getVarint(gap) || gap > UINT32_MAX) return false;
+            column += static_cast<int64_t>(gap) + 1;
+        } else if (!in.getZigzag(column))
+            return false;
+        if (row < INT_MIN || row > INT_MAX || column < INT_MIN || column > INT_MAX) return false;
+        m_Entries[chunk.m_First + i] = {static_cast<int>(row), static_cast<int>(column), chunk.m_Offset + in.offset()};
+
+        uint8_t record;
+        uint64_t id;
+        int64_t integer;
+        std::string_view number;
+        if (!in.getByte(record)) return false;
+        switch (static_cast<ERecord>(record)) {
+            case ERecord::Formula:
+                if (!in.getVarint(id) || id >= m_Templates.size()) return false;
+                break;
+            case ERecord::Number:
+                if (!in.getBytes(sizeof(double), number)) return false;
+                break;
+            case ERecord::Integer:
+                if (!in.getZigzag(integer)) return false;
+                break;
+            default:
+                return false;
+        }
+    }
+    return !in.remaining();
+}
+
+bool CSheetFile::checkChunk(CChunk &chunk) {
+    if (!chunk.m_Checked) {
+        uint32_t crc;
+        CByteReader trailer(m_Data.substr(chunk.m_Offset + chunk.m_Size, CRC_SIZE));
+        chunk.m_Valid = trailer.getFixed32(crc) && crc == CCrc32::compute(m_Data.substr(chunk.m_Offset, chunk.m_Size));
+        chunk.m_Checked = true;
+    }
+    return chunk.m_Valid;
+}
+
+bool CSheetFile::map(const std::string &path, unsigned threads) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat status{};
+    void *address = MAP_FAILED;
+    if (!fstat(fd, &status) && status.st_size > 0)
+        address = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping stays valid after the descriptor is closed
+    close(fd);
+    if (address == MAP_FAILED) return false;
+    auto size = static_cast<size_t>(status.st_size);
+    m_Mapping = std::shared_ptr<const char>(static_cast<const char *>(address), [size](const char *data) {
+        munmap(const_cast<char *>(data), size);
+    });
+    return open(std::string_view(m_Mapping.get(), size), threads);
+}
+
+CSheetFile::CEntry *CSheetFile::find(const CPos &pos) {
+    return const_cast<CEntry *>(std::as_const(*this).find(pos));
+}
+
+const CSheetFile::CEntry *CSheetFile::find(const CPos &pos) const {
+    auto it = std::lower_bound(m_Entries.begin(), m_Entries.end(), pos, [](const CEntry &entry, const CPos &pos) {
+        return std::pair(entry.m_Row, entry.m_Column) < std::pair(pos.m_Row, pos.m_Column);
+    });
+    if (it == m_Entries.end() || it->m_Row != pos.m_Row || it->m_Column != pos.m_Column || it->m_Offset == DECODED)
+        return nullptr;
+    return &*it;
+}
+
+bool CSheetFile::decodeTemplate(uint64_t id, CStringPool &strings, CFormula &formula) const {
+    if (id >= m_TemplateOffsets.size() || m_TemplateOffsets[id] >= m_Data.size()) return false;
+    CByteReader code(m_Data.substr(m_TemplateOffsets[id]));
+    return formula.loadBinary(code, m_Strings) && formula.finalize(strings);
+}
+
+bool CSheetFile::decodeRecord(const CEntry &entry, CGrid &sheet, CFormulaPool *formulas,
+                              std::vector<std::shared_ptr<const CFormula>> *templates) const {
+    // open checked the record, the checks here keep a bad offset or template id from reading outside the data
+    if (entry.m_Offset >= m_Data.size()) return false;
+    CByteReader in(m_Data.substr(entry.m_Offset));
+    CPos pos(entry.m_Row, entry.m_Column);
+    uint8_t record = 0;
+    uint64_t id = 0;
+    double number = 0;
+    int64_t integer = 0;
+    if (!in.getByte(record)) return false;
+    switch (static_cast<ERecord>(record)) {
+        case ERecord::Formula: {
+            if (!in.getVarint(id) || id >= m_Templates.size()) return false;
+            std::shared_ptr<const CFormula> shared = m_Templates[id];
+            if (!shared) {
+                CFormula formula;
+                if (!formulas || !decodeTemplate(id, sheet.strings(), formula)) return false;
+                shared = formulas->intern(std::move(formula));
+                if (templates)
+                    (*templates)[id] = shared;
+            }
+            CCell &cell = sheet[pos];
+            cell.m_Formula = std::move(shared);
+            cell.m_Pos = pos;
+            return true;
+        }
+        case ERecord::Number:
+            if (!in.getDouble(number)) return false;
+            sheet.setNumber(pos, number);
+            return true;
+        case ERecord::Integer:
+            if (!in.getZigzag(integer)) return false;
+            sheet.setNumber(pos, static_cast<double>(integer));
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool CSheetFile::decode(CEntry &entry, CGrid &sheet, CFormulaPool &formulas) {
+    auto index = static_cast<size_t>(&entry - m_Entries.data());
+    auto chunk = std::upper_bound(m_Chunks.begin(), m_Chunks.end(), index, [](size_t index, const CChunk &chunk) {
+        return index < chunk.m_First;
+    });
+    bool decoded = checkChunk(*std::prev(chunk)) && decodeRecord(entry, sheet, &formulas, &m_Templates);
+    entry.m_Offset = DECODED;
+    m_Pending--;
+    return decoded;
+}
+
+bool CSheetFile::decodeAll(CGrid &sheet, CFormulaPool &formulas, unsigned threads) {
+    // templates are decoded first, the chunks then only read them
+    std::vector<int> tasks;
+    for (size_t id = 0; id < m_Templates.size(); id++)
+        if (!m_Templates[id])
+            tasks.push_back(static_cast<int>(id));
+    std::vector<CFormula> decoded(m_Templates.size());
+    std::vector<uint8_t> valid(m_Templates.size());
+    CTaskPool::run(workers(threads, tasks.size()), tasks, [&](int id, auto &&) {
+        valid[id] = decodeTemplate(id, sheet.strings(), decoded[id]);
+    });
+    for (int id: tasks)
+        if (valid[id])
+            m_Templates[id] = formulas.intern(std::move(decoded[id]));
+
+    tasks.resize(m_Chunks.size());
+    for (size_t i = 0; i < tasks.size(); i++)
+        tasks[i] = static_cast<int>(i);
+    std::vector<CGrid> grids(m_Chunks.size());
+    valid.assign(m_Chunks.size(), 1);
+    CTaskPool::run(workers(threads, tasks.size()), tasks, [&](int id, auto &&) {
+        CChunk &chunk = m_Chunks[id];
+        for (size_t i = chunk.m_First; i < chunk.m_First + chunk.m_Count; i++) {
+            if (m_Entries[i].m_Offset == DECODED) continue;
+            if (!checkChunk(chunk) || !decodeRecord(m_Entries[i], grids[id], nullptr, nullptr))
+                valid[id] = 0;
+            m_Entries[i].m_Offset = DECODED;
+        }
+    });
+    for (auto &grid: grids)
+        sheet.merge(std::move(grid));
+    m_Pending = 0;
+    return std::find(valid.begin(), valid.end(), 0) == valid.end();
+}
+
+void CSheetFile::discard(const CPos &pos) {
+    if (CEntry *entry = find(pos)) {
+        entry->m_Offset = DECODED;
+        m_Pending--;
+    }
+}
+
+size_t CSheetFile::pending() const {
+    return m_Pending;
+}
+
+// *—————————————————————————————————————————————————CSpreadsheet.h——————————————————————————————————————————————————————* //
+
+/**
+ * Class representing a spreadsheet.
+ */
+class CSpreadsheet {
+public:
+    static unsigned capabilities() {
+        return SPREADSHEET_CYCLIC_DEPS | SPREADSHEET_FUNCTIONS | SPREADSHEET_FILE_IO | SPREADSHEET_SPEED
+            /*| SPREADSHEET_PARSER*/;
+    }
+
+    CSpreadsheet();
+
+    /**
+     * Take a copy of the spreadsheet in constant time, the same as copying it. The copy shares the tiles of cells and
+     * of dependencies with the spreadsheet until one of them changes, a change then copies only the tiles it touches.
+     * Evaluating a cell counts as a change of its tile, the value is cached in it. Unlike a plain copy, a snapshot
+     * may be taken while other threads read cells that are still pending.
+     * @return - independent copy
+     */
+    CSpreadsheet snapshot() const;
+
+    /**
+     * Load the spreadsheet from the input stream, in the current format or in the format of version 1.
+     * @param is - input stream
+     * @return
+     */
+    bool load(std::istream &is);
+
+    /**
+     * Open a file saved by save without decoding it. The file is mapped to memory and only the positions of its cells
+     * are indexed, a cell is decoded on its first access. Writes, recalculate and save decode what they need. The
+     * checksum of a chunk of cells is checked on the first decode from it, the cells of a damaged chunk are left
+     * empty. While cells are pending, the file may be replaced, as save to a path does, but not written over in place.
+     * @param path - path to the file
+     * @return - true if the file is valid, the spreadsheet is left unchanged otherwise
+     */
+    bool openMapped(const std::string &path);
+
+    /**
+     * Save the spreadsheet to the output stream. The file starts with a header of CSheetFile::FILE_MAGIC, the format
+     * version, the string table, the dictionary of formula templates and the sizes of the chunks of cells, closed by
+     * its CRC-32. The chunks follow, each with the cells of whole bands of tile rows in row-major order with delta
+     * coded positions and its own CRC-32, they are encoded in parallel. Integers are varints, doubles little-endian.
+     * @param os - output stream
+     * @return
+     */
+    bool save(std::ostream &os) const;
+
+    /**
+     * Save the spreadsheet to a file. The file is written under a temporary name and renamed over the path, so a
+     * spreadsheet that opened the path by openMapped keeps reading the content it was opened with.
+     * @param path - path to the file
+     * @return - true if success, false otherwise, the file at the path is left as it was then
+     */
+    bool save(const std::string &path) const;
+
+    /**
+     * Set the contents of the cell.
+     * @param pos - position of the cell
+     * @param contents - contents of the cell
+     * @return - true if the cell was set successfully
+     */
+    bool setCell(CPos pos, std::string contents);
+
+    /**
+     * Get the value of the cell.
+     * @param pos - position of the cell
+     * @return - value of the cell
+     */
+    CValue getValue(CPos pos);
+
+    /**
+     * Get the value of the cell without changing the spreadsheet, any number of threads may call it at once while no
+     * thread changes the spreadsheet. Values are calculated for the call only, values cached by recalculate or by the
+     * non-const getValue are read as they are. While cells are pending in a mapped file or unparsed, the call
+     * materializes the cells it needs into the spreadsheet itself, once for all readers, and the readers take turns
+     * with it. Once no cell is pending, the reads take no lock.
+     * @param pos - position of the cell
+     * @return - value of the cell
+     */
+    CValue getValue(CPos pos) const;
+
+    /**
+     * Copy a rectangle of cells from one position to another.
+     * @param dst - destination position
+     * @param src - source position
+     * @param w  - width
+     * @param h  - height
+     */
+    void copyRect(CPos dst, CPos src, int w = 1, int h = 1);
+
+    /**
+     * Get the values of many cells at once.
+     * Values shared by the cells are evaluated once and reused by the rest of the batch.
+     * @param positions - positions of the cells
+     * @param values - buffer for the values, at least as long as positions
+     * @return - false if the buffer is too short, nothing is read then
+     */
+    bool getValues(std::span<const CPos> positions, std::span<CValue> values);
 
-CValue
-CFuncCall::evaluate(std::deque<std::shared_ptr<COperation>> &stack, std::map<CPos, CCell> &sheet, int &depth) const {
-    return {}; // todo
-}
+    /**
+     * Get the values of a rectangle of cells at once, walking the rectangle tile by tile.
+     * @param topLeft - position of the top left cell
+     * @param w - width
+     * @param h - height
+     * @param values - buffer for the values row after row, at least w * h long
+     * @return - false if the buffer is too short, nothing is read then
+     */
+    bool getRect(CPos topLeft, int w, int h, std::span<CValue> values);
 
-std::shared_ptr<COperation> CFuncCall::clone() const {
-    return std::make_shared<CFuncCall>(*this);
-}
+    /**
+     * Evaluate every cell without a cached value on a pool of threads.
+     * A cell is evaluated once all cells it references are, so evaluations never wait for each other.
+     * Cells on a cycle are undefined, cells written in an uncommitted batch may form cycles that are not known yet,
+     * such cells are skipped and left to getValue.
+     * @param threads - number of threads, zero for the number of hardware threads
+     */
+    void recalculate(unsigned threads = 0);
 
-bool CFuncCall::saveBinary(std::ostream &os) const {
-    return os.good();
-}
+    /**
+     * Start a batch of writes. Until commit, setCell parses and stores cells but defers dependency maintenance and
+     * invalidation, and values read inside the batch may not reflect its writes.
+     */
+    void beginBatch();
 
-bool CFuncCall::loadBinary(std::istream &is) {
-    return is.good();
-}
+    /**
+     * Finish a batch of writes: link the written cells to their references and invalidate their dependents in
+     * one pass.
+     */
+    void commit();
 
-int CFuncCall::getTypeId() const {
-    return 17;
-}
+    /**
+     * Let setCell store formulas as text and parse them when they are first needed: when the cell is evaluated or
+     * copied, or when a parsed formula references it. Formulas written to cells that parsed formulas already
+     * reference are parsed at once. An invalid formula found later leaves its cell empty and is reported by
+     * parseErrors.
+     * @param lazy - true to defer parsing
+     */
+    void setLazyParsing(bool lazy);
 
-// *—————————————————————————————————————————————————CCell.h——————————————————————————————————————————————————————————————* //
+    /**
+     * Get the positions of the cells whose deferred formulas turned out invalid when they were parsed.
+     * @return - positions in the order the formulas were parsed
+     */
+    const std::vector<CPos> &parseErrors() const;
 
-/**
- * Class that represents cell.
- */
-class CCell {
-public:
     /**
-     * Stack of operations.
+     * Get how often a formula written to a cell had the same shape as one compiled before, relative to its cell,
+     * and reused its template without parsing.
+     * @return - hits and misses of the parse cache
      */
-    std::deque<std::shared_ptr<COperation>> m_Stack;
+    CParseCache::CStats parseCacheStats() const;
 
     /**
-     * Flag that indicates whether the cell is calculated.
+     * Get the number of strings interned for the cells, strings no cell holds anymore are released by later writes.
+     * @return - number of strings
      */
-    bool m_IsCalculated = false;
+    size_t stringCount() const;
 
-    CCell() {};
+private:
+    /**
+     * Map of cells.
+     */
+    CGrid m_Sheet;
 
     /**
-     * Save cell to binary file.
-     * @param os - output stream
-     * @return - true if success, false otherwise
+     * Arena for the operations of formulas being parsed or loaded, reset once they are compiled.
      */
-    bool saveBinary(std::ostream &os) const;
+    CArena m_Arena;
 
     /**
-     * Calculate cell.
-     * @param sheet - sheet of cells
-     * @return - result of calculation
+     * Formula templates shared by the cells, copies of the spreadsheet share the pool like the strings of the sheet.
      */
-    CValue calculateCell(std::map<CPos, CCell> &sheet);
+    std::shared_ptr<CFormulaPool> m_Formulas = std::make_shared<CFormulaPool>();
 
     /**
-     * Load cell from binary file.
-     * @param is - input stream
-     * @return - true if success, false otherwise
+     * Map of cells whose formulas use ranges to the ranges, relocated to the cells. A cell is listed once for each of
+     * its ranges, so a range is checked without decoding the formula.
      */
-    bool loadBinary(std::istream &is);
-};
+    using CRangeDependents = std::multimap<CPos, CRange>;
 
-// *—————————————————————————————————————————————————CCell.cpp——————————————————————————————————————————————————————————————* //
+    /**
+     * Cells depending on the cells of one tile.
+     */
+    struct CDependents {
+        /**
+         * Map of cell keys to the cells whose formulas reference them.
+         */
+        std::unordered_map<uint64_t, std::set<CPos>> m_Cells;
+
+        /**
+         * Cells whose formulas use a range overlapping the tile.
+         */
+        CRangeDependents m_Ranges;
+    };
 
-CValue CCell::calculateCell(std::map<CPos, CCell> &sheet) {
-    if (m_IsCalculated) return {};
-    else m_IsCalculated = true;
-    int depth = 0;
+    /**
+     * Dependents by the tile key of the cells they depend on, shared by copies of the spreadsheet like the tiles of
+     * the sheet.
+     */
+    CSharedBlocks<CDependents> m_Dependents;
 
+    /**
+     * Ranges covering more tiles are not indexed by tiles.
+     */
+    static constexpr int64_t MAX_INDEXED_RANGE_TILES = 1024;
 
-    auto result = (m_Stack.rbegin()->get()->evaluate(m_Stack, sheet, depth));
-    m_IsCalculated = false;
-    return result;
-}
+    /**
+     * Index of the file opened by openMapped, for the cells not decoded yet.
+     * Cells still in the file or in m_Unparsed are pending, they are not in the sheet. Every cell in the sheet has
+     * the cells its formula references materialized too, so evaluation and cycle detection never reach a pending
+     * cell.
+     */
+    CShared<CSheetFile> m_File;
 
-bool CCell::saveBinary(std::ostream &os) const {
-    size_t stackSize = m_Stack.size();
-    os.write(reinterpret_cast<const char *>(&stackSize), sizeof(stackSize));
+    /**
+     * Formulas stored as text by setCell with lazy parsing, not parsed yet.
+     */
+    CShared<std::map<CPos, std::string>> m_Unparsed;
 
-    for (const auto &op: m_Stack) {
-        int typeId = op->getTypeId();
-        os.write(reinterpret_cast<const char *>(&typeId), sizeof(typeId));
-        if (!op->saveBinary(os)) return false;
-    }
+    bool m_LazyParsing = false;
 
-    bool isCalculated = m_IsCalculated;
-    os.write(reinterpret_cast<const char *>(&isCalculated), sizeof(isCalculated));
+    std::vector<CPos> m_ParseErrors;
 
-    return true;
-}
+    /**
+     * Templates of recently compiled formulas by their text relative to the cell.
+     */
+    CParseCache m_ParseCache;
 
-// *—————————————————————————————————————————————————CMyExpressionBuilder.h——————————————————————————————————————————————————————* //
+    /**
+     * Check whether some cells are pending.
+     * @return - true if cells are left in the file or unparsed
+     */
+    bool hasPending() const;
 
-class CMyExpressionBuilder : public CExprBuilder {
-public:
     /**
-     * Add operation to the stack.
+     * Move the pending cells at the positions and inside the ranges to the sheet, together with the cells they
+     * transitively reference, and link them.
+     * @param positions - positions of the cells
+     * @param ranges - ranges of cells
      */
-    void opAdd() override;
+    void materialize(std::span<const CPos> positions, std::span<const CRange> ranges = {});
 
     /**
-     * Subtract operation from the stack.
+     * Calculate the value of a materialized cell, storing the values in the tiles the sheet owns.
+     * @param pos - position of the cell
+     * @return - value of the cell
      */
-    void opSub() override;
+    CValue calculate(const CPos &pos);
 
     /**
-     * Multiply operation from the stack.
+     * Move all pending cells to the sheet and release the file.
      */
-    void opMul() override;
+    void materializeAll();
 
     /**
-     * Divide operation from the stack.
+     * Drop a pending cell that is overwritten.
+     * @param pos - position of the cell
      */
-    void opDiv() override;
+    void discardPending(const CPos &pos);
 
     /**
-     * Power operation from the stack.
+     * Release the interned strings no cell value or formula template retains, of this spreadsheet or of the copies
+     * sharing its pool, once they outnumber the ones in use. The sweep is left to a later write while a copy is
+     * being evaluated.
      */
-    void opPow() override;
+    void releaseStrings();
 
     /**
-     * Negation operation from the stack.
+     * Compile a formula for a cell, reusing the template of a formula of the same shape compiled before.
+     * @param formula - formula starting with '='
+     * @param pos - position of the cell
+     * @param cell - receives the compiled formula
+     * @return - false if the formula is invalid
      */
-    void opNeg() override;
+    bool compileFormula(const std::string &formula, const CPos &pos, CCell &cell);
 
     /**
-     * Equal operation from the stack.
+     * Check whether any cell references the position, directly or through a range.
+     * @param pos - position
+     * @return - true if the position has dependents
      */
-    void opEq() override;
+    bool hasDependents(const CPos &pos) const;
 
     /**
-     * Not equal operation from the stack.
+     * Load the format of version 1: the count of cells and for every cell its position and operations.
+     * @param is - input stream
+     * @return - true if success, false otherwise
      */
-    void opNe() override;
+    bool loadVersion1(std::istream &is);
 
     /**
-     * Less than operation from the stack.
+     * Load a file of version 2 or of the current format through its index.
+     * @param data - content of the file
+     * @return - true if success, false otherwise
      */
-    void opLt() override;
+    bool loadIndexed(std::string_view data);
 
     /**
-     * Less equal operation from the stack.
+     * Replace the cells by loaded ones and rebuild the dependencies.
+     * @param sheet - loaded cells
+     * @param formulas - templates of the loaded formulas
      */
-    void opLe() override;
+    void replaceSheet(CGrid &&sheet, std::shared_ptr<CFormulaPool> formulas);
 
     /**
-     * Greater than operation from the stack.
+     * Cells whose formulas use a range too large to be indexed by tiles, by the columns the range spans. Ranges
+     * spanning more than MAX_INDEXED_RANGE_TILES columns are kept under WIDE_RANGES.
      */
-    void opGt() override;
+    CSharedBlocks<CRangeDependents> m_LargeRanges;
 
     /**
-     * Greater equal operation from the stack.
+     * Key of the ranges of m_LargeRanges that are not indexed by columns, no column has it.
      */
-    void opGe() override;
+    static constexpr uint64_t WIDE_RANGES = ~uint64_t(0);
 
     /**
-     * Add number to the stack.
-     * @param val - number
+     * Collect keys of the tiles a range overlaps.
+     * @param range - range of cells
+     * @param keys - vector to append the keys to
+     * @return - false if the range covers more than MAX_INDEXED_RANGE_TILES tiles
      */
-    void valNumber(double val) override;
+    static bool rangeTiles(const CRange &range, std::vector<uint64_t> &keys);
 
     /**
-     * Add string to the stack.
-     * @param val - string
+     * Collect keys of m_LargeRanges a range too large to be indexed by tiles is kept under.
+     * @param range - range of cells
+     * @param keys - vector to append the keys to
      */
-    void valString(std::string val) override;
+    static void rangeColumns(const CRange &range, std::vector<uint64_t> &keys);
 
     /**
-     * Add reference on cell to the stack.
-     * @param val - reference on cell
+     * Register the cell as a dependent of every cell its formula references.
+     * @param pos - position of the cell
      */
-    void valReference(std::string val) override;
+    void linkCell(const CPos &pos);
 
     /**
-     * Add range of cells to the stack.
-     * @param val - range of cells
+     * Remove the cell from the dependents of every cell its formula references.
+     * @param pos - position of the cell
      */
-    void valRange(std::string val) override;
+    void unlinkCell(const CPos &pos);
 
     /**
-     * Add function call to the stack.
-     * @param fnName - function name
-     * @param paramCount - count of parameters
+     * Call a function for every cell whose formula references a position, directly or through a range.
+     * @param pos - position
+     * @param fn - function called with the position of the dependent cell
      */
-    void funcCall(std::string fnName, int paramCount) override; // function call
+    template<typename F>
+    void forEachDependent(const CPos &pos, F &&fn) const;
 
     /**
-     * Get the stack of operations.
-     * @return - stack of operations
+     * Call a function for every cell a formula references, directly or as a cell of a range.
+     * @param pos - position of the formula cell
+     * @param fn - function called with the position of the referenced cell
      */
-    std::deque<std::shared_ptr<COperation>> getStack();
+    template<typename F>
+    void forEachPrecedent(const CPos &pos, F &&fn) const;
 
-private:
     /**
-     * Stack of operations.
+     * Recompute cycle membership of the cells a change can affect.
+     * A cycle that appears passes through a changed cell, its cells are reachable from the changed ones both along
+     * the dependents and along the precedents. A cycle that disappears passed through a changed cell too, its other
+     * cells are still marked and reachable along the dependents. The searches along the dependents and along the
+     * precedents take turns until one of them is complete, so the work is bounded by the smaller side. If the
+     * dependents are complete first, all of them are examined, otherwise only the cells reachable within the
+     * precedents and the marked cells reachable from the changed ones. Strongly connected components of the examined
+     * cells are found by Tarjan's algorithm on an explicit stack.
+     * @param changed - positions of the changed cells
+     * @param flipped - receives the positions of cells that joined or left a cycle
      */
-    std::deque<std::shared_ptr<COperation>> m_Stack;
-};
+    void updateCycles(std::span<const CPos> changed, std::vector<CPos> &flipped);
 
+    /**
+     * Check whether a cell lies on a cycle of references.
+     * @param pos - position of the cell
+     * @return - true if the cell is on a cycle
+     */
+    bool inCycle(const CPos &pos) const;
 
-// *—————————————————————————————————————————————————CMyExpressionBuilder.cpp——————————————————————————————————————————————————————* //
+    /**
+     * Update cycle membership and drop cached values after cells have been written and linked.
+     * @param changed - positions of the written cells
+     */
+    void refresh(std::span<const CPos> changed);
 
-void CMyExpressionBuilder::opAdd() {
-    m_Stack.push_back(std::make_shared<CAddition>());
-}
+    /**
+     * Drop cached values of the cell and of all cells that transitively depend on it.
+     * @param pos - position of the changed cell
+     */
+    void invalidate(const CPos &pos);
 
-void CMyExpressionBuilder::opSub() {
-    m_Stack.push_back(std::make_shared<CSubtraction>());
-}
+    /**
+     * Drop cached values of the cells and of all cells that transitively depend on them, every cell at most once.
+     * @param positions - positions of the changed cells
+     */
+    void invalidate(std::span<const CPos> positions);
 
-void CMyExpressionBuilder::opMul() {
-    m_Stack.push_back(std::make_shared<CMultiplication>());
-}
+    /**
+     * True between beginBatch and commit.
+     */
+    bool m_InBatch = false;
 
-void CMyExpressionBuilder::opDiv() {
-    m_Stack.push_back(std::make_shared<CDivision>());
-}
+    /**
+     * Cells written since beginBatch, not yet linked to their references nor invalidated.
+     */
+    std::vector<CPos> m_BatchCells;
 
-void CMyExpressionBuilder::opPow() {
-    m_Stack.push_back(std::make_shared<CPower>());
-}
+    /**
+     * Turns of the const methods of a spreadsheet with pending cells, copies of the spreadsheet get their own.
+     */
+    struct CReads {
+        CReads() = default;
 
-void CMyExpressionBuilder::opNeg() {
-    m_Stack.push_back(std::make_shared<CNegation>());
-}
+        CReads(const CReads &) {}
 
-void CMyExpressionBuilder::opEq() {
-    m_Stack.push_back(std::make_shared<CEqual>());
-}
+        CReads &operator=(const CReads &) {
+            m_Settled.store(false, std::memory_order_relaxed);
+            return *this;
+        }
 
-void CMyExpressionBuilder::opNe() {
-    m_Stack.push_back(std::make_shared<CNotEqual>());
-}
+        /**
+         * Held exclusively while a const method materializes cells, shared by the const methods reading meanwhile.
+         */
+        std::shared_mutex m_Mutex;
 
-void CMyExpressionBuilder::opLt() {
-    m_Stack.push_back(std::make_shared<CLessThan>());
-}
+        /**
+         * Set once no cell is pending, the const methods then take no lock until a write makes cells pending again.
+         */
+        std::atomic<bool> m_Settled = false;
+    };
 
-void CMyExpressionBuilder::opLe() {
-    m_Stack.push_back(std::make_shared<CLessEqual>());
-}
+    mutable CReads m_Reads;
 
-void CMyExpressionBuilder::opGt() {
-    m_Stack.push_back(std::make_shared<CGreaterThan>());
-}
+    /**
+     * Materialize the pending cells a const method reads, into the spreadsheet itself, and lock it for the method.
+     * @param positions - positions of the cells the method reads
+     * @return - lock shared with the other const methods, it holds nothing once no cell is pending
+     */
+    std::shared_lock<std::shared_mutex> lockReads(std::span<const CPos> positions) const;
+};
 
-void CMyExpressionBuilder::opGe() {
-    m_Stack.push_back(std::make_shared<CGreaterEqual>());
-}
+// *—————————————————————————————————————————————————CSpreadsheet.cpp——————————————————————————————————————————————————————* //
 
-void CMyExpressionBuilder::valNumber(double val) {
-    m_Stack.push_back(std::make_shared<CNumber>(val));
-}
+CSpreadsheet::CSpreadsheet() {}
 
-void CMyExpressionBuilder::valString(std::string val) {
-    m_Stack.push_back(std::make_shared<CString>(val));
+CSpreadsheet CSpreadsheet::snapshot() const {
+    auto lock = lockReads({});
+    return *this;
 }
 
-void CMyExpressionBuilder::valReference(std::string val) {
-    m_Stack.push_back(std::make_shared<CReference>(val));
+std::shared_lock<std::shared_mutex> CSpreadsheet::lockReads(std::span<const CPos> positions) const {
+    if (m_Reads.m_Settled.load(std::memory_order_acquire)) return {};
+    {
+        std::lock_guard<std::shared_mutex> lock(m_Reads.m_Mutex);
+        // materializing changes only how the cells are stored, not their values, so const methods may do it while no
+        // other method reads
+        if (!positions.empty())
+            const_cast<CSpreadsheet *>(this)->materialize(positions);
+        if (!hasPending()) {
+            m_Reads.m_Settled.store(true, std::memory_order_release);
+            return {};
+        }
+    }
+    return std::shared_lock<std::shared_mutex>(m_Reads.m_Mutex);
 }
 
-void CMyExpressionBuilder::valRange(std::string val) {
-    m_Stack.push_back(std::make_shared<CValRange>());
+bool CSpreadsheet::load(std::istream &is) {
+    std::string data{std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>()};
+    if (std::string_view(data).starts_with(std::string_view(CSheetFile::FILE_MAGIC, sizeof(CSheetFile::FILE_MAGIC))))
+        return loadIndexed(data);
+    std::istringstream version1(std::move(data));
+    return loadVersion1(version1);
 }
 
-void CMyExpressionBuilder::funcCall(std::string fnName, int paramCount) {
-    m_Stack.push_back(std::make_shared<CFuncCall>());
+bool CSpreadsheet::loadVersion1(std::istream &is) {
+    // the loaded strings go to the pool of the new grid, templates holding them must not be shared with old cells
+    CGrid newSheet;
+    auto newFormulas = std::make_shared<CFormulaPool>();
+    size_t size;
+    if (!is.read(reinterpret_cast<char *>(&size), sizeof(size))) return false;
+    for (size_t i = 0; i < size; i++) {
+        CPos pos;
+        CCell cell;
+        m_Arena.reset();
+        if (!pos.loadBinary(is) || !cell.loadBinary(is, m_Arena, pos, *newFormulas, newSheet.strings()))
+            return false;
+        double number;
+        if (cell.m_Formula->getNumber(number))
+            newSheet.setNumber(pos, number);
+        else
+            newSheet[pos] = std::move(cell);
+    }
+    replaceSheet(std::move(newSheet), std::move(newFormulas));
+    return true;
 }
 
-std::deque<std::shared_ptr<COperation>> CMyExpressionBuilder::getStack() {
-    return m_Stack;
+bool CSpreadsheet::loadIndexed(std::string_view data) {
+    CSheetFile file;
+    CGrid newSheet;
+    auto newFormulas = std::make_shared<CFormulaPool>();
+    if (!file.open(data) || !file.decodeAll(newSheet, *newFormulas)) return false;
+    replaceSheet(std::move(newSheet), std::move(newFormulas));
+    return true;
 }
 
-// *—————————————————————————————————————————————————CSpreadsheet.h——————————————————————————————————————————————————————* //
-
-/**
- * Class representing a spreadsheet.
- */
-class CSpreadsheet {
-public:
-    static unsigned capabilities() {
-        return SPREADSHEET_CYCLIC_DEPS | SPREADSHEET_FUNCTIONS | SPREADSHEET_FILE_IO | SPREADSHEET_SPEED
-            /*| SPREADSHEET_PARSER*/;
+bool CSpreadsheet::openMapped(const std::string &path) {
+    CSheetFile file;
+    if (!file.map(path)) return false;
+    replaceSheet(CGrid(), std::make_shared<CFormulaPool>());
+    if (file.pending()) {
+        m_File.emplace(std::move(file));
+        m_Reads.m_Settled.store(false, std::memory_order_relaxed);
     }
+    return true;
+}
 
-    CSpreadsheet();
-
-    /**
-     * Load the spreadsheet from the input stream.
-     * @param is - input stream
-     * @return
-     */
-    bool load(std::istream &is);
-
-    /**
-     * Save the spreadsheet to the output stream.
-     * @param os - output stream
-     * @return
-     */
-    bool save(std::ostream &os) const;
-
-    /**
-     * Set the contents of the cell.
-     * @param pos - position of the cell
-     * @param contents - contents of the cell
-     * @return - true if the cell was set successfully
-     */
-    bool setCell(CPos pos, std::string contents);
-
-    /**
-     * Get the value of the cell.
-     * @param pos - position of the cell
-     * @return - value of the cell
-     */
-    CValue getValue(CPos pos);
-
-    /**
-     * Copy a rectangle of cells from one position to another.
-     * @param dst - destination position
-     * @param src - source position
-     * @param w  - width
-     * @param h  - height
-     */
-    void copyRect(CPos dst, CPos src, int w = 1, int h = 1);
-
-private:
-    /**
-     * Map of cells.
-     */
-    std::map<CPos, CCell> m_Sheet;
-};
-
-// *—————————————————————————————————————————————————CSpreadsheet.cpp——————————————————————————————————————————————————————* //
+bool CSpreadsheet::hasPending() const {
+    return m_File || !m_Unparsed->empty();
+}
 
-CSpreadsheet::CSpreadsheet() {}
+void CSpreadsheet::materialize(std::span<const CPos> positions, std::span<const CRange> ranges) {
+    if (!hasPending()) return;
+    std::vector<CPos> pending(positions.begin(), positions.end()), materialized;
+    std::vector<CRange> pendingRanges(ranges.begin(), ranges.end());
+    while (!pending.empty() || !pendingRanges.empty()) {
+        if (pendingRanges.empty()) {
+            CPos pos = pending.back();
+            pending.pop_back();
+            // a malformed template leaves the cell empty
+            if (m_File && m_File->find(pos)) {
+                CSheetFile &file = m_File.edit();
+                file.decode(*file.find(pos), m_Sheet, *m_Formulas);
+            } else if (auto it = m_Unparsed->find(pos); it != m_Unparsed->end()) {
+                CCell cell;
+                if (compileFormula(it->second, pos, cell))
+                    m_Sheet[pos] = std::move(cell);
+                else
+                    m_ParseErrors.push_back(pos);
+                m_Unparsed.edit().erase(pos);
+            } else
+                continue;
+            materialized.push_back(pos);
+            if (const CCell *cell = std::as_const(m_Sheet).find(pos)) {
+                cell->getReferences(pending);
+                cell->getRanges(pendingRanges);
+            }
+            continue;
+        }
+        CRange range = pendingRanges.back();
+        pendingRanges.pop_back();
+        if (m_File)
+            m_File->forEachInRange(range, [&](const CSheetFile::CEntry &entry) {
+                pending.emplace_back(entry.m_Row, entry.m_Column);
+            });
+        // rows without unparsed cells inside the range are skipped by a search for the next row
+        for (auto it = m_Unparsed->lower_bound(CPos(range.top(), range.left()));
+             it != m_Unparsed->end() && it->first.m_Row <= range.bottom();) {
+            if (it->first.m_Column > range.right()) {
+                if (it->first.m_Row == INT_MAX) break;
+                it = m_Unparsed->lower_bound(CPos(it->first.m_Row + 1, range.left()));
+                continue;
+            }
+            pending.push_back(it->first);
+            ++it;
+        }
+    }
+    for (const auto &pos: materialized)
+        linkCell(pos);
+    refresh(materialized);
+    if (m_File && !m_File->pending())
+        m_File.reset();
+}
 
-bool CSpreadsheet::load(std::istream &is) {
-    std::map < CPos, CCell > newSheet;
-    size_t size;
-    if (!is.read(reinterpret_cast<char *>(&size), sizeof(size))) return false;
-    for (size_t i = 0; i < size; i++) {
-        CPos pos;
+void CSpreadsheet::materializeAll() {
+    if (!hasPending()) return;
+    std::vector<CPos> materialized;
+    if (m_File) {
+        m_File->forEachPending([&](const CSheetFile::CEntry &entry) {
+            materialized.emplace_back(entry.m_Row, entry.m_Column);
+        });
+        // a malformed template leaves its cells empty
+        m_File.edit().decodeAll(m_Sheet, *m_Formulas);
+        m_File.reset();
+    }
+    for (const auto &[pos, formula]: *m_Unparsed) {
         CCell cell;
-        if (!pos.loadBinary(is) || !cell.loadBinary(is)) return false;
-        newSheet[pos] = cell;
+        if (compileFormula(formula, pos, cell))
+            m_Sheet[pos] = std::move(cell);
+        else
+            m_ParseErrors.push_back(pos);
+        materialized.push_back(pos);
+    }
+    m_Unparsed.reset();
+    for (const auto &pos: materialized)
+        linkCell(pos);
+    refresh(materialized);
+}
+
+void CSpreadsheet::discardPending(const CPos &pos) {
+    if (m_File && m_File->find(pos))
+        m_File.edit().discard(pos);
+    if (m_Unparsed->count(pos))
+        m_Unparsed.edit().erase(pos);
+}
+
+bool CSpreadsheet::compileFormula(const std::string &formula, const CPos &pos, CCell &cell) {
+    std::string key;
+    bool cacheable = CParseCache::normalize(formula, pos, key);
+    if (cacheable)
+        if (auto shared = m_ParseCache.find(key)) {
+            cell.m_Formula = std::move(shared);
+            cell.m_Pos = pos;
+            return true;
+        }
+    m_Arena.reset();
+    CMyExpressionBuilder builder(m_Arena);
+    try {
+        parseExpression(formula, builder);
+    } catch (const std::exception &e) {
+        return false;
     }
-    m_Sheet = std::move(newSheet);
+    if (!cell.compile(builder.getStack(), pos, *m_Formulas, m_Sheet.strings())) return false;
+    if (cacheable)
+        m_ParseCache.insert(std::move(key), cell.m_Formula);
     return true;
 }
 
+bool CSpreadsheet::hasDependents(const CPos &pos) const {
+    bool found = false;
+    forEachDependent(pos, [&](const CPos &) { found = true; });
+    return found;
+}
+
+void CSpreadsheet::setLazyParsing(bool lazy) {
+    m_LazyParsing = lazy;
+}
+
+const std::vector<CPos> &CSpreadsheet::parseErrors() const {
+    return m_ParseErrors;
+}
+
+CParseCache::CStats CSpreadsheet::parseCacheStats() const {
+    return m_ParseCache.stats();
+}
+
+size_t CSpreadsheet::stringCount() const {
+    return m_Sheet.strings().size();
+}
+
+void CSpreadsheet::releaseStrings() {
+    CStringPool &strings = m_Sheet.strings();
+    if (strings.sweepDue())
+        strings.sweep();
+}
+
+void CSpreadsheet::replaceSheet(CGrid &&sheet, std::shared_ptr<CFormulaPool> formulas) {
+    m_File.reset();
+    m_Unparsed.reset();
+    m_ParseErrors.clear();
+    // the cached templates hold strings of the replaced sheet
+    m_ParseCache.clear();
+    m_Sheet = std::move(sheet);
+    m_Formulas = std::move(formulas);
+    m_Dependents.clear();
+    m_LargeRanges.clear();
+    std::vector<CPos> cells, flipped;
+    m_Sheet.forEach([&](const CPos &pos, CCell &cell) {
+        cell.m_IsCached = false;
+        linkCell(pos);
+        cells.push_back(pos);
+    });
+    updateCycles(cells, flipped);
+}
+
 bool CSpreadsheet::save(std::ostream &os) const {
-    auto size = m_Sheet.size();
-    os.write(reinterpret_cast<const char *>(&size), sizeof(size));
-    for (const auto &[pos, cell]: m_Sheet) {
-        if (!pos.saveBinary(os)) return false; // Serialize position
-        if (!cell.saveBinary(os)) return false; // Serialize cell contents
+    auto lock = lockReads({});
+    if (hasPending()) {
+        // pending cells are saved from a copy that materializes them
+        CSpreadsheet copy(*this);
+        copy.materializeAll();
+        return copy.save(os);
+    }
+    return CSheetFile::write(os, m_Sheet);
+}
+
+bool CSpreadsheet::save(const std::string &path) const {
+    // a mapping of the old file keeps its content once the name refers to the new one, truncating it would not
+    std::string temporary = path + ".tmp";
+    std::ofstream os(temporary, std::ios::binary | std::ios::trunc);
+    bool saved = os && save(os);
+    os.close();
+    std::error_code error;
+    if (saved && os)
+        std::filesystem::rename(temporary, path, error);
+    if (!saved || !os || error) {
+        std::filesystem::remove(temporary, error);
+        return false;
     }
     return true;
 }
 
 bool CSpreadsheet::setCell(CPos pos, std::string contents) {
+    m_Arena.reset();
+    releaseStrings();
+    std::vector<COperation *> stack;
+    CCell cell;
     // Check for formula (starts with '=')
     if (contents.starts_with('=')) {
-        try {
-            CMyExpressionBuilder builder;
-            parseExpression(contents, builder);
-            m_Sheet[pos].m_Stack = builder.getStack();
-        } catch (const std::exception &e) {
+        if (m_LazyParsing && !hasDependents(pos)) {
+            // no cell in the sheet references the formula, it cannot affect any until it is parsed
+            discardPending(pos);
+            unlinkCell(pos);
+            m_Sheet.erase(pos);
+            m_Unparsed.edit()[pos] = std::move(contents);
+            m_Reads.m_Settled.store(false, std::memory_order_relaxed);
+            return true;
+        }
+        if (!compileFormula(contents, pos, cell)) {
             std::cout << "Invalid formula" << std::endl;
             return false;
         }
@@ -1486,83 +7515,650 @@ bool CSpreadsheet::setCell(CPos pos, std::string contents) {
             double numericValue = std::stod(contents, &idx);
             if (idx == contents.length()) {
                 // Store as a number
-                m_Sheet[pos].m_Stack.push_back(std::make_shared<CNumber>(numericValue));
+                discardPending(pos);
+                bool touchesCycles = inCycle(pos);
+                unlinkCell(pos);
+                m_Sheet.setNumber(pos, numericValue);
+                if (m_InBatch)
+                    m_BatchCells.push_back(pos);
+                else if (touchesCycles)
+                    refresh(std::span<const CPos>(&pos, 1));
+                else
+                    invalidate(pos);
+                return true;
             } else {
                 // Store as a string
-                m_Sheet[pos].m_Stack.push_back(std::make_shared<CString>(contents));
+                stack.push_back(m_Arena.make<CString>(contents));
             }
         } catch (const std::exception &e) {
             // Store as a string
-            m_Sheet[pos].m_Stack.push_back(std::make_shared<CString>(contents));
+            stack.push_back(m_Arena.make<CString>(contents));
         }
     }
+    // formulas are compiled already
+    if (!stack.empty() && !cell.compile(stack, pos, *m_Formulas, m_Sheet.strings())) return false;
+    // a cycle through the cell needs references into it, before or after the change
+    std::vector<CPos> refs;
+    std::vector<CRange> ranges;
+    cell.getReferences(refs);
+    cell.getRanges(ranges);
+    if (hasPending()) {
+        discardPending(pos);
+        materialize(refs, ranges);
+    }
+    bool touchesCycles = inCycle(pos) || !refs.empty() || !ranges.empty();
+    unlinkCell(pos);
+    m_Sheet[pos] = std::move(cell);
+    if (m_InBatch) {
+        m_BatchCells.push_back(pos);
+        return true;
+    }
+    linkCell(pos);
+    if (touchesCycles)
+        refresh(std::span<const CPos>(&pos, 1));
+    else
+        invalidate(pos);
     return true;
 }
 
+bool CSpreadsheet::inCycle(const CPos &pos) const {
+    const CCell *cell = m_Sheet.find(pos);
+    return cell && cell->m_InCycle;
+}
+
+void CSpreadsheet::beginBatch() {
+    m_InBatch = true;
+}
+
+void CSpreadsheet::commit() {
+    if (!m_InBatch) return;
+    m_InBatch = false;
+    if (hasPending()) {
+        // formulas written later in the batch may have been deferred although written cells reference them
+        std::vector<CPos> refs;
+        std::vector<CRange> ranges;
+        for (const auto &pos: m_BatchCells)
+            if (const CCell *cell = m_Sheet.find(pos)) {
+                cell->getReferences(refs);
+                cell->getRanges(ranges);
+            }
+        materialize(refs, ranges);
+    }
+    // a cell written twice is linked once, linking is idempotent
+    for (const auto &pos: m_BatchCells)
+        linkCell(pos);
+    refresh(m_BatchCells);
+    m_BatchCells.clear();
+    m_BatchCells.shrink_to_fit();
+}
+
 CValue CSpreadsheet::getValue(CPos pos) {
-    // Check if the cell exists in the map
-    auto it = m_Sheet.find(pos);
-    if (it != m_Sheet.end() && !it->second.m_Stack.empty()) {
-//            m_Sheet[pos].m_IsCalculated = true;
-//        std::cout << "Calculating...\n";
-        return it->second.calculateCell(m_Sheet);
+    if (hasPending())
+        materialize(std::span<const CPos>(&pos, 1));
+    return calculate(pos);
+}
+
+CValue CSpreadsheet::calculate(const CPos &pos) {
+    // Check if the cell exists in the map, the tile is not changed unless a value is cached in it
+    const double *number;
+    const CCell *cell = std::as_const(m_Sheet).lookup(pos, number);
+    if (number)
+        return *number;
+    if (cell && cell->hasFormula()) {
+        CEvaluation evaluation(m_Sheet);
+        CValue value = cell->calculateCell(evaluation).toValue();
+        evaluation.flush();
+        return value;
     }
     // Return undefined if the cell does not exist
     return std::monostate{};
 }
 
+CValue CSpreadsheet::getValue(CPos pos) const {
+    auto lock = lockReads(std::span<const CPos>(&pos, 1));
+    const double *number;
+    const CCell *cell = m_Sheet.lookup(pos, number);
+    if (number)
+        return *number;
+    if (cell && cell->hasFormula()) {
+        CEvaluation evaluation(m_Sheet);
+        return cell->calculateCell(evaluation).toValue();
+    }
+    return std::monostate{};
+}
+
+bool CSpreadsheet::getValues(std::span<const CPos> positions, std::span<CValue> values) {
+    if (values.size() < positions.size()) return false;
+    if (hasPending())
+        materialize(positions);
+    // one evaluation for the whole batch, a cell reached from several positions is calculated once
+    CEvaluation evaluation(m_Sheet);
+    for (size_t i = 0; i < positions.size(); i++) {
+        const double *number;
+        const CCell *cell = std::as_const(m_Sheet).lookup(positions[i], number);
+        if (number)
+            values[i] = *number;
+        else if (cell && cell->hasFormula())
+            values[i] = cell->calculateCell(evaluation).toValue();
+        else
+            values[i] = CValue();
+    }
+    evaluation.flush();
+    return true;
+}
+
+bool CSpreadsheet::getRect(CPos topLeft, int w, int h, std::span<CValue> values) {
+    if (w <= 0 || h <= 0) return true;
+    if (values.size() < static_cast<size_t>(w) * h) return false;
+    std::fill_n(values.begin(), static_cast<size_t>(w) * h, CValue());
+    auto at = [&](const CPos &pos) -> CValue & {
+        return values[static_cast<size_t>(pos.m_Row - topLeft.m_Row) * w + (pos.m_Column - topLeft.m_Column)];
+    };
+    CRange rect(CPos(topLeft.m_Row, topLeft.m_Column), CPos(topLeft.m_Row + h - 1, topLeft.m_Column + w - 1));
+    if (hasPending())
+        materialize({}, std::span<const CRange>(&rect, 1));
+    CEvaluation evaluation(m_Sheet);
+    m_Sheet.forEachEntryInRange(rect, [&](const CPos &pos, double number) {
+        at(pos) = number;
+    }, [&](const CPos &pos, const CCell &cell) {
+        if (cell.hasFormula())
+            at(pos) = cell.calculateCell(evaluation).toValue();
+    });
+    evaluation.flush();
+    return true;
+}
+
 void CSpreadsheet::copyRect(CPos dst, CPos src, int w, int h) {
+    if (hasPending() && w > 0 && h > 0) {
+        // the source is materialized before the pending destination is dropped, they may overlap
+        CRange source(CPos(src.m_Row, src.m_Column), CPos(src.m_Row + h - 1, src.m_Column + w - 1));
+        materialize({}, std::span<const CRange>(&source, 1));
+        if (hasPending())
+            for (int x = 0; x < w; x++)
+                for (int y = 0; y < h; y++)
+                    discardPending(CPos(dst.m_Row + y, dst.m_Column + x));
+    }
 
-    // Calculate offset between source and destination
-    int rowOffset = dst.m_Row - src.m_Row;
-    int columnOffset = dst.m_Column - src.m_Column;
-
-    std::map < CPos, CCell > newSheet;
-    // Copy cells from source to destination
-    for (int x = 0; x < w; x++) {
-        for (int y = 0; y < h; y++) {
-            CPos srcPos = {src.m_Row + y, src.m_Column + x};
-            CPos dstPos = {dst.m_Row + y, dst.m_Column + x};
-
-            // Check if the source cell exists
-            auto it = m_Sheet.find(srcPos);
-            if (it != m_Sheet.end()) {
-                // Copy the cell to the destination
-                newSheet[dstPos].m_Stack.clear();
-                for (const auto &operation: it->second.m_Stack) {
-                    newSheet[dstPos].m_Stack.push_back(operation->clone());
-                }
+    // like memmove, cells are copied starting at the side the destination is moved to, so every source cell is read
+    // before it is overwritten
+    int rowStep = dst.m_Row > src.m_Row ? -1 : 1;
+    int columnStep = dst.m_Column > src.m_Column ? -1 : 1;
+    int firstRow = rowStep > 0 ? 0 : h - 1, firstColumn = columnStep > 0 ? 0 : w - 1;
+    auto forEachCell = [&](auto &&fn) {
+        for (int y = firstRow; y >= 0 && y < h; y += rowStep)
+            for (int x = firstColumn; x >= 0 && x < w; x += columnStep)
+                fn(CPos(src.m_Row + y, src.m_Column + x), CPos(dst.m_Row + y, dst.m_Column + x));
+    };
+
+    if (hasPending()) {
+        std::vector<CPos> refs;
+        std::vector<CRange> ranges;
+        forEachCell([&](const CPos &srcPos, const CPos &dstPos) {
+            if (const CCell *cell = m_Sheet.find(srcPos); cell && cell->m_Formula) {
+                cell->m_Formula->getReferences(dstPos, refs);
+                cell->m_Formula->getRanges(dstPos, ranges);
+            }
+        });
+        materialize(refs, ranges);
+    }
 
-                // Update the cell reference in the formula
-                for (auto &operation: newSheet[dstPos].m_Stack)
-                    if (auto reference = std::dynamic_pointer_cast<CReference>(operation))
-                        reference->setCPos(rowOffset, columnOffset);
-            } else {
-                // Clear the destination cell if the source cell does not exist
-                newSheet[dstPos].m_Stack.clear();
+    // formulas and cells leaving a cycle need the cycles updated, the rest only invalidates its dependents
+    std::vector<CPos> changed, invalidated;
+    forEachCell([&](const CPos &srcPos, const CPos &dstPos) {
+        const double *number;
+        const CCell *cell = m_Sheet.lookup(srcPos, number);
+        const double *dstNumber;
+        if (!number && !cell && !m_Sheet.lookup(dstPos, dstNumber) && !dstNumber)
+            return;
+        (inCycle(dstPos) || cell ? changed : invalidated).push_back(dstPos);
+        if (number) {
+            // Numeric literals have no references to update
+            double value = *number;
+            unlinkCell(dstPos);
+            m_Sheet.setNumber(dstPos, value);
+        } else if (cell) {
+            // Share the formula template, its relative references follow the position of the cell
+            CCell copy;
+            copy.m_Formula = cell->m_Formula;
+            copy.m_Pos = dstPos;
+            unlinkCell(dstPos);
+            m_Sheet[dstPos] = std::move(copy);
+            linkCell(dstPos);
+        } else {
+            // Clear the destination cell if the source cell does not exist
+            unlinkCell(dstPos);
+            m_Sheet.erase(dstPos);
+        }
+    });
+    refresh(changed);
+    invalidate(invalidated);
+}
+
+void CSpreadsheet::linkCell(const CPos &pos) {
+    const CCell *cell = std::as_const(m_Sheet).find(pos);
+    if (!cell) return;
+    std::vector<CPos> refs;
+    cell->getReferences(refs);
+    for (const auto &ref: refs)
+        m_Dependents[CGrid::tileKey(ref.m_Row, ref.m_Column)].m_Cells[CGrid::cellKey(ref)].insert(pos);
+    std::vector<CRange> ranges;
+    cell->getRanges(ranges);
+    std::vector<uint64_t> keys;
+    for (const auto &range: ranges) {
+        keys.clear();
+        if (rangeTiles(range, keys)) {
+            for (uint64_t key: keys)
+                m_Dependents[key].m_Ranges.emplace(pos, range);
+            continue;
+        }
+        rangeColumns(range, keys);
+        for (uint64_t key: keys)
+            m_LargeRanges[key].emplace(pos, range);
+    }
+}
+
+void CSpreadsheet::unlinkCell(const CPos &pos) {
+    const CCell *cell = std::as_const(m_Sheet).find(pos);
+    if (!cell) return;
+    auto dropEmpty = [&](uint64_t key, const CDependents &dependents) {
+        if (dependents.m_Cells.empty() && dependents.m_Ranges.empty())
+            m_Dependents.erase(key);
+    };
+    std::vector<CPos> refs;
+    cell->getReferences(refs);
+    for (const auto &ref: refs) {
+        uint64_t key = CGrid::tileKey(ref.m_Row, ref.m_Column);
+        CDependents *dependents = m_Dependents.edit(key);
+        if (!dependents) continue;
+        auto dep = dependents->m_Cells.find(CGrid::cellKey(ref));
+        if (dep == dependents->m_Cells.end()) continue;
+        dep->second.erase(pos);
+        if (dep->second.empty())
+            dependents->m_Cells.erase(dep);
+        dropEmpty(key, *dependents);
+    }
+    std::vector<CRange> ranges;
+    cell->getRanges(ranges);
+    // all ranges of the cell are dropped with the first range overlapping a tile, the tiles shared with copies are
+    // changed only if they list the cell
+    std::vector<uint64_t> keys;
+    for (const auto &range: ranges) {
+        keys.clear();
+        if (rangeTiles(range, keys)) {
+            for (uint64_t key: keys) {
+                const CDependents *found = std::as_const(m_Dependents).find(key);
+                if (!found || !found->m_Ranges.count(pos)) continue;
+                CDependents &dependents = *m_Dependents.edit(key);
+                dependents.m_Ranges.erase(pos);
+                dropEmpty(key, dependents);
+            }
+            continue;
+        }
+        rangeColumns(range, keys);
+        for (uint64_t key: keys) {
+            const CRangeDependents *found = std::as_const(m_LargeRanges).find(key);
+            if (!found || !found->count(pos)) continue;
+            CRangeDependents &dependents = *m_LargeRanges.edit(key);
+            dependents.erase(pos);
+            if (dependents.empty())
+                m_LargeRanges.erase(key);
+        }
+    }
+}
+
+bool CSpreadsheet::rangeTiles(const CRange &range, std::vector<uint64_t> &keys) {
+    int top = range.top() >> CGrid::TILE_BITS, bottom = range.bottom() >> CGrid::TILE_BITS;
+    int left = range.left() >> CGrid::TILE_BITS, right = range.right() >> CGrid::TILE_BITS;
+    if ((int64_t(bottom) - top + 1) * (int64_t(right) - left + 1) > MAX_INDEXED_RANGE_TILES)
+        return false;
+    for (int row = top; row <= bottom; row++)
+        for (int column = left; column <= right; column++)
+            keys.push_back(CGrid::tileKey(row << CGrid::TILE_BITS, column << CGrid::TILE_BITS));
+    return true;
+}
+
+void CSpreadsheet::rangeColumns(const CRange &range, std::vector<uint64_t> &keys) {
+    int left = range.left(), right = range.right();
+    if (int64_t(right) - left + 1 > MAX_INDEXED_RANGE_TILES) {
+        keys.push_back(WIDE_RANGES);
+        return;
+    }
+    for (int column = left; column <= right; column++)
+        keys.push_back(static_cast<uint32_t>(column));
+}
+
+template<typename F>
+void CSpreadsheet::forEachDependent(const CPos &pos, F &&fn) const {
+    if (const CDependents *dependents = m_Dependents.find(CGrid::tileKey(pos.m_Row, pos.m_Column))) {
+        auto dep = dependents->m_Cells.find(CGrid::cellKey(pos));
+        if (dep != dependents->m_Cells.end())
+            for (const auto &dependent: dep->second)
+                fn(dependent);
+        for (const auto &[dependent, range]: dependents->m_Ranges)
+            if (range.contains(pos))
+                fn(dependent);
+    }
+    if (!m_LargeRanges.size()) return;
+    for (uint64_t key: {uint64_t(static_cast<uint32_t>(pos.m_Column)), WIDE_RANGES})
+        if (const CRangeDependents *dependents = m_LargeRanges.find(key))
+            for (const auto &[dependent, range]: *dependents)
+                if (range.contains(pos))
+                    fn(dependent);
+}
+
+template<typename F>
+void CSpreadsheet::forEachPrecedent(const CPos &pos, F &&fn) const {
+    const CCell *cell = m_Sheet.find(pos);
+    if (!cell || !cell->hasFormula()) return;
+    std::vector<CPos> refs;
+    cell->getReferences(refs);
+    for (const auto &ref: refs)
+        fn(ref);
+    std::vector<CRange> ranges;
+    cell->getRanges(ranges);
+    for (const auto &range: ranges)
+        m_Sheet.forEachInRange(range, [](const double *, uint64_t) {}, [&](const CPos &inner, const CCell &) {
+            fn(inner);
+        });
+}
+
+void CSpreadsheet::updateCycles(std::span<const CPos> changed, std::vector<CPos> &flipped) {
+    auto key = CGrid::cellKey;
+    // cells seen by the search along the dependents and by the one along the precedents are marked per tile, with
+    // a row mask for every column of the tile and search, the next cell of a chain mostly lies in the same tile
+    constexpr int SIZE = CGrid::TILE_SIZE, DEPENDENTS = 0, PRECEDENTS = 1;
+    using CMarks = std::array<uint64_t, 2 * SIZE>;
+    std::unordered_map<uint64_t, CMarks> marks;
+    uint64_t lastTile = ~uint64_t(0);
+    CMarks *last = nullptr;
+    auto mask = [&](const CPos &pos, int side) -> uint64_t & {
+        if (uint64_t tile = CGrid::tileKey(pos.m_Row, pos.m_Column); tile != lastTile) {
+            last = &marks[tile];
+            lastTile = tile;
+        }
+        return (*last)[side * SIZE + (pos.m_Column & (SIZE - 1))];
+    };
+    auto bit = [](const CPos &pos) { return uint64_t(1) << (pos.m_Row & (SIZE - 1)); };
+    auto seen = [&](const CPos &pos, int side) { return (mask(pos, side) & bit(pos)) != 0; };
+    // marks the cell, returns false if it was marked already
+    auto mark = [&](const CPos &pos, int side) {
+        uint64_t &bits = mask(pos, side);
+        if (bits & bit(pos)) return false;
+        bits |= bit(pos);
+        return true;
+    };
+
+    std::vector<CPos> dependents, precedents;
+    for (const auto &pos: changed)
+        if (mark(pos, DEPENDENTS)) {
+            mark(pos, PRECEDENTS);
+            dependents.push_back(pos);
+            precedents.push_back(pos);
+        }
+    // the searches meet on every cycle through a changed cell, the last step of one of them reaches a cell the
+    // other one has seen
+    bool met = false;
+    auto step = [&](std::vector<CPos> &stack, int side, auto &&forEach) {
+        CPos pos = stack.back();
+        stack.pop_back();
+        forEach(pos, [&](const CPos &next) {
+            met = met || seen(next, 1 - side);
+            if (mark(next, side))
+                stack.push_back(next);
+        });
+    };
+    auto forEachDependentOf = [&](const CPos &pos, auto &&fn) { forEachDependent(pos, fn); };
+    auto forEachPrecedentOf = [&](const CPos &pos, auto &&fn) { forEachPrecedent(pos, fn); };
+    while (!dependents.empty() && !precedents.empty()) {
+        step(dependents, DEPENDENTS, forEachDependentOf);
+        step(precedents, PRECEDENTS, forEachPrecedentOf);
+    }
+    // without a new cycle and without a marked cell next to a changed one, which every cycle broken by the change
+    // has, no cell flips, the changed cells are written unmarked
+    bool marked = false;
+    for (const auto &pos: changed)
+        forEachDependent(pos, [&](const CPos &dependent) { marked = marked || inCycle(dependent); });
+    if (!met && !marked) return;
+
+    // with the precedents complete, the examined cells are those reachable from the changed ones within the
+    // precedents, which closes the cycles through the changed cells, and the marked cells reachable from them
+    bool restricted = !dependents.empty();
+    std::unordered_set<uint64_t> region;
+    if (restricted) {
+        std::vector<CPos> stack;
+        for (const auto &pos: changed)
+            if (region.insert(key(pos)).second)
+                stack.push_back(pos);
+        while (!stack.empty()) {
+            CPos pos = stack.back();
+            stack.pop_back();
+            forEachDependent(pos, [&](const CPos &dependent) {
+                if (!seen(dependent, PRECEDENTS) && !inCycle(dependent)) return;
+                if (region.insert(key(dependent)).second)
+                    stack.push_back(dependent);
+            });
+        }
+    }
+
+    struct CNode {
+        int m_Index;
+        int m_Low;
+        bool m_OnStack = true;
+    };
+
+    // a visit is a suspended step of the depth-first search, walking the dependents of one cell, the dependents of
+    // the visits on the stack lie in one buffer in the order of the visits
+    struct CVisit {
+        CPos m_Pos;
+        size_t m_Next;
+        size_t m_At;
+    };
+
+    std::unordered_map<uint64_t, CNode> nodes;
+    nodes.reserve(changed.size());
+    std::vector<CPos> component, next;
+    std::vector<CVisit> visits;
+    int counter = 0;
+    auto enter = [&](const CPos &pos) {
+        nodes.emplace(key(pos), CNode{counter, counter});
+        counter++;
+        component.push_back(pos);
+        visits.push_back({pos, next.size(), next.size()});
+        forEachDependent(pos, [&](const CPos &dependent) {
+            if (!restricted || region.count(key(dependent)))
+                next.push_back(dependent);
+        });
+    };
+
+    for (const auto &start: changed) {
+        if (nodes.count(key(start))) continue;
+        enter(start);
+        while (!visits.empty()) {
+            CVisit &visit = visits.back();
+            CNode &node = nodes.at(key(visit.m_Pos));
+            // the dependents of the visits above have been popped, so the ones of this visit end the buffer
+            if (visit.m_At < next.size()) {
+                CPos dependent = next[visit.m_At++];
+                auto it = nodes.find(key(dependent));
+                if (it == nodes.end())
+                    enter(dependent);
+                else if (it->second.m_OnStack)
+                    node.m_Low = std::min(node.m_Low, it->second.m_Index);
+                continue;
+            }
+
+            CPos pos = visit.m_Pos;
+            auto isPos = [&](const CPos &other) { return (other <=> pos) == 0; };
+            bool selfLoop = std::any_of(next.begin() + static_cast<ptrdiff_t>(visit.m_Next), next.end(), isPos);
+            next.resize(visit.m_Next);
+            visits.pop_back();
+            if (!visits.empty()) {
+                CNode &parent = nodes.at(key(visits.back().m_Pos));
+                parent.m_Low = std::min(parent.m_Low, node.m_Low);
             }
+            if (node.m_Low != node.m_Index) continue;
+
+            // the cell is the root of a strongly connected component, its members lie above it on the stack
+            auto root = std::find_if(component.rbegin(), component.rend(), isPos).base() - 1;
+            bool cyclic = component.end() - root > 1 || selfLoop;
+            for (auto it = root; it != component.end(); ++it) {
+                nodes.at(key(*it)).m_OnStack = false;
+                // tiles shared with copies are changed only where a cell flips
+                const CCell *cell = std::as_const(m_Sheet).find(*it);
+                if (cell && cell->m_InCycle != cyclic) {
+                    m_Sheet.find(*it)->m_InCycle = cyclic;
+                    flipped.push_back(*it);
+                }
+            }
+            component.erase(root, component.end());
         }
     }
+}
+
+void CSpreadsheet::refresh(std::span<const CPos> changed) {
+    std::vector<CPos> flipped;
+    updateCycles(changed, flipped);
+    invalidate(changed);
+    invalidate(flipped);
+}
+
+void CSpreadsheet::invalidate(const CPos &pos) {
+    invalidate(std::span<const CPos>(&pos, 1));
+}
+
+void CSpreadsheet::invalidate(std::span<const CPos> positions) {
+    std::vector<CPos> pending;
+    auto expand = [&](const CPos &current) {
+        forEachDependent(current, [&](const CPos &dependent) {
+            pending.push_back(dependent);
+        });
+    };
+
+    // the changed cells are cleared even without a cached value, their dependents may still hold one
+    for (const auto &pos: positions) {
+        if (const CCell *cell = std::as_const(m_Sheet).find(pos); cell && cell->m_IsCached)
+            m_Sheet.find(pos)->m_IsCached = false;
+        expand(pos);
+    }
+    while (!pending.empty()) {
+        CPos current = pending.back();
+        pending.pop_back();
+        const CCell *cell = std::as_const(m_Sheet).find(current);
+        // a cell without cached value has no cached dependents either
+        if (!cell || !cell->m_IsCached) continue;
+        m_Sheet.find(current)->m_IsCached = false;
+        expand(current);
+    }
+}
 
-    //Iterate map and move cells to the original map
-    for (auto &[pos, cell]: newSheet) {
-        m_Sheet[pos] = std::move(cell);
+void CSpreadsheet::recalculate(unsigned threads) {
+    materializeAll();
+    if (!threads)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    // number the cells tile by tile, a cell is found by its offset from the first cell of its tile, cells on a
+    // cycle are undefined without evaluation
+    std::vector<CCell *> cells;
+    std::vector<CPos> positions;
+    std::unordered_map<uint64_t, int> tileIds;
+    CEvaluation cycles(m_Sheet);
+    m_Sheet.forEach([&](const CPos &pos, CCell &cell) {
+        if (cell.m_InCycle)
+            cell.calculateCell(cycles);
+        tileIds.try_emplace(CGrid::tileKey(pos.m_Row, pos.m_Column), static_cast<int>(cells.size()));
+        cells.push_back(&cell);
+        positions.push_back(pos);
+    });
+    auto idOf = [&](const CPos &pos) {
+        auto tile = tileIds.find(CGrid::tileKey(pos.m_Row, pos.m_Column));
+        const CCell *cell = std::as_const(m_Sheet).find(pos);
+        if (tile == tileIds.end() || !cell) return -1;
+        return tile->second + static_cast<int>(cell - cells[tile->second]);
+    };
+    // cells written in an uncommitted batch are not linked yet, their precedents are walked instead
+    std::vector<char> unlinked(cells.size());
+    for (const auto &pos: m_BatchCells)
+        if (int id = idOf(pos); id >= 0)
+            unlinked[id] = true;
+
+    // edges between the cells to evaluate from every cell to the cells that reference it, found in the index of
+    // dependents by slices of the cells in parallel
+    constexpr size_t SLICE_CELLS = 4096;
+    size_t sliceCount = std::min<size_t>(size_t(threads) * 4, (cells.size() + SLICE_CELLS - 1) / SLICE_CELLS);
+    std::vector<std::vector<std::pair<int, int>>> sliceEdges(sliceCount);
+    std::vector<int> slices(sliceCount);
+    for (size_t i = 0; i < slices.size(); i++)
+        slices[i] = static_cast<int>(i);
+    CTaskPool::run(threads, slices, [&](int slice, auto &&) {
+        auto &edges = sliceEdges[slice];
+        auto add = [&](int from, int to) {
+            if (from >= 0 && !cells[from]->m_IsCached && !cells[to]->m_IsCached)
+                edges.emplace_back(from, to);
+        };
+        size_t first = cells.size() * slice / sliceCount, last = cells.size() * (slice + 1) / sliceCount;
+        for (size_t id = first; id < last; id++) {
+            if (cells[id]->m_IsCached) continue;
+            forEachDependent(positions[id], [&](const CPos &dependent) {
+                if (int to = idOf(dependent); to >= 0 && !unlinked[to])
+                    add(static_cast<int>(id), to);
+            });
+            if (unlinked[id])
+                forEachPrecedent(positions[id], [&](const CPos &precedent) {
+                    add(idOf(precedent), static_cast<int>(id));
+                });
+        }
+    });
+
+    // the dependents of a cell are the slice of dependents between its offset and the offset of the next cell
+    std::vector<size_t> offsets(cells.size() + 1);
+    std::vector<std::atomic<int>> precedents(cells.size());
+    for (const auto &edges: sliceEdges)
+        for (const auto &[from, to]: edges) {
+            offsets[from + 1]++;
+            precedents[to].fetch_add(1, std::memory_order_relaxed);
+        }
+    for (size_t id = 0; id < cells.size(); id++)
+        offsets[id + 1] += offsets[id];
+    std::vector<int> dependents(offsets.back());
+    std::vector<size_t> filled(offsets.begin(), offsets.end() - 1);
+    for (auto &edges: sliceEdges) {
+        for (const auto &[from, to]: edges)
+            dependents[filled[from]++] = to;
+        std::vector<std::pair<int, int>>().swap(edges);
     }
 
+    std::vector<int> ready;
+    for (size_t id = 0; id < cells.size(); id++)
+        if (!cells[id]->m_IsCached && !precedents[id])
+            ready.push_back(static_cast<int>(id));
+
+    // every evaluated cell reads only cached values, cells left with precedents are on or behind an unknown cycle
+    CTaskPool::run(threads, ready, [&](int id, auto &&push) {
+        CEvaluation evaluation(m_Sheet);
+        cells[id]->calculateCell(evaluation);
+        for (size_t edge = offsets[id]; edge < offsets[id + 1]; edge++)
+            if (int dependent = dependents[edge]; precedents[dependent].fetch_sub(1, std::memory_order_acq_rel) == 1)
+                push(dependent);
+    });
 }
 
 // *—————————————————————————————————————————————————CReference.cpp————————————————————————————————————————————————* //
 
 CReference::CReference(std::string &str) : m_Pos(str) {}
 
+CReference::CReference(const CPos &pos) : m_Pos(pos) {}
+
 CValue
-CReference::evaluate(std::deque<std::shared_ptr<COperation>> &stack, std::map<CPos, CCell> &sheet, int &depth) const {
+CReference::evaluate(const std::vector<COperation *> &stack, CGrid &sheet, int &depth) const {
     // Check if the cell exists in the map
     depth++;
-    auto it = sheet.find(m_Pos);
-    if (it != sheet.end() && !it->second.m_Stack.empty()) {
-//        std::cout << "Calculating...\n";
-        return it->second.calculateCell(sheet);
+    const double *number;
+    CCell *cell = sheet.lookup(m_Pos, number);
+    if (number)
+        return *number;
+    if (cell && cell->hasFormula()) {
+        CEvaluation evaluation(sheet);
+        return cell->calculateCell(evaluation).toValue();
     }
     // Return undefined if the cell does not exist
     return std::monostate{};
@@ -1573,14 +8169,15 @@ CPos CReference::getCPos() {
 }
 
 void CReference::setCPos(int rowOffset, int columnOffset) {
-    if (!m_Pos.m_AbsRow)
-        m_Pos.m_Row += rowOffset;
-    if (!m_Pos.m_AbsColumn)
-        m_Pos.m_Column += columnOffset;
+    m_Pos.relocate(rowOffset, columnOffset);
+}
+
+COperation *CReference::clone(CArena &arena) const {
+    return arena.make<CReference>(*this);
 }
 
-std::shared_ptr<COperation> CReference::clone() const {
-    return std::make_shared<CReference>(*this);
+void CReference::compile(CFormula &formula) const {
+    formula.emitReference(m_Pos);
 }
 
 bool CReference::saveBinary(std::ostream &os) const {
@@ -1596,44 +8193,88 @@ int CReference::getTypeId() const {
     return 13;
 }
 
+// *—————————————————————————————————————————————————CFuncCall.cpp——————————————————————————————————————————————————* //
+
+CFuncCall::CFuncCall(int function, int paramCount) : m_Function(function), m_ParamCount(paramCount) {}
+
+CValue
+CFuncCall::evaluate(const std::vector<COperation *> &stack, CGrid &sheet, int &depth) const {
+    depth++;
+    CCompactValue values[CFunction::MAX_PARAMS];
+    const CRange *ranges[CFunction::MAX_PARAMS] = {};
+    for (int i = m_ParamCount - 1; i >= 0; i--) {
+        const auto &operation = stack[stack.size() - 1 - depth];
+        if (auto range = dynamic_cast<const CValRange *>(operation))
+            ranges[i] = &range->getRange();
+        values[i] = CCompactValue::fromValue(operation->evaluate(stack, sheet, depth), sheet.strings());
+    }
+    CEvaluation evaluation(sheet);
+    return CFunctionRegistry::get(m_Function).m_Evaluate(values, ranges, evaluation).toValue();
+}
+
+COperation *CFuncCall::clone(CArena &arena) const {
+    return arena.make<CFuncCall>(*this);
+}
+
+void CFuncCall::compile(CFormula &formula) const {
+    formula.emitCall(m_Function, m_ParamCount);
+}
+
+bool CFuncCall::saveBinary(std::ostream &os) const {
+    os.write(reinterpret_cast<const char *>(&m_Function), sizeof(m_Function));
+    os.write(reinterpret_cast<const char *>(&m_ParamCount), sizeof(m_ParamCount));
+    return os.good();
+}
+
+bool CFuncCall::loadBinary(std::istream &is) {
+    is.read(reinterpret_cast<char *>(&m_Function), sizeof(m_Function));
+    is.read(reinterpret_cast<char *>(&m_ParamCount), sizeof(m_ParamCount));
+    return is.good() && m_Function >= 0 && m_Function < CFunctionRegistry::size()
+           && m_ParamCount == CFunctionRegistry::get(m_Function).m_ParamCount;
+}
+
+int CFuncCall::getTypeId() const {
+    return 17;
+}
+
 // *—————————————————————————————————————————————————COperation.cpp————————————————————————————————————————————* //
 
-std::shared_ptr<COperation> COperation::createOperationFromType(int typeId) {
+COperation *COperation::createOperationFromType(int typeId, CArena &arena) {
     switch (typeId) {
         case 1:
-            return std::make_shared<CAddition>();
+            return arena.make<CAddition>();
         case 2:
-            return std::make_shared<CSubtraction>();
+            return arena.make<CSubtraction>();
         case 3:
-            return std::make_shared<CMultiplication>();
+            return arena.make<CMultiplication>();
         case 4:
-            return std::make_shared<CDivision>();
+            return arena.make<CDivision>();
         case 5:
-            return std::make_shared<CPower>();
+            return arena.make<CPower>();
         case 6:
-            return std::make_shared<CNegation>();
+            return arena.make<CNegation>();
         case 7:
-            return std::make_shared<CEqual>();
+            return arena.make<CEqual>();
         case 8:
-            return std::make_shared<CNotEqual>();
+            return arena.make<CNotEqual>();
         case 9:
-            return std::make_shared<CLessThan>();
+            return arena.make<CLessThan>();
         case 10:
-            return std::make_shared<CLessEqual>();
+            return arena.make<CLessEqual>();
         case 11:
-            return std::make_shared<CGreaterThan>();
+            return arena.make<CGreaterThan>();
         case 12:
-            return std::make_shared<CGreaterEqual>();
+            return arena.make<CGreaterEqual>();
         case 13:
-            return std::make_shared<CReference>();
+            return arena.make<CReference>();
         case 14:
-            return std::make_shared<CNumber>();
+            return arena.make<CNumber>();
         case 15:
-            return std::make_shared<CString>();
+            return arena.make<CString>();
         case 16:
-            return std::make_shared<CValRange>();
+            return arena.make<CValRange>();
         case 17:
-            return std::make_shared<CFuncCall>();
+            return arena.make<CFuncCall>();
         default:
             return nullptr;
     }
@@ -1641,24 +8282,38 @@ std::shared_ptr<COperation> COperation::createOperationFromType(int typeId) {
 }
 
 // *—————————————————————————————————————————————————CCell.cpp————————————————————————————————————————————* //
-bool CCell::loadBinary(std::istream &is) {
+bool CCell::loadBinary(std::istream &is, CArena &arena, const CPos &pos, CFormulaPool &pool,
+                       CStringPool &strings) {
     size_t stackSize;
     is.read(reinterpret_cast<char *>(&stackSize), sizeof(stackSize));
-    m_Stack.clear();
+    std::vector<COperation *> stack;
+    bool lost = false;
 
     for (size_t i = 0; i < stackSize; ++i) {
         int typeId;
         is.read(reinterpret_cast<char *>(&typeId), sizeof(typeId));
 
-        auto op = COperation::createOperationFromType(typeId);
-        if (!op || !op->loadBinary(is)) return false;
+        auto op = COperation::createOperationFromType(typeId, arena);
+        if (!op) return false;
+        // the first release saved ranges and function calls without operands
+        if (typeId == 16 || typeId == 17) {
+            lost = true;
+            continue;
+        }
+        if (!op->loadBinary(is)) return false;
 
-        m_Stack.push_back(op);
+        stack.push_back(op);
     }
 
-    is.read(reinterpret_cast<char *>(&m_IsCalculated), sizeof(m_IsCalculated));
+    bool isCalculated;
+    is.read(reinterpret_cast<char *>(&isCalculated), sizeof(isCalculated));
+    if (!is) return false;
 
-    return true;
+    // the range and the function were never saved, the formula was undefined in that release and stays so
+    if (lost)
+        stack = {arena.make<CNumber>(0.0), arena.make<CNumber>(0.0), arena.make<CDivision>()};
+
+    return compile(stack, pos, pool, strings);
 }
 
 // *—————————————————————————————————————————————————PROGTEST——————————————————————————————————————————————————————* //
@@ -1681,6 +8336,462 @@ bool valueMatch(const CValue &r,
     return fabs(std::get<double>(r) - std::get<double>(s)) <= 1e8 * DBL_EPSILON * fabs(std::get<double>(r));
 }
 
+#ifdef SPREADSHEET_BENCHMARK
+
+// *—————————————————————————————————————————————————Benchmark——————————————————————————————————————————————————————* //
+
+/**
+ * Measure average time of a callable in nanoseconds.
+ * @param iterations - number of calls
+ * @param fn - measured callable
+ * @return - nanoseconds per call
+ */
+template<typename F>
+static double measureNs(size_t iterations, F &&fn) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++)
+        fn();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+}
+
+/**
+ * Get the number of bytes allocated from the heap and not freed.
+ * @return - allocated bytes
+ */
+static size_t heapBytes() {
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+/**
+ * Format a position the way formulas reference it.
+ * @param row - row
+ * @param column - column
+ * @return - name of the cell, for example "AB12"
+ */
+static std::string cellName(int row, int column) {
+    std::string letters;
+    for (column++; column > 0; column = (column - 1) / 26)
+        letters.insert(letters.begin(), static_cast<char>('A' + (column - 1) % 26));
+    return letters + std::to_string(row);
+}
+
+/**
+ * Compare the operation tree with the compiled formula on a single expression.
+ * @param name - name of the case
+ * @param expr - formula text
+ * @param sheet - cells referenced by the formula
+ * @param iterations - number of evaluations
+ */
+static void benchmarkFormula(const std::string &name, const std::string &expr, CGrid &sheet,
+                             size_t iterations) {
+    CArena arena;
+    CFormulaPool pool;
+    CMyExpressionBuilder builder(arena);
+    parseExpression(expr, builder);
+    const auto &stack = builder.getStack();
+    CCell cell;
+    cell.compile(stack, CPos(0, 0), pool, sheet.strings());
+
+    volatile double sink = 0;
+    double treeNs = measureNs(iterations, [&]() {
+        int depth = 0;
+        CValue value = stack.back()->evaluate(stack, sheet, depth);
+        sink = sink + std::get<double>(value);
+    });
+    double codeNs = measureNs(iterations, [&]() {
+        sink = sink + cell.m_Formula->evaluate(sheet, cell.m_Pos).number();
+    });
+    std::cout << std::left << std::setw(16) << name << std::right
+              << std::setw(8) << stack.size() << " ops"
+              << std::setw(12) << std::fixed << std::setprecision(1) << treeNs << " ns tree"
+              << std::setw(12) << codeNs << " ns bytecode"
+              << std::setw(8) << std::setprecision(2) << treeNs / codeNs << "x" << std::endl;
+}
+
+/**
+ * Synthetic sheet shape of the workload suite.
+ */
+struct CWorkload {
+    const char *m_Name;
+
+    /**
+     * Fill an empty spreadsheet with about the given number of cells.
+     * @param sheet - empty spreadsheet
+     * @param cells - number of cells
+     * @return - range holding all written cells
+     */
+    CRange (*m_Generate)(CSpreadsheet &sheet, int cells);
+};
+
+/**
+ * Long chain: every cell of a column adds one to the cell above it.
+ */
+static CRange generateChain(CSpreadsheet &sheet, int cells) {
+    sheet.setCell(CPos(1, 0), "1");
+    for (int row = 2; row <= cells; row++)
+        sheet.setCell(CPos(row, 0), "=" + cellName(row - 1, 0) + " + 1");
+    return CRange(CPos(1, 0), CPos(cells, 0));
+}
+
+/**
+ * Diamonds: every row splits the value of the row above into two cells and joins them again.
+ */
+static CRange generateDiamonds(CSpreadsheet &sheet, int cells) {
+    int rows = std::max(1, cells / 3);
+    sheet.setCell(CPos(1, 0), "1");
+    for (int row = 2; row <= rows; row++) {
+        std::string above = cellName(row - 1, 0);
+        sheet.setCell(CPos(row, 1), "=" + above + " * 0.5");
+        sheet.setCell(CPos(row, 2), "=" + above + " + 1");
+        sheet.setCell(CPos(row, 0), "=(" + cellName(row, 1) + " + " + cellName(row, 2) + ") / 2");
+    }
+    return CRange(CPos(1, 0), CPos(rows, 2));
+}
+
+/**
+ * Wide fan-in: one cell sums a column of formulas over a column of literals.
+ */
+static CRange generateFanIn(CSpreadsheet &sheet, int cells) {
+    int rows = std::max(1, (cells - 1) / 2);
+    for (int row = 1; row <= rows; row++) {
+        sheet.setCell(CPos(row, 0), std::to_string(row % 100));
+        sheet.setCell(CPos(row, 1), "=" + cellName(row, 0) + " * 2");
+    }
+    sheet.setCell(CPos(1, 2), "=sum(" + cellName(1, 1) + ":" + cellName(rows, 1) + ")");
+    return CRange(CPos(1, 0), CPos(rows, 2));
+}
+
+/**
+ * Filled column: a formula next to a column of literals, filled down by copies of doubling height.
+ */
+static CRange generateFilledColumn(CSpreadsheet &sheet, int cells) {
+    int rows = std::max(1, cells / 2);
+    for (int row = 1; row <= rows; row++)
+        sheet.setCell(CPos(row, 0), std::to_string(row));
+    sheet.setCell(CPos(1, 1), "=" + cellName(1, 0) + " * $A$1 + 1");
+    for (int filled = 1; filled < rows; filled *= 2)
+        sheet.copyRect(CPos(1 + filled, 1), CPos(1, 1), 1, std::min(filled, rows - filled));
+    return CRange(CPos(1, 0), CPos(rows, 1));
+}
+
+/**
+ * Strings: a column of labels and a column concatenating every label with the one above it.
+ */
+static CRange generateStrings(CSpreadsheet &sheet, int cells) {
+    int rows = std::max(1, cells / 2);
+    for (int row = 1; row <= rows; row++) {
+        sheet.setCell(CPos(row, 0), "item-" + std::to_string(row % 100));
+        std::string label = cellName(row, 0);
+        sheet.setCell(CPos(row, 1), row == 1 ? "=" + label : "=" + label + " + \"/\" + " + cellName(row - 1, 0));
+    }
+    return CRange(CPos(1, 0), CPos(rows, 1));
+}
+
+/**
+ * Literals: a square grid of numbers without formulas.
+ */
+static CRange generateLiterals(CSpreadsheet &sheet, int cells) {
+    int side = std::max(1, static_cast<int>(std::sqrt(cells)));
+    for (int row = 1; row <= side; row++)
+        for (int column = 0; column < side; column++)
+            sheet.setCell(CPos(row, column), std::to_string((row * 31 + column) % 1000 * 0.5));
+    return CRange(CPos(1, 0), CPos(side, side - 1));
+}
+
+/**
+ * Run every workload at every scale up to a number of cells and write the timings as JSON. For every sheet the
+ * suite times building it, reading all its cells twice, the second time from the cached values, saving it, loading
+ * the saved file and copying all its cells next to it.
+ * @param maxCells - largest scale
+ * @param os - output stream for the JSON document
+ */
+static void runWorkloads(int maxCells, std::ostream &os) {
+    static const CWorkload WORKLOADS[] = {
+            {"chain",        generateChain},
+            {"diamonds",     generateDiamonds},
+            {"fan-in",       generateFanIn},
+            {"filled-column", generateFilledColumn},
+            {"strings",      generateStrings},
+            {"literals",     generateLiterals},
+    };
+    os << "{\n  \"hardwareThreads\": " << std::thread::hardware_concurrency() << ",\n  \"results\": [";
+    const char *separator = "\n";
+    auto result = [&](const char *workload, int cells, const char *operation, size_t count, double ns) {
+        os << separator << "    {\"workload\": \"" << workload << "\", \"cells\": " << cells
+           << ", \"operation\": \"" << operation << "\", \"count\": " << count << std::fixed << std::setprecision(1)
+           << ", \"ns\": " << ns << ", \"nsPerItem\": " << ns / std::max<size_t>(count, 1) << "}";
+        separator = ",\n";
+    };
+
+    for (const auto &workload: WORKLOADS)
+        for (int cells = 1000; cells <= maxCells; cells *= 10) {
+            CSpreadsheet sheet;
+            CRange area;
+            result(workload.m_Name, cells, "build", cells, measureNs(1, [&]() {
+                area = workload.m_Generate(sheet, cells);
+            }));
+
+            int width = area.right() - area.left() + 1, height = area.bottom() - area.top() + 1;
+            size_t positions = static_cast<size_t>(width) * height;
+            volatile size_t sink = 0;
+            auto readAll = [&]() {
+                for (int row = area.top(); row <= area.bottom(); row++)
+                    for (int column = area.left(); column <= area.right(); column++)
+                        sink = sink + sheet.getValue(CPos(row, column)).index();
+            };
+            result(workload.m_Name, cells, "getValue", positions, measureNs(1, readAll));
+            result(workload.m_Name, cells, "getValueCached", positions, measureNs(1, readAll));
+
+            std::ostringstream saved;
+            result(workload.m_Name, cells, "save", cells, measureNs(1, [&]() {
+                sheet.save(saved);
+            }));
+            std::istringstream file(saved.str());
+            CSpreadsheet loaded;
+            result(workload.m_Name, cells, "load", cells, measureNs(1, [&]() {
+                loaded.load(file);
+            }));
+
+            result(workload.m_Name, cells, "copyRect", positions, measureNs(1, [&]() {
+                sheet.copyRect(CPos(area.top(), area.right() + 1), CPos(area.top(), area.left()), width, height);
+            }));
+        }
+    os << "\n  ]\n}" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    // the workload suite alone, as JSON to compare runs
+    if (argc > 1 && std::string_view(argv[1]) == "--json") {
+        runWorkloads(argc > 2 ? std::atoi(argv[2]) : 100000, std::cout);
+        return EXIT_SUCCESS;
+    }
+
+    CGrid sheet;
+    for (int row = 0; row <= 1000; row++)
+        sheet.setNumber(CPos(row, 0), row + 1.0);
+
+    for (int ops: {10, 100, 1000}) {
+        // chained: every operator consumes the result of the previous one
+        std::string chained = "A1";
+        const char *operators = "+*-/";
+        for (int i = 0; i < ops; i++)
+            chained = "(" + chained + operators[i % 4] + std::to_string(i % 7 + 1) + ")";
+        benchmarkFormula("chained-" + std::to_string(ops), "=" + chained, sheet, 2000000 / ops);
+
+        // wide: a flat sum of many references
+        std::string wide = "=A1";
+        for (int i = 1; i < ops; i++)
+            wide += "+A" + std::to_string(i + 1);
+        benchmarkFormula("wide-" + std::to_string(ops), wide, sheet, 2000000 / ops);
+    }
+
+    // aggregate: a sum over a column of a million literals
+    constexpr int COLUMN_ROWS = 1000000;
+    for (int row = 0; row < COLUMN_ROWS; row++)
+        sheet.setNumber(CPos(row, 1), row % 100);
+    CArena arena;
+    CFormulaPool pool;
+    CMyExpressionBuilder builder(arena);
+    parseExpression("=sum(B1:B" + std::to_string(COLUMN_ROWS) + ")", builder);
+    CCell cell;
+    cell.compile(builder.getStack(), CPos(0, 0), pool, sheet.strings());
+    volatile double sink = 0;
+    double sumNs = measureNs(20, [&]() {
+        sink = sink + cell.m_Formula->evaluate(sheet, cell.m_Pos).number();
+    });
+    // the kernel alone over the same numbers in one array, the formula also walks the tiles of the range twice,
+    // once for the formulas to evaluate first and once for the numbers
+    std::vector<double> column(COLUMN_ROWS - COLUMN_ROWS % CGrid::TILE_SIZE);
+    for (size_t row = 0; row < column.size(); row++)
+        column[row] = static_cast<double>(row % 100);
+    double kernelColumnNs = measureNs(20, [&]() {
+        double sum = 0;
+        for (size_t row = 0; row < column.size(); row += CGrid::TILE_SIZE)
+            sum += CKernels::sum(&column[row], ~uint64_t(0));
+        sink = sink + sum;
+    });
+    std::cout << std::left << std::setw(16) << "sum-column" << std::right
+              << std::setw(8) << COLUMN_ROWS << " cells"
+              << std::setw(11) << std::fixed << std::setprecision(3) << sumNs / COLUMN_ROWS << " ns/cell formula"
+              << std::setw(9) << kernelColumnNs / column.size() << " ns/cell kernel" << std::endl;
+
+    // rectangles: overlapping sums over a 256x256 block, column kernels against summed-area tables
+    CGrid block;
+    for (int row = 0; row < 256; row++)
+        for (int column = 0; column < 256; column++)
+            block.setNumber(CPos(row, column), row ^ column);
+    std::vector<CRange> rects;
+    for (int i = 0; i < 64; i++)
+        rects.emplace_back(CPos(i * 3, i), CPos(i * 3 + 60, i * 2 + 100));
+    auto ignoreCell = [](const CPos &, const CCell &) {};
+    double kernelNs = measureNs(200, [&]() {
+        for (const auto &rect: rects)
+            block.forEachInRange(rect, [&](const double *numbers, uint64_t mask) {
+                sink = sink + CKernels::sum(numbers, mask);
+            }, ignoreCell);
+    });
+    double tableNs = measureNs(200, [&]() {
+        for (const auto &rect: rects) {
+            double sum = 0;
+            size_t count = 0;
+            block.sumInRange(rect, sum, count, [&](const double *numbers, uint64_t mask) {
+                sum += CKernels::sum(numbers, mask);
+            }, ignoreCell);
+            sink = sink + sum;
+        }
+    });
+    std::cout << std::left << std::setw(16) << "sum-rects" << std::right
+              << std::setw(8) << rects.size() << " rects"
+              << std::setw(11) << std::setprecision(1) << kernelNs / rects.size() << " ns kernels"
+              << std::setw(10) << tableNs / rects.size() << " ns tables"
+              << std::setw(8) << std::setprecision(2) << kernelNs / tableNs << "x" << std::endl;
+
+    // memory: heap bytes per cell of a sheet filled in one batch, for sparse layouts as well as dense blocks
+    auto measureBytes = [](const char *name, int cells, auto &&fill) {
+        size_t before = heapBytes();
+        auto *filled = new CSpreadsheet();
+        filled->beginBatch();
+        for (int i = 0; i < cells; i++)
+            fill(*filled, i);
+        filled->commit();
+        double bytes = static_cast<double>(heapBytes() - before);
+        delete filled;
+        std::cout << std::left << std::setw(16) << name << std::right
+                  << std::setw(8) << cells << " cells"
+                  << std::setw(11) << std::setprecision(1) << bytes / cells << " B/cell" << std::endl;
+    };
+    auto scattered = [](int i) {
+        return CPos(static_cast<int>(i * 7919LL % 1000003), static_cast<int>(i * 104729LL % 5000));
+    };
+    measureBytes("memory-column", 1000000, [](CSpreadsheet &filled, int i) {
+        filled.setCell(CPos(i, 0), "1.5");
+    });
+    measureBytes("memory-dense", 512 * 512, [](CSpreadsheet &filled, int i) {
+        filled.setCell(CPos(i / 512, i % 512), "3");
+    });
+    measureBytes("memory-scattered", 20000, [&](CSpreadsheet &filled, int i) {
+        filled.setCell(scattered(i), "2");
+    });
+    measureBytes("memory-formulas", 20000, [&](CSpreadsheet &filled, int i) {
+        filled.setCell(scattered(i), "=A1 + 1");
+    });
+
+    // deep chains: a running balance where every cell adds a literal to the cell above, read once from the last
+    // cell, the reference chain is as deep as the column is long
+    for (int depth: {1000, 10000, 100000, 1000000}) {
+        CSpreadsheet ledger;
+        ledger.beginBatch();
+        for (int row = 1; row <= depth; row++) {
+            ledger.setCell(CPos(row, 0), std::to_string(row % 10));
+            ledger.setCell(CPos(row, 1), row == 1 ? "=A1" : "=" + cellName(row - 1, 1) + " + " + cellName(row, 0));
+        }
+        ledger.commit();
+        double chainNs = measureNs(1, [&]() {
+            sink = sink + std::get<double>(ledger.getValue(CPos(depth, 1)));
+        });
+        std::cout << std::left << std::setw(16) << "deep-chain" << std::right
+                  << std::setw(8) << depth << " cells"
+                  << std::setw(11) << std::setprecision(1) << chainNs / depth << " ns/cell" << std::endl;
+    }
+
+    // recalculation: a block where every cell adds the cells above and to the left, one thread against all
+    CSpreadsheet model;
+    constexpr int MODEL_ROWS = 200, MODEL_COLUMNS = 100;
+    for (int row = 1; row <= MODEL_ROWS; row++)
+        for (int column = 0; column < MODEL_COLUMNS; column++) {
+            CPos pos(row, column);
+            if (row == 1 || column == 0)
+                model.setCell(pos, "1");
+            else
+                model.setCell(pos, "=" + cellName(row - 1, column) + " + " + cellName(row, column - 1) + " * 0.5");
+        }
+    unsigned hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+    auto recalculateNs = [&](unsigned threads) {
+        return measureNs(5, [&]() {
+            model.setCell(CPos(1, 1), "1");
+            model.recalculate(threads);
+        });
+    };
+    double serialNs = recalculateNs(1), parallelNs = recalculateNs(hardwareThreads);
+    std::cout << std::left << std::setw(16) << "recalculate" << std::right
+              << std::setw(8) << MODEL_ROWS * MODEL_COLUMNS << " cells"
+              << std::setw(11) << std::setprecision(1) << serialNs / 1000 << " us 1 thread"
+              << std::setw(10) << parallelNs / 1000 << " us " << hardwareThreads << " threads" << std::endl;
+
+    // concurrent readers: const reads of formulas calculated on every read, the same reads split among more threads
+    CSpreadsheet readSheet;
+    constexpr int READ_ROWS = 10000, READ_COLUMNS = 8, READS = 400000;
+    readSheet.beginBatch();
+    for (int row = 1; row <= READ_ROWS; row++) {
+        for (int column = 0; column < READ_COLUMNS; column++)
+            readSheet.setCell(CPos(row, column), std::to_string(row + column));
+        readSheet.setCell(CPos(row, READ_COLUMNS), "=sum(" + cellName(row, 0) + ":" + cellName(row, READ_COLUMNS - 1)
+                                                   + ") + " + cellName(row, 0) + " * 2");
+    }
+    readSheet.commit();
+    auto readNs = [&](const CSpreadsheet &reader, unsigned threads) {
+        return measureNs(1, [&]() {
+            std::vector<std::thread> workers;
+            for (unsigned thread = 0; thread < threads; thread++)
+                workers.emplace_back([&, thread]() {
+                    volatile double sink = 0;
+                    for (unsigned i = thread; i < READS; i += threads)
+                        sink = sink + std::get<double>(reader.getValue(CPos(i % READ_ROWS + 1, READ_COLUMNS)));
+                });
+            for (auto &worker: workers)
+                worker.join();
+        });
+    };
+    auto printReads = [&](const std::string &name, double ns, double singleNs) {
+        std::cout << std::left << std::setw(16) << name << std::right
+                  << std::setw(8) << READS << " reads"
+                  << std::setw(11) << std::setprecision(2) << READS / ns * 1000 << " M/s"
+                  << std::setw(9) << singleNs / ns << "x" << std::endl;
+    };
+    double singleReadNs = 0;
+    for (unsigned threads = 1; threads <= std::max(4u, hardwareThreads); threads *= 2) {
+        double ns = readNs(readSheet, threads);
+        if (threads == 1)
+            singleReadNs = ns;
+        printReads("read-" + std::to_string(threads) + "-threads", ns, singleReadNs);
+    }
+
+    // the same reads starting from an opened file with every cell pending, the first read of a cell materializes it
+    // for all readers
+    std::string pendingPath = (std::filesystem::temp_directory_path() / "spreadsheet_benchmark_reads.sps").string();
+    {
+        std::ofstream os(pendingPath, std::ios::binary);
+        readSheet.save(os);
+    }
+    double singlePendingNs = 0;
+    for (unsigned threads = 1; threads <= std::max(4u, hardwareThreads); threads *= 2) {
+        CSpreadsheet pendingSheet;
+        if (!pendingSheet.openMapped(pendingPath)) return EXIT_FAILURE;
+        double ns = readNs(pendingSheet, threads);
+        if (threads == 1)
+            singlePendingNs = ns;
+        printReads("opened-" + std::to_string(threads) + "-threads", ns, singlePendingNs);
+    }
+    std::filesystem::remove(pendingPath);
+    return EXIT_SUCCESS;
+}
+
+#else
+
+/**
+ * Check the result of a call made for its effect. The call is not the argument of an assert, so it is made and
+ * checked even where assertions are disabled.
+ * @param result - result of the call
+ */
+static void expect(bool result) {
+    if (!result) {
+        std::cerr << "Unexpected result of a call" << std::endl;
+        std::abort();
+    }
+}
+
 int main() {
 // *—————————————————————————————————————————————————My Tests——————————————————————————————————————————————————————* //
 
@@ -1712,6 +8823,919 @@ int main() {
     ss.setCell(CPos("I4"), "=A1 + B2 * 3");
     assert(valueMatch(ss.getValue(CPos("I4")), CValue(14.0)));
 
+    // Cached values and dependency-driven invalidation
+    CSpreadsheet diamond;
+    expect(diamond.setCell(CPos("A1"), "1"));
+    for (int row = 2; row <= 80; row++)
+        expect(diamond.setCell(CPos("A" + std::to_string(row)),
+                               "=A" + std::to_string(row - 1) + "+A" + std::to_string(row - 1)));
+    assert(valueMatch(diamond.getValue(CPos("A80")), CValue(std::pow(2.0, 79))));
+    expect(diamond.setCell(CPos("A1"), "2"));
+    assert(valueMatch(diamond.getValue(CPos("A80")), CValue(std::pow(2.0, 80))));
+    expect(diamond.setCell(CPos("B1"), "=C1"));
+    assert(valueMatch(diamond.getValue(CPos("B1")), CValue()));
+    expect(diamond.setCell(CPos("C1"), "=A1*5"));
+    assert(valueMatch(diamond.getValue(CPos("B1")), CValue(10.0)));
+    expect(diamond.setCell(CPos("C1"), "=B1"));
+    assert(valueMatch(diamond.getValue(CPos("B1")), CValue()));
+    assert(valueMatch(diamond.getValue(CPos("C1")), CValue()));
+    expect(diamond.setCell(CPos("C1"), "7"));
+    assert(valueMatch(diamond.getValue(CPos("B1")), CValue(7.0)));
+
+    // Cells spread over several tiles of the grid
+    CSpreadsheet tiles;
+    for (int row = 60; row < 70; row++)
+        expect(tiles.setCell(CPos("BL" + std::to_string(row)), std::to_string(row)));
+    expect(tiles.setCell(CPos("BM60"), "=BL60"));
+    for (int row = 61; row < 70; row++)
+        tiles.copyRect(CPos("BM" + std::to_string(row)), CPos("BM60"));
+    assert(valueMatch(tiles.getValue(CPos("BM63")), CValue(63.0)));
+    assert(valueMatch(tiles.getValue(CPos("BM64")), CValue(64.0)));
+    assert(valueMatch(tiles.getValue(CPos("BM69")), CValue(69.0)));
+    assert(valueMatch(tiles.getValue(CPos("BN64")), CValue()));
+
+    // Numeric literals replacing and replaced by other cells
+    expect(tiles.setCell(CPos("BN64"), "=BL64*2"));
+    expect(tiles.setCell(CPos("BL64"), "text"));
+    assert(valueMatch(tiles.getValue(CPos("BN64")), CValue()));
+    expect(tiles.setCell(CPos("BL64"), "2.5"));
+    assert(valueMatch(tiles.getValue(CPos("BN64")), CValue(5.0)));
+    expect(tiles.setCell(CPos("BN64"), "8"));
+    expect(tiles.setCell(CPos("BL64"), "=BN64"));
+    assert(valueMatch(tiles.getValue(CPos("BM64")), CValue(8.0)));
+    tiles.copyRect(CPos("BL65"), CPos("BN64"), 1, 1);
+    assert(valueMatch(tiles.getValue(CPos("BM65")), CValue(8.0)));
+    tiles.copyRect(CPos("BL65"), CPos("BO64"), 1, 1);
+    assert(valueMatch(tiles.getValue(CPos("BM65")), CValue()));
+
+    // Ranges and in-place range views
+    CRange range("$A$1:b$2");
+    range.relocate(3, 4);
+    assert(range.top() == 1 && range.bottom() == 2 && range.left() == 0 && range.right() == 5);
+    CGrid grid;
+    for (int row = 0; row < 200; row++)
+        grid.setNumber(CPos(row, 70), row);
+    grid[CPos(100, 70)];
+    double rangeSum = 0;
+    int rangeCells = 0;
+    grid.forEachInRange(CRange("BS50:BT150"), [&](const double *numbers, uint64_t mask) {
+        for (; mask; mask &= mask - 1)
+            rangeSum += numbers[std::countr_zero(mask)];
+    }, [&](const CPos &pos, CCell &) {
+        assert(pos.m_Row == 100);
+        rangeCells++;
+    });
+    assert(rangeSum == 10100 - 100 && rangeCells == 1);
+
+    // Sparse tiles and columns
+    CGrid sparse;
+    for (int row = 63; row >= 0; row -= 4)
+        sparse.setNumber(CPos(row, 5), row);
+    sparse.erase(CPos(31, 5));
+    assert(*sparse.findNumber(CPos(35, 5)) == 35 && !sparse.findNumber(CPos(31, 5)) && sparse.size() == 15);
+    for (int row = 1; row < 64; row += 4)
+        sparse.setNumber(CPos(row, 5), row);
+    double sparseSum = 0;
+    sparse.forEachInRange(CRange("F1:F64"), [&](const double *numbers, uint64_t mask) {
+        for (; mask; mask &= mask - 1)
+            sparseSum += numbers[std::countr_zero(mask)];
+    }, [](const CPos &, CCell &) {});
+    assert(sparseSum == 497 + 496 && *sparse.findNumber(CPos(61, 5)) == 61);
+    for (int i = 0; i < 2 * CGrid::TILE_SIZE; i++)
+        sparse[CPos(i % 8, 8 + i / 8)];
+    sparse.erase(CPos(3, 9));
+    assert(sparse.find(CPos(2, 9)) && !sparse.find(CPos(3, 9)) && sparse.find(CPos(7, 23)));
+    sparse[CPos(1, 5)];
+    assert(!sparse.findNumber(CPos(1, 5)) && sparse.find(CPos(1, 5)) && sparse.size() == 31 + 127);
+
+    // Functions over ranges
+    CSpreadsheet fn;
+    for (int row = 1; row <= 100; row++)
+        expect(fn.setCell(CPos("A" + std::to_string(row)), std::to_string(row)));
+    expect(fn.setCell(CPos("A50"), "text"));
+    expect(fn.setCell(CPos("A51"), "=A1*1000"));
+    expect(fn.setCell(CPos("A52"), "=A1/0"));
+    expect(fn.setCell(CPos("B1"), "=sum(A1:A100)"));
+    expect(fn.setCell(CPos("B2"), "=count(A1:A100)"));
+    expect(fn.setCell(CPos("B3"), "=min(A1:A100) + max($A$1:$A$100)"));
+    expect(fn.setCell(CPos("B4"), "=countval(2, A1:A100) + countval(\"text\", A1:A100)"));
+    expect(fn.setCell(CPos("B5"), "=if(B1 > 5000, \"big\", \"small\")"));
+    expect(fn.setCell(CPos("B6"), "=sum(D1:D10)"));
+    assert(valueMatch(fn.getValue(CPos("B1")), CValue(5050.0 - 50 - 51 - 52 + 1000)));
+    assert(valueMatch(fn.getValue(CPos("B2")), CValue(99.0)));
+    assert(valueMatch(fn.getValue(CPos("B3")), CValue(1001.0)));
+    assert(valueMatch(fn.getValue(CPos("B4")), CValue(2.0)));
+    assert(valueMatch(fn.getValue(CPos("B5")), CValue("big")));
+    assert(valueMatch(fn.getValue(CPos("B6")), CValue()));
+    expect(fn.setCell(CPos("A1"), "-5"));
+    assert(valueMatch(fn.getValue(CPos("B1")), CValue(5050.0 - 50 - 51 - 52 - 5000 - 6)));
+    assert(valueMatch(fn.getValue(CPos("B3")), CValue(-5000.0 + 100)));
+    assert(valueMatch(fn.getValue(CPos("B5")), CValue("small")));
+    fn.copyRect(CPos("C1"), CPos("B1"), 1, 3);
+    assert(valueMatch(fn.getValue(CPos("C3")), CValue(-4900.0 + 100)));
+    expect(!fn.setCell(CPos("B7"), "=sum(A1)"));
+    std::ostringstream fnOut;
+    expect(fn.save(fnOut));
+    std::istringstream fnIn(fnOut.str());
+    CSpreadsheet fnLoaded;
+    expect(fnLoaded.load(fnIn));
+    assert(valueMatch(fnLoaded.getValue(CPos("B4")), CValue(2.0)));
+    assert(valueMatch(fnLoaded.getValue(CPos("C1")), CValue(-109.0 + 99 - 4900 + 2)));
+    assert(valueMatch(fnLoaded.getValue(CPos("C2")), CValue(5.0)));
+
+    // Ranges too large to be indexed by tiles, tall ones by their columns and wide ones apart
+    CSpreadsheet large;
+    expect(large.setCell(CPos("B1"), "=sum(A1:A100000)"));
+    expect(large.setCell(CPos("C1"), "=count(A2:AMK100000)"));
+    assert(valueMatch(large.getValue(CPos("B1")), CValue()));
+    assert(valueMatch(large.getValue(CPos("C1")), CValue(0.0)));
+    expect(large.setCell(CPos("A99999"), "5"));
+    expect(large.setCell(CPos("A100001"), "7"));
+    expect(large.setCell(CPos("AMK50"), "1"));
+    assert(valueMatch(large.getValue(CPos("B1")), CValue(5.0)));
+    assert(valueMatch(large.getValue(CPos("C1")), CValue(2.0)));
+    expect(large.setCell(CPos("B1"), "=A1"));
+    expect(large.setCell(CPos("A5"), "3"));
+    assert(valueMatch(large.getValue(CPos("B1")), CValue()));
+    assert(valueMatch(large.getValue(CPos("C1")), CValue(3.0)));
+
+    // Summed-area tables
+    CSpreadsheet sat;
+    for (int row = 1; row <= 100; row++)
+        for (int column = 60; column < 70; column++)
+            expect(sat.setCell(CPos(row, column), std::to_string(row + column)));
+    expect(sat.setCell(CPos("A1"), "=sum(BI1:BR100)"));
+    expect(sat.setCell(CPos("A2"), "=sum(BJ60:BK70) + count(BJ60:BK70)"));
+    expect(sat.setCell(CPos("A3"), "=count(BR1:BZ200)"));
+    assert(valueMatch(sat.getValue(CPos("A1")), CValue(10.0 * 5050 + 100 * 645)));
+    assert(valueMatch(sat.getValue(CPos("A2")), CValue(2.0 * 715 + 11 * 123 + 22)));
+    expect(sat.setCell(CPos("BJ65"), "=1000"));
+    expect(sat.setCell(CPos("BR100"), "text"));
+    assert(valueMatch(sat.getValue(CPos("A2")), CValue(2.0 * 715 + 11 * 123 + 22 - 126 + 1000)));
+    assert(valueMatch(sat.getValue(CPos("A3")), CValue(100.0)));
+    CGrid infinite;
+    infinite.setNumber(CPos("A1"), std::numeric_limits<double>::infinity());
+    infinite.setNumber(CPos("A2"), 2);
+    double infiniteSum = 0;
+    size_t infiniteCount = 0;
+    infinite.sumInRange(CRange("A2:B3"), infiniteSum, infiniteCount, [&](const double *numbers, uint64_t mask) {
+        for (; mask; mask &= mask - 1, infiniteCount++)
+            infiniteSum += numbers[std::countr_zero(mask)];
+    }, [](const CPos &, const CCell &) {});
+    assert(infiniteSum == 2 && infiniteCount == 1);
+    // differences of large sums keep the small numbers
+    for (double large: {1e20, 1e11}) {
+        CSpreadsheet magnitudes;
+        for (int row = 1; row <= 64; row++)
+            for (int column = 0; column < 64; column++)
+                expect(magnitudes.setCell(CPos(row, column), row == 1 && column == 0 ? std::to_string(large) : "0.5"));
+        expect(magnitudes.setCell(CPos("BZ1"), "=sum(B2:AZ40)"));
+        expect(magnitudes.setCell(CPos("BZ2"), "=count(B2:AZ40)"));
+        assert(valueMatch(magnitudes.getValue(CPos("BZ1")), CValue(994.5)));
+        assert(valueMatch(magnitudes.getValue(CPos("BZ2")), CValue(1989.0)));
+    }
+
+    // Parallel recalculation
+    CSpreadsheet par;
+    expect(par.setCell(CPos("A1"), "1"));
+    expect(par.setCell(CPos("B1"), "0"));
+    for (int row = 2; row <= 300; row++) {
+        std::string prev = std::to_string(row - 1);
+        expect(par.setCell(CPos("A" + std::to_string(row)), "=A" + prev + " + 1"));
+        expect(par.setCell(CPos("B" + std::to_string(row)), "=A" + prev + " * 2 + B" + prev));
+    }
+    expect(par.setCell(CPos("C1"), "=sum(A1:B300)"));
+    expect(par.setCell(CPos("D1"), "=D2 + 1"));
+    expect(par.setCell(CPos("D2"), "=D1 + A1"));
+    expect(par.setCell(CPos("D3"), "=D2 + 1"));
+    par.recalculate(4);
+    assert(valueMatch(par.getValue(CPos("A300")), CValue(300.0)));
+    assert(valueMatch(par.getValue(CPos("B300")), CValue(299.0 * 300)));
+    assert(valueMatch(par.getValue(CPos("C1")), CValue(45150.0 + 299.0 * 300 * 301 / 3)));
+    assert(valueMatch(par.getValue(CPos("D1")), CValue()));
+    assert(valueMatch(par.getValue(CPos("D3")), CValue()));
+    expect(par.setCell(CPos("A1"), "2"));
+    par.recalculate(3);
+    assert(valueMatch(par.getValue(CPos("A300")), CValue(301.0)));
+    assert(valueMatch(par.getValue(CPos("C1")), CValue(45450.0 + 299.0 * 300 * 301 / 3 + 299.0 * 300)));
+
+    // Batch reads
+    std::vector<CValue> batch(4 * 70);
+    expect(par.getRect(CPos("A62"), 4, 70, batch));
+    assert(valueMatch(batch[0], CValue(63.0)) && valueMatch(batch[1], CValue(61.0 * 62 + 2 * 61)));
+    assert(valueMatch(batch[2], CValue()) && valueMatch(batch[4 * 69], CValue(132.0)));
+    assert(valueMatch(batch[4 * 69 + 1], CValue(130.0 * 131 + 2 * 130)));
+    std::vector<CPos> scattered = {CPos("D3"), CPos("A1"), CPos("ZZ1000"), CPos("C1")};
+    expect(par.getValues(scattered, batch));
+    assert(valueMatch(batch[0], CValue()) && valueMatch(batch[1], CValue(2.0)) && valueMatch(batch[2], CValue()));
+    assert(valueMatch(batch[3], par.getValue(CPos("C1"))));
+    expect(!par.getValues(scattered, std::span<CValue>(batch).first(3)));
+    expect(!par.getRect(CPos("A1"), 4, 70, std::span<CValue>(batch).first(4 * 70 - 1)));
+    expect(par.getRect(CPos("A1"), 0, 70, {}));
+    // a batch through tiles shared with a snapshot evaluates the shared chain once and caches it
+    expect(par.setCell(CPos("A1"), "3"));
+    CSpreadsheet parSnapshot = par.snapshot();
+    std::vector<CPos> chainEnds = {CPos("B300"), CPos("A300"), CPos("B299")};
+    expect(par.getValues(chainEnds, batch));
+    assert(valueMatch(batch[0], CValue(299.0 * 300 + 4 * 299)) && valueMatch(batch[1], CValue(302.0)));
+    assert(valueMatch(batch[2], CValue(298.0 * 299 + 4 * 298)));
+
+    // Batched writes
+    CSpreadsheet bulk;
+    expect(bulk.setCell(CPos("A1"), "1"));
+    expect(bulk.setCell(CPos("B1"), "=A1 + A2"));
+    assert(valueMatch(bulk.getValue(CPos("B1")), CValue()));
+    bulk.beginBatch();
+    for (int row = 2; row <= 100; row++)
+        expect(bulk.setCell(CPos("A" + std::to_string(row)), "=A" + std::to_string(row - 1) + " + 1"));
+    expect(bulk.setCell(CPos("A50"), "=A49 * 0"));
+    expect(bulk.setCell(CPos("A50"), "=A49 + 1"));
+    expect(!bulk.setCell(CPos("A101"), "=sum(A1)"));
+    expect(bulk.setCell(CPos("C1"), "=sum(A1:A100)"));
+    bulk.commit();
+    assert(valueMatch(bulk.getValue(CPos("B1")), CValue(3.0)));
+    assert(valueMatch(bulk.getValue(CPos("C1")), CValue(5050.0)));
+    bulk.beginBatch();
+    expect(bulk.setCell(CPos("A1"), "11"));
+    expect(bulk.setCell(CPos("A100"), "0"));
+    bulk.commit();
+    assert(valueMatch(bulk.getValue(CPos("B1")), CValue(23.0)));
+    assert(valueMatch(bulk.getValue(CPos("A99")), CValue(109.0)));
+    assert(valueMatch(bulk.getValue(CPos("C1")), CValue(5050.0 + 990 - 100)));
+    // cells written in the batch are not linked yet, recalculate orders them by their own references
+    bulk.beginBatch();
+    expect(bulk.setCell(CPos("D1"), "=sum(A1:A100) + E1"));
+    expect(bulk.setCell(CPos("E1"), "=A100 + D2"));
+    expect(bulk.setCell(CPos("D2"), "=B1 + 1"));
+    bulk.recalculate(3);
+    assert(valueMatch(bulk.getValue(CPos("D1")), CValue(5050.0 + 990 - 100 + 24)));
+    bulk.commit();
+    assert(valueMatch(bulk.getValue(CPos("D1")), CValue(5050.0 + 990 - 100 + 24)));
+
+    // Deep reference chains
+    CSpreadsheet ledger;
+    constexpr int LEDGER_ROWS = 100000;
+    ledger.beginBatch();
+    expect(ledger.setCell(CPos("B1"), "=A1"));
+    for (int row = 1; row <= LEDGER_ROWS; row++) {
+        std::string name = std::to_string(row);
+        expect(ledger.setCell(CPos("A" + name), "1"));
+        if (row > 1)
+            expect(ledger.setCell(CPos("B" + name), "=B" + std::to_string(row - 1) + " + A" + name));
+        expect(ledger.setCell(CPos("C" + name), "=D" + name));
+        expect(ledger.setCell(CPos("D" + name), "=C" + std::to_string(row % LEDGER_ROWS + 1)));
+    }
+    expect(ledger.setCell(CPos("E1"), "=sum(B1:B" + std::to_string(LEDGER_ROWS) + ")"));
+    ledger.commit();
+    assert(valueMatch(ledger.getValue(CPos("B" + std::to_string(LEDGER_ROWS))), CValue(double(LEDGER_ROWS))));
+    assert(valueMatch(ledger.getValue(CPos("E1")), CValue(double(LEDGER_ROWS) * (LEDGER_ROWS + 1) / 2)));
+    assert(valueMatch(ledger.getValue(CPos("C1")), CValue()));
+    expect(ledger.setCell(CPos("A1"), "2"));
+    assert(valueMatch(ledger.getValue(CPos("E1")), CValue(double(LEDGER_ROWS) * (LEDGER_ROWS + 3) / 2)));
+
+    // Cycles found when formulas are written
+    CSpreadsheet loop;
+    expect(loop.setCell(CPos("A1"), "=A2 + 1"));
+    expect(loop.setCell(CPos("A2"), "=A3 + 1"));
+    expect(loop.setCell(CPos("A3"), "5"));
+    expect(loop.setCell(CPos("B1"), "=if(1, 7, B1)"));
+    expect(loop.setCell(CPos("C1"), "=sum(C2:C3)"));
+    expect(loop.setCell(CPos("C2"), "=count(C1:C3) + 1"));
+    expect(loop.setCell(CPos("D1"), "=count(A1:A3)"));
+    assert(valueMatch(loop.getValue(CPos("A1")), CValue(7.0)));
+    assert(valueMatch(loop.getValue(CPos("B1")), CValue()));
+    assert(valueMatch(loop.getValue(CPos("C1")), CValue()) && valueMatch(loop.getValue(CPos("C2")), CValue()));
+    expect(loop.setCell(CPos("A3"), "=A1"));
+    assert(valueMatch(loop.getValue(CPos("A1")), CValue()) && valueMatch(loop.getValue(CPos("A2")), CValue()));
+    assert(valueMatch(loop.getValue(CPos("D1")), CValue(0.0)));
+    expect(loop.setCell(CPos("C2"), "3"));
+    assert(valueMatch(loop.getValue(CPos("C1")), CValue(3.0)));
+    loop.copyRect(CPos("A3"), CPos("C2"));
+    assert(valueMatch(loop.getValue(CPos("A1")), CValue(5.0)) && valueMatch(loop.getValue(CPos("D1")), CValue(3.0)));
+    loop.copyRect(CPos("A2"), CPos("A1"));
+    assert(valueMatch(loop.getValue(CPos("A1")), CValue(5.0)) && valueMatch(loop.getValue(CPos("A2")), CValue(4.0)));
+    loop.beginBatch();
+    expect(loop.setCell(CPos("A3"), "=A1 + A2"));
+    loop.commit();
+    assert(valueMatch(loop.getValue(CPos("A1")), CValue()) && valueMatch(loop.getValue(CPos("D1")), CValue(0.0)));
+
+    // Operations allocated from an arena, formulas rebuilt to operations when saved
+    CArena arena;
+    CGrid noCells;
+    for (int round = 0; round < 3; round++) {
+        arena.reset();
+        std::vector<CString *> strings;
+        for (int i = 0; i < 1000; i++)
+            strings.push_back(arena.make<CString>(std::string(i % 50, 'x')));
+        auto large = arena.make<std::array<double, 1024>>();
+        (*large)[1023] = 1;
+        int depth = 0;
+        assert(valueMatch(strings[999]->evaluate({}, noCells, depth), CValue(std::string(49, 'x'))));
+    }
+    CSpreadsheet nodes;
+    expect(nodes.setCell(CPos("A1"), "=$B$1 * 2 + sum(B1:B3)"));
+    expect(nodes.setCell(CPos("A3"), "=\"a\" + \"b\""));
+    expect(nodes.setCell(CPos("B1"), "3"));
+    expect(!nodes.setCell(CPos("A2"), "=sum(B1:B3"));
+    std::ostringstream nodesOut, nodesAgain;
+    expect(nodes.save(nodesOut));
+    std::istringstream nodesIn(nodesOut.str());
+    CSpreadsheet nodesCopy;
+    expect(nodesCopy.load(nodesIn));
+    expect(nodesCopy.save(nodesAgain));
+    assert(nodesAgain.str() == nodesOut.str());
+    assert(valueMatch(nodesCopy.getValue(CPos("A1")), nodes.getValue(CPos("A1"))));
+
+    // Formula templates shared by cells whose formulas are the same relative to their positions
+    CFormulaPool pool;
+    auto compileAt = [&](const char *pos, const std::string &expr) {
+        arena.reset();
+        CMyExpressionBuilder builder(arena);
+        parseExpression(expr, builder);
+        CCell cell;
+        expect(cell.compile(builder.getStack(), CPos(pos), pool, noCells.strings()));
+        return cell;
+    };
+    CCell shared1 = compileAt("B1", "=A1 * $C$1 + sum(A1:A$3)");
+    CCell shared2 = compileAt("B7", "=A7 * $C$1 + sum(A7:A$3)");
+    CCell other = compileAt("B2", "=A1 * $C$1 + sum(A1:A$3)");
+    assert(shared1.m_Formula == shared2.m_Formula && shared1.m_Formula != other.m_Formula && pool.size() == 2);
+    std::vector<CPos> sharedRefs;
+    shared2.getReferences(sharedRefs);
+    assert(sharedRefs.size() == 2 && (sharedRefs[0] <=> CPos("A7")) == 0 && (sharedRefs[1] <=> CPos("C1")) == 0);
+    other = CCell();
+    assert(pool.size() == 1);
+    CSpreadsheet column;
+    expect(column.setCell(CPos("A1"), "1"));
+    expect(column.setCell(CPos("B1"), "=A1 + $A$1"));
+    expect(column.setCell(CPos("C1"), "=sum($B$1:B1)"));
+    for (int row = 2; row <= 200; row++) {
+        expect(column.setCell(CPos("A" + std::to_string(row)), std::to_string(row)));
+        column.copyRect(CPos("B" + std::to_string(row)), CPos("B1"), 2, 1);
+    }
+    assert(valueMatch(column.getValue(CPos("B200")), CValue(201.0)));
+    assert(valueMatch(column.getValue(CPos("C200")), CValue(200.0 * 201 / 2 + 200)));
+    std::ostringstream columnOut;
+    expect(column.save(columnOut));
+    std::istringstream columnIn(columnOut.str());
+    CSpreadsheet columnCopy;
+    expect(columnCopy.load(columnIn));
+    assert(valueMatch(columnCopy.getValue(CPos("C100")), CValue(100.0 * 101 / 2 + 100)));
+
+    // Compact file format of version 2, files of version 1 still load
+    assert(CCrc32::compute("123456789") == 0xCBF43926u);
+    CSpreadsheet tiny;
+    expect(tiny.setCell(CPos("A1"), "1"));
+    std::ostringstream tinyOut;
+    expect(tiny.save(tinyOut));
+    std::string tinyData = tinyOut.str();
+    // magic, version, no strings, no formulas, one chunk of four bytes and one cell, checksum of the header,
+    // the cell in row 1 and column 0 holding the integer 1, checksum of the chunk
+    assert(tinyData == std::string("\x89SPS\x03\x00\x00\x01\x04\x01\xe9\xda\x63\x61"
+                                   "\x02\x00\x02\x02\x39\x14\x75\x57", 22));
+    // the same sheet in the format of version 2
+    std::istringstream tinyIn(std::string("\x89SPS\x02\x00\x00\x01\x02\x00\x02\x02\x28\x36\x58\x9c", 16));
+    expect(tiny.load(tinyIn));
+    assert(valueMatch(tiny.getValue(CPos("A1")), CValue(1.0)));
+    CSpreadsheet v2;
+    expect(v2.setCell(CPos("A1"), "-0"));
+    expect(v2.setCell(CPos("B1"), "0.25"));
+    expect(v2.setCell(CPos("C1"), "-123456789012"));
+    expect(v2.setCell(CPos("ZZ100000"), "=$A1 + sum(B$1:C1) + \"x\" = \"x\""));
+    expect(v2.setCell(CPos("A5"), "text"));
+    for (int row = 2; row <= 500; row++)
+        v2.copyRect(CPos("B" + std::to_string(row)), CPos("ZZ100000"));
+    std::ostringstream v2Out;
+    expect(v2.save(v2Out));
+    std::string v2Data = v2Out.str();
+    CSpreadsheet v2Loaded;
+    std::istringstream v2In(v2Data);
+    expect(v2Loaded.load(v2In));
+    assert(std::signbit(std::get<double>(v2Loaded.getValue(CPos("A1")))));
+    assert(valueMatch(v2Loaded.getValue(CPos("C1")), CValue(-123456789012.0)));
+    assert(valueMatch(v2Loaded.getValue(CPos("A5")), CValue("text")));
+    for (const char *pos: {"ZZ100000", "B2", "B300", "B500"})
+        assert(valueMatch(v2Loaded.getValue(CPos(pos)), v2.getValue(CPos(pos))));
+    std::ostringstream v1Out;
+    size_t v1Count = 499;
+    v1Out.write(reinterpret_cast<const char *>(&v1Count), sizeof(v1Count));
+    for (int row = 2; row <= 500; row++) {
+        CCell cell = compileAt(("B" + std::to_string(row)).c_str(), "=$A" + std::to_string(row) + " + sum(B$1:C"
+                                                                    + std::to_string(row) + ") + \"x\" = \"x\"");
+        arena.reset();
+        expect(cell.m_Pos.saveBinary(v1Out));
+        expect(cell.saveBinary(v1Out, arena));
+    }
+    assert(v2Data.size() * 10 < v1Out.str().size());
+    for (size_t i = 0; i < v2Data.size(); i += 7) {
+        std::string damaged = v2Data;
+        damaged[i] ^= 0x10;
+        std::istringstream damagedIn(damaged);
+        expect(!v2Loaded.load(damagedIn));
+    }
+    std::istringstream truncatedIn(v2Data.substr(0, v2Data.size() - 1));
+    expect(!v2Loaded.load(truncatedIn));
+    std::ostringstream legacyOut;
+    size_t legacyCount = 2;
+    legacyOut.write(reinterpret_cast<const char *>(&legacyCount), sizeof(legacyCount));
+    CCell legacyFormula = compileAt("B1", "=A1 * 2");
+    arena.reset();
+    expect(CPos("A1").saveBinary(legacyOut));
+    expect(CCell::saveBinary(legacyOut, 5.0));
+    expect(CPos("B1").saveBinary(legacyOut));
+    expect(legacyFormula.saveBinary(legacyOut, arena));
+    std::istringstream legacyIn(legacyOut.str());
+    CSpreadsheet legacy;
+    expect(legacy.load(legacyIn));
+    assert(valueMatch(legacy.getValue(CPos("B1")), CValue(10.0)));
+    // saved by the first release: A1 = 1, A2 = 2, A3 = sum(A1:A2), the range and the call are stored without operands
+    const char baselineBytes[] =
+            "\x03\x00\x00\x00\x00\x00\x00\x00\x01\x00\x00\x00\x00\x00\x00\x00\x00\x01\x00\x00\x00\x00"
+            "\x00\x00\x00\x0e\x00\x00\x00\x00\x00\x00\x00\x00\x00\xf0\x3f\x00\x02\x00\x00\x00\x00\x00"
+            "\x00\x00\x00\x01\x00\x00\x00\x00\x00\x00\x00\x0e\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"
+            "\x40\x00\x03\x00\x00\x00\x00\x00\x00\x00\x00\x02\x00\x00\x00\x00\x00\x00\x00\x10\x00\x00"
+            "\x00\x11\x00\x00\x00\x00";
+    std::istringstream baselineIn(std::string(baselineBytes, sizeof(baselineBytes) - 1));
+    CSpreadsheet baselineSheet;
+    expect(baselineSheet.load(baselineIn));
+    assert(valueMatch(baselineSheet.getValue(CPos("A1")), CValue(1.0)));
+    assert(valueMatch(baselineSheet.getValue(CPos("A2")), CValue(2.0)));
+    assert(valueMatch(baselineSheet.getValue(CPos("A3")), CValue()));
+    expect(baselineSheet.setCell(CPos("A3"), "=sum(A1:A2)"));
+    assert(valueMatch(baselineSheet.getValue(CPos("A3")), CValue(3.0)));
+    // the first release ignored bytes after the last cell
+    std::istringstream trailingIn(std::string(baselineBytes, sizeof(baselineBytes) - 1) + "trailing");
+    CSpreadsheet trailingSheet;
+    expect(trailingSheet.load(trailingIn));
+    assert(valueMatch(trailingSheet.getValue(CPos("A2")), CValue(2.0)));
+
+    // Files opened mapped decode cells on first access, with the cells they reference
+    CSpreadsheet model;
+    expect(model.setCell(CPos("A1"), "1"));
+    expect(model.setCell(CPos("B1"), "=A1 * 2"));
+    for (int row = 2; row <= 1000; row++) {
+        expect(model.setCell(CPos("A" + std::to_string(row)), std::to_string(row)));
+        model.copyRect(CPos("B" + std::to_string(row)), CPos("B1"));
+    }
+    expect(model.setCell(CPos("C1"), "=sum(B1:B1000)"));
+    expect(model.setCell(CPos("D1"), "=E1"));
+    expect(model.setCell(CPos("E1"), "=D1"));
+    expect(model.setCell(CPos("F1"), "text"));
+    // a file of the test's own in the temporary directory, removed at the end
+    std::string modelPath = (std::filesystem::temp_directory_path()
+                             / ("spreadsheet_test_" + std::to_string(getpid()) + ".sps")).string();
+    std::string modelData;
+    {
+        std::ofstream modelOut(modelPath, std::ios::binary);
+        std::ostringstream modelBytes;
+        expect(model.save(modelBytes));
+        expect(model.save(modelOut));
+        modelData = modelBytes.str();
+    }
+    CSheetFile index;
+    expect(index.open(modelData));
+    assert(index.pending() == 2004);
+    CSheetFile::CEntry *entry = index.find(CPos("B5"));
+    CGrid decodedGrid;
+    CFormulaPool decodedFormulas;
+    assert(entry);
+    expect(index.decode(*entry, decodedGrid, decodedFormulas));
+    assert(!index.find(CPos("B5")) && index.pending() == 2003 && decodedGrid.find(CPos("B5")));
+    assert(!index.find(CPos("G1")));
+    expect(!CSheetFile().open(modelData.substr(1)));
+
+    CSpreadsheet mapped;
+    expect(!mapped.openMapped(modelPath + ".missing"));
+    expect(mapped.openMapped(modelPath));
+    // const reads decode into copies, the cells stay pending for the spreadsheet itself
+    const CSpreadsheet &mappedReader = mapped;
+    expect(valueMatch(mappedReader.getValue(CPos("C1")), CValue(1000.0 * 1001)));
+    assert(valueMatch(mappedReader.getValue(CPos("B10")), CValue(20.0)));
+    assert(valueMatch(mapped.getValue(CPos("B10")), CValue(20.0)));
+    assert(valueMatch(mapped.getValue(CPos("C1")), CValue(1000.0 * 1001)));
+    assert(valueMatch(mapped.getValue(CPos("D1")), CValue()) && valueMatch(mapped.getValue(CPos("F1")), CValue("text")));
+    assert(valueMatch(mapped.getValue(CPos("G1")), CValue()));
+    std::ostringstream mappedOut;
+    expect(mapped.save(mappedOut));
+    assert(mappedOut.str() == modelData);
+    // writes to cells still in the file
+    CSpreadsheet mappedCopy = mapped;
+    expect(mapped.openMapped(modelPath));
+    expect(mapped.setCell(CPos("A5"), "100"));
+    assert(valueMatch(mapped.getValue(CPos("B5")), CValue(200.0)));
+    expect(mapped.setCell(CPos("A3"), "=B3"));
+    assert(valueMatch(mapped.getValue(CPos("B3")), CValue()));
+    mapped.copyRect(CPos("A7"), CPos("A6"), 1, 3);
+    assert(valueMatch(mapped.getValue(CPos("B9")), CValue(16.0)));
+    assert(valueMatch(mapped.getValue(CPos("A10")), CValue(10.0)));
+    assert(valueMatch(mappedCopy.getValue(CPos("B5")), CValue(10.0)));
+    expect(mapped.openMapped(modelPath));
+    expect(mapped.setCell(CPos("A1000"), "0"));
+    mapped.recalculate(2);
+    assert(valueMatch(mapped.getValue(CPos("C1")), CValue(1000.0 * 1001 - 2000)));
+    // mapped files are replaced by renaming a new file over them, never written over in place
+    auto replaceModel = [&](const std::string &data) {
+        std::string newPath = modelPath + ".new";
+        {
+            std::ofstream newOut(newPath, std::ios::binary);
+            newOut.write(data.data(), static_cast<std::streamsize>(data.size()));
+        }
+        std::filesystem::rename(newPath, modelPath);
+    };
+    // the header is checked when the file is opened, a chunk on the first decode from it
+    std::string damaged = modelData;
+    damaged[6] ^= 0x01;
+    replaceModel(damaged);
+    expect(!mapped.openMapped(modelPath));
+    assert(valueMatch(mapped.getValue(CPos("B1000")), CValue(0.0)));
+    damaged = modelData;
+    damaged.back() ^= 0x01;
+    replaceModel(damaged);
+    expect(mapped.openMapped(modelPath));
+    assert(valueMatch(mapped.getValue(CPos("B10")), CValue()) && valueMatch(mapped.getValue(CPos("C1")), CValue()));
+    // the opened file may be saved to while its cells are pending
+    replaceModel(modelData);
+    expect(mapped.openMapped(modelPath));
+    CSpreadsheet overwrite;
+    expect(overwrite.setCell(CPos("B10"), "5"));
+    expect(overwrite.save(modelPath));
+    assert(valueMatch(mapped.getValue(CPos("B10")), CValue(20.0)));
+    expect(mapped.save(modelPath));
+    expect(!mapped.save(modelPath + ".missing/model.sps"));
+    std::ifstream savedIn(modelPath, std::ios::binary);
+    assert(std::string(std::istreambuf_iterator<char>(savedIn), std::istreambuf_iterator<char>()) == modelData);
+    assert(!std::filesystem::exists(modelPath + ".tmp"));
+    std::remove(modelPath.c_str());
+
+    // Files split into chunks of whole bands of tile rows, encoded and decoded in parallel
+    CGrid bands;
+    for (int row = 1; row <= 2000; row++)
+        for (int column = 0; column < 40; column++)
+            bands.setNumber(CPos(row, column), row * 0.5 + column);
+    CCell bandFormula = compileAt("AZ1", "=A1 + sum(A1:B2)");
+    for (int row = 1; row <= 2000; row += 3) {
+        CCell &cell = bands[CPos(row, 51)];
+        cell.m_Formula = bandFormula.m_Formula;
+        cell.m_Pos = CPos(row, 51);
+    }
+    std::ostringstream bandsSerial, bandsParallel;
+    expect(CSheetFile::write(bandsSerial, bands, 1));
+    expect(CSheetFile::write(bandsParallel, bands, 4));
+    std::string bandsData = bandsParallel.str();
+    assert(bandsData == bandsSerial.str());
+    CSheetFile bandsFile;
+    assert(bands.size() > CSheetFile::CHUNK_CELLS);
+    expect(bandsFile.open(bandsData, 4));
+    assert(bandsFile.pending() == bands.size());
+    CGrid bandsLoaded;
+    CFormulaPool bandsFormulas;
+    // cells decoded one by one share tiles with the chunks decoded later
+    for (const char *pos: {"A1", "AZ1", "B1000", "AN2000"})
+        expect(bandsFile.decode(*bandsFile.find(CPos(pos)), bandsLoaded, bandsFormulas));
+    expect(bandsFile.decodeAll(bandsLoaded, bandsFormulas, 4));
+    assert(!bandsFile.pending());
+    assert(bandsLoaded.size() == bands.size() && bandsFormulas.size() == 1);
+    std::ostringstream bandsAgain;
+    expect(CSheetFile::write(bandsAgain, bandsLoaded, 3));
+    assert(bandsAgain.str() == bandsData);
+    std::string bandsDamaged = bandsData;
+    bandsDamaged[6] ^= 0x01;
+    expect(!CSheetFile().open(bandsDamaged, 4));
+    // a damaged chunk is found when it is decoded, the other chunks decode
+    bandsDamaged = bandsData;
+    bandsDamaged.back() ^= 0x01;
+    CSheetFile bandsDamagedFile;
+    CGrid bandsPartial;
+    CFormulaPool bandsPartialFormulas;
+    expect(bandsDamagedFile.open(bandsDamaged, 4));
+    expect(!bandsDamagedFile.decode(*bandsDamagedFile.find(CPos("AZ1999")), bandsPartial, bandsPartialFormulas));
+    expect(!bandsDamagedFile.decodeAll(bandsPartial, bandsPartialFormulas, 4));
+    assert(bandsPartial.find(CPos("AZ1")) && !bandsPartial.find(CPos("AZ1999")) && !bandsDamagedFile.pending());
+
+    // Formulas parsed when they are first needed
+    CSpreadsheet lazy;
+    lazy.setLazyParsing(true);
+    expect(lazy.setCell(CPos("A1"), "=B1 + 1"));
+    expect(lazy.setCell(CPos("B1"), "=C1 * 2"));
+    expect(lazy.setCell(CPos("C1"), "5"));
+    expect(lazy.setCell(CPos("D1"), "=1 +"));
+    assert(lazy.parseErrors().empty());
+    // the read parses A1 and the formulas it references, not only a check
+    CValue lazyValue = lazy.getValue(CPos("A1"));
+    assert(valueMatch(lazyValue, CValue(11.0)));
+    // B1 is referenced by a parsed formula now, formulas written to it are parsed at once
+    expect(!lazy.setCell(CPos("B1"), "=C1 *"));
+    expect(lazy.setCell(CPos("C1"), "7"));
+    assert(valueMatch(lazy.getValue(CPos("A1")), CValue(15.0)));
+    assert(valueMatch(lazy.getValue(CPos("D1")), CValue()));
+    assert(lazy.parseErrors().size() == 1 && (lazy.parseErrors()[0] <=> CPos("D1")) == 0);
+    expect(lazy.setCell(CPos("E1"), "=F1"));
+    expect(lazy.setCell(CPos("F1"), "=E1"));
+    assert(valueMatch(lazy.getValue(CPos("E1")), CValue()) && valueMatch(lazy.getValue(CPos("F1")), CValue()));
+    expect(lazy.setCell(CPos("G1"), "=1"));
+    expect(lazy.setCell(CPos("G2"), "=G1 + 1"));
+    for (int row = 3; row <= 10; row++)
+        lazy.copyRect(CPos("G" + std::to_string(row)), CPos("G2"));
+    expect(lazy.setCell(CPos("H1"), "=sum(G1:G10)"));
+    assert(valueMatch(lazy.getValue(CPos("H1")), CValue(55.0)));
+    expect(lazy.setCell(CPos("J1"), "=J2"));
+    assert(valueMatch(lazy.getValue(CPos("J1")), CValue()));
+    lazy.beginBatch();
+    expect(lazy.setCell(CPos("J2"), "=J3 * 2"));
+    // J2 is not linked before commit, so J3 is deferred
+    expect(lazy.setCell(CPos("J3"), "=4"));
+    lazy.commit();
+    assert(valueMatch(lazy.getValue(CPos("J1")), CValue(8.0)));
+    expect(lazy.setCell(CPos("K1"), "=A1 * 10"));
+    expect(lazy.setCell(CPos("K2"), "text"));
+    std::ostringstream lazyOut;
+    expect(lazy.save(lazyOut));
+    std::istringstream lazyIn(lazyOut.str());
+    CSpreadsheet lazyLoaded;
+    expect(lazyLoaded.load(lazyIn));
+    assert(valueMatch(lazyLoaded.getValue(CPos("K1")), CValue(150.0)));
+    assert(valueMatch(lazyLoaded.getValue(CPos("K2")), CValue("text")));
+    lazy.recalculate(2);
+    assert(valueMatch(lazy.getValue(CPos("K1")), CValue(150.0)));
+
+    // Formulas of the same shape relative to their cells compiled once
+    std::string cacheKey, cacheOther;
+    assert(CParseCache::normalize("=A1*$B$1", CPos("C2"), cacheKey));
+    assert(CParseCache::normalize("=A2 * $B$1", CPos("C3"), cacheOther) && cacheKey != cacheOther);
+    assert(CParseCache::normalize("=A2*$B$1", CPos("C3"), cacheOther) && cacheKey == cacheOther);
+    assert(CParseCache::normalize("=sum(A1:B2) & \"A1\"\"\"", CPos("A1"), cacheKey));
+    assert(CParseCache::normalize("=sum(A2:B3) & \"A1\"\"\"", CPos("A2"), cacheOther) && cacheKey == cacheOther);
+    assert(CParseCache::normalize("=sum(A2:B3) & \"A2\"\"\"", CPos("A2"), cacheOther) && cacheKey != cacheOther);
+    assert(CParseCache::normalize("=1.5e-3+A1", CPos("A2"), cacheKey) && cacheKey == "=1.5e-3+\x01" "0,-1\x01");
+    assert(!CParseCache::normalize("=a1", CPos("A2"), cacheKey) && !CParseCache::normalize("=A1B", CPos("A2"), cacheKey));
+    CSpreadsheet cached;
+    expect(cached.setCell(CPos("A1"), "2"));
+    expect(cached.setCell(CPos("A2"), "3"));
+    expect(cached.setCell(CPos("C1"), "10"));
+    expect(cached.setCell(CPos("B1"), "=A1 * $C$1"));
+    expect(cached.setCell(CPos("B2"), "=A2 * $C$1"));
+    expect(cached.setCell(CPos("B3"), "=A1 * $C$1"));
+    expect(!cached.setCell(CPos("B4"), "=A3 *"));
+    expect(!cached.setCell(CPos("B4"), "=A3 *"));
+    assert(cached.parseCacheStats().m_Hits == 1 && cached.parseCacheStats().m_Misses == 4);
+    assert(valueMatch(cached.getValue(CPos("B1")), CValue(20.0)) && valueMatch(cached.getValue(CPos("B2")), CValue(30.0)));
+    assert(valueMatch(cached.getValue(CPos("B3")), CValue(20.0)));
+    // string literals are part of the shape
+    expect(cached.setCell(CPos("D1"), "=\"a\""));
+    expect(cached.setCell(CPos("D2"), "=\"b\""));
+    assert(valueMatch(cached.getValue(CPos("D1")), CValue("a")) && valueMatch(cached.getValue(CPos("D2")), CValue("b")));
+    assert(cached.parseCacheStats().m_Hits == 1);
+
+    // Constant subexpressions folded when formulas are compiled
+    CStringPool foldStrings;
+    auto folded = [&](const std::function<void(CFormula &)> &build, const std::function<void(CFormula &)> &expected) {
+        CFormula formula, other;
+        build(formula);
+        expected(other);
+        return formula.finalize(foldStrings) && other.finalize(foldStrings) && formula == other;
+    };
+    int ifId = CFunctionRegistry::find("if");
+    assert(folded([](CFormula &f) {
+        f.emitNumber(2), f.emitNumber(3), f.emit(EOpCode::Mul), f.emitReference(CPos("A1")), f.emit(EOpCode::Add);
+    }, [](CFormula &f) { f.emitNumber(6), f.emitReference(CPos("A1")), f.emit(EOpCode::Add); }));
+    // undefined whatever A1 is, but A1 stays a dependency
+    assert(folded([](CFormula &f) {
+        f.emitReference(CPos("A1")), f.emitNumber(1), f.emitNumber(0), f.emit(EOpCode::Div), f.emit(EOpCode::Add);
+    }, [](CFormula &f) {
+        f.emitReference(CPos("A1")), f.emitNumber(0), f.emitNumber(0), f.emit(EOpCode::Div), f.emit(EOpCode::Add);
+    }));
+    assert(folded([](CFormula &f) {
+        f.emitString("a"), f.emitReference(CPos("A1")), f.emitNumber(2), f.emit(EOpCode::Mul), f.emit(EOpCode::Eq);
+    }, [](CFormula &f) {
+        f.emitString("a"), f.emitReference(CPos("A1")), f.emitNumber(2), f.emit(EOpCode::Mul), f.emit(EOpCode::Eq);
+    }));
+    assert(folded([](CFormula &f) { f.emitString("a"), f.emitString("b"), f.emit(EOpCode::Add); },
+                  [](CFormula &f) { f.emitString("ab"); }));
+    // A1 ^ 0 is undefined for an empty A1, the identities hold only for numbers
+    assert(folded([](CFormula &f) { f.emitReference(CPos("A1")), f.emitNumber(0), f.emit(EOpCode::Pow); },
+                  [](CFormula &f) { f.emitReference(CPos("A1")), f.emitNumber(0), f.emit(EOpCode::Pow); }));
+    assert(folded([](CFormula &f) { f.emitReference(CPos("A1")), f.emitNumber(1), f.emit(EOpCode::Mul); },
+                  [](CFormula &f) { f.emitReference(CPos("A1")), f.emitNumber(1), f.emit(EOpCode::Mul); }));
+    assert(folded([](CFormula &f) {
+        f.emitNumber(1), f.emitReference(CPos("A1")), f.emitNumber(2), f.emit(EOpCode::Mul), f.emit(EOpCode::Mul);
+        f.emit(EOpCode::Neg), f.emit(EOpCode::Neg), f.emitNumber(1), f.emit(EOpCode::Div);
+    }, [](CFormula &f) { f.emitReference(CPos("A1")), f.emitNumber(2), f.emit(EOpCode::Mul); }));
+    assert(folded([&](CFormula &f) {
+        f.emitNumber(1), f.emitReference(CPos("A1")), f.emitString("x"), f.emitCall(ifId, 3);
+    }, [](CFormula &f) { f.emitReference(CPos("A1")); }));
+    assert(folded([&](CFormula &f) {
+        f.emitNumber(1), f.emitString("x"), f.emitReference(CPos("A1")), f.emitCall(ifId, 3);
+    }, [&](CFormula &f) { f.emitNumber(1), f.emitString("x"), f.emitReference(CPos("A1")), f.emitCall(ifId, 3); }));
+    CSpreadsheet folding;
+    expect(folding.setCell(CPos("B1"), "=2 * 3 + A1"));
+    expect(folding.setCell(CPos("B2"), "=A1 ^ 0"));
+    expect(folding.setCell(CPos("B3"), "=\"a\" + \"b\""));
+    expect(folding.setCell(CPos("B4"), "=if(0, A1, -(-(A1 * 1)))"));
+    assert(valueMatch(folding.getValue(CPos("B1")), CValue()) && valueMatch(folding.getValue(CPos("B2")), CValue()));
+    expect(folding.setCell(CPos("A1"), "4"));
+    assert(valueMatch(folding.getValue(CPos("B1")), CValue(10.0)));
+    assert(valueMatch(folding.getValue(CPos("B2")), CValue(1.0)) && valueMatch(folding.getValue(CPos("B3")), CValue("ab")));
+    assert(valueMatch(folding.getValue(CPos("B4")), CValue(4.0)));
+    // references of an operand folded to undefined still close cycles
+    expect(folding.setCell(CPos("C1"), "=C2 + 1/0"));
+    expect(folding.setCell(CPos("C2"), "=count(C1:C1)"));
+    expect(folding.setCell(CPos("D1"), "=D2 + 1/C9"));
+    expect(folding.setCell(CPos("D2"), "=count(D1:D1)"));
+    assert(valueMatch(folding.getValue(CPos("C2")), CValue()) && valueMatch(folding.getValue(CPos("D2")), CValue()));
+    assert(valueMatch(folding.getValue(CPos("C1")), CValue()) && valueMatch(folding.getValue(CPos("D1")), CValue()));
+
+    // Overlapping copies read every source cell before overwriting it
+    for (auto [dstRow, dstColumn]: {std::pair(2, 1), std::pair(-2, 0), std::pair(1, -1), std::pair(-1, 2)}) {
+        CSpreadsheet direct, staged;
+        for (CSpreadsheet *sheet: {&direct, &staged})
+            for (int row = 0; row < 5; row++)
+                for (int column = 0; column < 5; column++)
+                    if ((row + column) % 4 != 3)
+                        expect(sheet->setCell(CPos(10 + row, 10 + column),
+                                              (row + column) % 4 == 0 ? std::to_string(row * 5 + column)
+                                                                      : "=" + std::string(1, 'A' + 9 + column) +
+                                                                        std::to_string(10 + row) + " * 2 + 1"));
+        CPos from(10, 10), to(10 + dstRow, 10 + dstColumn), far(100, 100);
+        direct.copyRect(to, from, 5, 5);
+        staged.copyRect(far, from, 5, 5);
+        staged.copyRect(to, far, 5, 5);
+        for (int row = 5; row < 20; row++)
+            for (int column = 5; column < 20; column++)
+                assert(valueMatch(direct.getValue(CPos(row, column)), staged.getValue(CPos(row, column))));
+    }
+
+    // Snapshots share tiles until either side changes them
+    CGrid shared;
+    shared[CPos("A1")];
+    shared.setNumber(CPos("A2"), 1);
+    shared[CPos("ZZ1000")];
+    CGrid sharedCopy(shared);
+    assert(std::as_const(shared).find(CPos("A1")) == std::as_const(sharedCopy).find(CPos("A1")));
+    sharedCopy.setNumber(CPos("A3"), 2);
+    assert(std::as_const(shared).find(CPos("A1")) != std::as_const(sharedCopy).find(CPos("A1")));
+    assert(std::as_const(shared).find(CPos("ZZ1000")) == std::as_const(sharedCopy).find(CPos("ZZ1000")));
+    assert(!shared.findNumber(CPos("A3")) && *sharedCopy.findNumber(CPos("A3")) == 2 && shared.size() == 3);
+    // an evaluation keeps the values of cells in shared tiles to itself until it is flushed, it caches them in tiles
+    // it owns at once
+    shared[CPos("B1")] = compileAt("B1", "=A2 * 2");
+    shared[CPos("B2")] = compileAt("B2", "=B1 + 1");
+    CGrid readCopy(shared);
+    const CCell *sharedCell = std::as_const(shared).find(CPos("B1"));
+    expect(sharedCell);
+    CEvaluation sharedEvaluation(shared);
+    assert(valueMatch(sharedCell->calculateCell(sharedEvaluation).toValue(), CValue(2.0)));
+    assert(std::as_const(readCopy).find(CPos("B1")) == sharedCell && !sharedCell->m_IsCached);
+    sharedEvaluation.flush();
+    const CCell *ownCell = std::as_const(shared).find(CPos("B1"));
+    expect(ownCell != sharedCell);
+    assert(ownCell->m_IsCached && valueMatch(ownCell->m_Value.toValue(), CValue(2.0)));
+    assert(std::as_const(readCopy).find(CPos("B1")) == sharedCell && !sharedCell->m_IsCached);
+    // the second read finds the value cached in the own tile
+    CEvaluation ownEvaluation(shared);
+    CCompactValue known;
+    assert(ownEvaluation.cached(*ownCell, known) && valueMatch(known.toValue(), CValue(2.0)));
+    const CCell *ownNext = std::as_const(shared).find(CPos("B2"));
+    expect(ownNext);
+    assert(valueMatch(ownNext->calculateCell(ownEvaluation).toValue(), CValue(3.0)) && ownNext->m_IsCached);
+    CSpreadsheet original;
+    expect(original.setCell(CPos("A1"), "10"));
+    expect(original.setCell(CPos("B1"), "=A1 * 2"));
+    expect(original.setCell(CPos("C1"), "=sum(A1:B1)"));
+    assert(valueMatch(original.getValue(CPos("C1")), CValue(30.0)));
+    CSpreadsheet snapshot = original.snapshot();
+    expect(original.setCell(CPos("A1"), "=C1"));
+    assert(valueMatch(original.getValue(CPos("C1")), CValue()) && valueMatch(snapshot.getValue(CPos("C1")), CValue(30.0)));
+    expect(snapshot.setCell(CPos("A1"), "1"));
+    assert(valueMatch(snapshot.getValue(CPos("C1")), CValue(3.0)));
+    assert(valueMatch(original.getValue(CPos("B1")), CValue()));
+    expect(original.setCell(CPos("A1"), "5"));
+    assert(valueMatch(original.getValue(CPos("C1")), CValue(15.0)));
+    CSpreadsheet second = snapshot.snapshot();
+    second.copyRect(CPos("A2"), CPos("A1"), 3, 1);
+    assert(valueMatch(second.getValue(CPos("C2")), CValue(3.0)) && valueMatch(snapshot.getValue(CPos("C2")), CValue()));
+
+    // Const reads calculate without storing anything, any number of threads may read at once
+    CSpreadsheet readers;
+    readers.beginBatch();
+    for (int row = 1; row <= 200; row++) {
+        expect(readers.setCell(CPos(row, 0), std::to_string(row)));
+        expect(readers.setCell(CPos(row, 1),
+                               row == 1 ? "=A1" : "=B" + std::to_string(row - 1) + " + A" + std::to_string(row)));
+        expect(readers.setCell(CPos(row, 2), "=sum(A1:B" + std::to_string(row) + ")"));
+    }
+    expect(readers.setCell(CPos("D1"), "hi"));
+    expect(readers.setCell(CPos("E1"), "=D1 + \"!\""));
+    expect(readers.setCell(CPos("F1"), "=G1 + 1"));
+    expect(readers.setCell(CPos("G1"), "=F1"));
+    const CSpreadsheet &reader = readers;
+    assert(valueMatch(reader.getValue(CPos("F1")), CValue()) && valueMatch(reader.getValue(CPos("G1")), CValue()));
+    readers.commit();
+    auto expectedSum = [](double row) { return row * (row + 1) / 2 + row * (row + 1) * (row + 2) / 6; };
+    std::vector<std::thread> threads;
+    std::atomic<int> mismatches = 0;
+    for (int thread = 0; thread < 4; thread++)
+        threads.emplace_back([&, thread]() {
+            for (int i = 0; i < 200; i++) {
+                int row = (i * 37 + thread * 50) % 200 + 1;
+                if (!valueMatch(reader.getValue(CPos(row, 2)), CValue(expectedSum(row)))
+                    || !valueMatch(reader.getValue(CPos("E1")), CValue("hi!"))
+                    || !valueMatch(reader.getValue(CPos("F1")), CValue()))
+                    mismatches++;
+            }
+        });
+    for (auto &thread: threads)
+        thread.join();
+    assert(mismatches == 0);
+    assert(valueMatch(readers.getValue(CPos(200, 2)), CValue(expectedSum(200))));
+    expect(readers.setCell(CPos("A1"), "2"));
+    assert(valueMatch(reader.getValue(CPos(200, 2)), CValue(expectedSum(200) + 201)));
+    CSpreadsheet pendingReaders;
+    pendingReaders.setLazyParsing(true);
+    for (int row = 1; row <= 100; row++) {
+        expect(pendingReaders.setCell(CPos(row, 0), std::to_string(row)));
+        expect(pendingReaders.setCell(CPos(row, 1), "=A" + std::to_string(row) + " * 2"));
+    }
+    expect(pendingReaders.setCell(CPos("C1"), "=sum(B1:B100)"));
+    const CSpreadsheet &pendingReader = pendingReaders;
+    std::vector<std::thread> pendingThreads;
+    for (int thread = 0; thread < 4; thread++)
+        pendingThreads.emplace_back([&, thread]() {
+            for (int i = 0; i < 5; i++)
+                if (!valueMatch(pendingReader.getValue(CPos("C1")), CValue(10100.0))
+                    || !valueMatch(pendingReader.getValue(CPos(thread * 20 + i + 1, 1)), CValue((thread * 20 + i + 1) * 2.0)))
+                    mismatches++;
+        });
+    for (auto &thread: pendingThreads)
+        thread.join();
+    assert(mismatches == 0);
+    expect(pendingReaders.setCell(CPos("A1"), "3"));
+    assert(valueMatch(pendingReaders.getValue(CPos("C1")), CValue(10104.0)));
+
+    // Strings interned per sheet, compared by their handles
+    CStringPool strings;
+    assert(strings.intern("abc") == strings.intern(std::string("ab") + "c"));
+    assert(strings.intern("abd") != strings.intern("abc") && strings.size() == 2);
+    assert(CCompactValue(strings.intern("x")) == CCompactValue(strings.intern("x")));
+    assert(!(CCompactValue() == CCompactValue(0.0)));
+    assert(valueMatch(CCompactValue(strings.intern("x")).toValue(), CValue("x")));
+    const std::string *kept = strings.keep("abc");
+    expect(strings.sweep() && strings.size() == 1 && strings.intern("abc") == kept);
+    // strings held by a running evaluation are not retained, so nothing is released meanwhile
+    strings.enter();
+    expect(strings.intern("held") && !strings.sweep() && strings.size() == 2);
+    strings.leave();
+    CStringPool::release(kept);
+    expect(strings.sweep() && strings.size() == 0);
+    CSpreadsheet words;
+    expect(words.setCell(CPos("A1"), "ab"));
+    expect(words.setCell(CPos("A2"), "=\"a\" + \"b\""));
+    expect(words.setCell(CPos("A3"), "=A1 = A2"));
+    expect(words.setCell(CPos("A4"), "=A1 < \"abc\""));
+    expect(words.setCell(CPos("A5"), "=A1 >= A2"));
+    expect(words.setCell(CPos("A6"), "=countval(\"ab\", A1:A2)"));
+    expect(words.setCell(CPos("A7"), "=A1 + A2"));
+    assert(valueMatch(words.getValue(CPos("A3")), CValue(1.0)) && valueMatch(words.getValue(CPos("A4")), CValue(1.0)));
+    assert(valueMatch(words.getValue(CPos("A5")), CValue(1.0)) && valueMatch(words.getValue(CPos("A6")), CValue(2.0)));
+    assert(valueMatch(words.getValue(CPos("A7")), CValue("abab")));
+    CSpreadsheet wordsCopy(words);
+    expect(wordsCopy.setCell(CPos("A2"), "=\"ab\" + \"ab\""));
+    assert(valueMatch(wordsCopy.getValue(CPos("A3")), CValue(0.0)) && valueMatch(words.getValue(CPos("A3")), CValue(1.0)));
+    expect(wordsCopy.setCell(CPos("B1"), "=A2 = A7"));
+    assert(valueMatch(wordsCopy.getValue(CPos("B1")), CValue(0.0)));
+    expect(wordsCopy.setCell(CPos("B1"), "=A2 = (A1 + A1)"));
+    assert(valueMatch(wordsCopy.getValue(CPos("B1")), CValue(1.0)));
+    // strings no cell holds anymore are released by later writes, also while a copy shares the pool
+    CSpreadsheet edits;
+    expect(edits.setCell(CPos("B1"), "=A1 + \"!\""));
+    auto editText = [&](int count) {
+        for (int i = 0; i < count; i++) {
+            expect(edits.setCell(CPos("A1"), "text " + std::to_string(i)));
+            expect(valueMatch(edits.getValue(CPos("B1")), CValue("text " + std::to_string(i) + "!")));
+        }
+    };
+    editText(1000);
+    expect(edits.stringCount() < 100);
+    auto editsCopy = std::make_unique<CSpreadsheet>(edits);
+    editText(1000);
+    expect(edits.stringCount() < 100);
+    assert(valueMatch(editsCopy->getValue(CPos("B1")), CValue("text 999!")));
+    // the copy evaluates its own edits meanwhile
+    std::atomic<int> copyMismatches = 0;
+    std::thread copyEdits([&] {
+        for (int i = 0; i < 1000; i++) {
+            expect(editsCopy->setCell(CPos("A1"), "copy " + std::to_string(i)));
+            if (!valueMatch(editsCopy->getValue(CPos("B1")), CValue("copy " + std::to_string(i) + "!")))
+                copyMismatches++;
+        }
+    });
+    editText(1000);
+    copyEdits.join();
+    assert(copyMismatches == 0 && valueMatch(editsCopy->getValue(CPos("B1")), CValue("copy 999!")));
+    expect(edits.stringCount() < 200);
+    editsCopy.reset();
+    editText(100);
+    expect(edits.stringCount() < 100);
+
 // *—————————————————————————————————————————————————Progtest Tests——————————————————————————————————————————————————————* //
 
     CSpreadsheet x0, x1;
@@ -1851,4 +9875,6 @@ int main() {
     return EXIT_SUCCESS;
 }
 
+#endif /* SPREADSHEET_BENCHMARK */
+
 #endif /* __PROGTEST__ */
\ No newline at end of file